@@ -0,0 +1,392 @@
+#ifndef _CACHE_SNAPSHOT_
+#define _CACHE_SNAPSHOT_
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "Crc32c.h"
+
+/**
+ * @brief Writes snapshot files. \n
+ *
+ * A snapshot file is laid out as:
+ *   - a header: the magic "DSCS" and the format version (uint32)
+ *   - blocks of records, each with a block header: flags, record count, stored size, raw size and
+ *     the CRC32C of the stored bytes (all uint32). A block is stored deflate compressed when
+ *     BLOCK_COMPRESSED is set in its flags.
+ *   - an index: the file offset (uint64) and record count (uint32) of every block
+ *   - a footer: the offset of the index (uint64), the number of blocks (uint32), the CRC32C of
+ *     the index (uint32) and the magic "DSCI"
+ *
+ * A record is a flags byte, the key and value lengths (uint32) and the key and value bytes.
+ * All integers are little endian. The writer uses no iostreams and takes no locks of its own,
+ * but it does allocate memory and calls zlib to compress blocks. That is safe in a child process
+ * created with fork() as long as the allocator is reset in the child, as glibc's is (it is not
+ * async-signal-safe in general). The file is written under
+ * a temporary name and renamed into place when it is finished, so a partially written snapshot is
+ * never visible.
+ *
+ */
+class CacheSnapshotWriter
+{
+public:
+    static const uint32_t VERSION = 2;
+    static const uint8_t FLAG_MODIFIED = 0x1;
+    static const uint32_t BLOCK_COMPRESSED = 0x1;
+    static const size_t HEADER_SIZE = 8;
+    static const size_t BLOCK_HEADER_SIZE = 20;
+    static const size_t INDEX_ENTRY_SIZE = 12;
+    static const size_t FOOTER_SIZE = 20;
+
+    /**
+     * @brief Construct a new Cache Snapshot Writer object
+     *
+     * @param path The file name of the snapshot
+     * @param compress Whether to deflate compress the blocks (blocks that do not shrink are stored raw)
+     * @param block_size The number of record bytes to collect before a block is written out
+     */
+    CacheSnapshotWriter(const std::string& path, bool compress = false, size_t block_size = 64 * 1024) :
+        m_path(path),
+        m_tmp_path(path + ".tmp"),
+        m_compress(compress),
+        m_block_size(block_size),
+        m_block_records(0),
+        m_offset(0)
+    {
+        m_fd = ::open(m_tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        m_ok = m_fd >= 0;
+        m_block.reserve(m_block_size);
+
+        std::string header("DSCS", 4);
+        appendU32(header, VERSION);
+        writeOut(header);
+    }
+
+    /**
+     * @brief Destroy the Cache Snapshot Writer object, discarding the snapshot if it was not finished
+     */
+    ~CacheSnapshotWriter()
+    {
+        if (m_fd >= 0)
+        {
+            ::close(m_fd);
+            ::unlink(m_tmp_path.c_str());
+        }
+    }
+
+    CacheSnapshotWriter(const CacheSnapshotWriter&) = delete;
+    CacheSnapshotWriter& operator=(const CacheSnapshotWriter&) = delete;
+
+    /**
+     * @brief Adds an entry to the snapshot
+     *
+     * @param key The key of the entry
+     * @param value The value of the entry
+     * @param modified Whether the value has been modified since it was last written to the database
+     */
+    void add(const std::string& key, const std::string& value, bool modified)
+    {
+        m_block.push_back(static_cast<char>(modified ? FLAG_MODIFIED : 0));
+        appendU32(m_block, static_cast<uint32_t>(key.size()));
+        appendU32(m_block, static_cast<uint32_t>(value.size()));
+        m_block.append(key);
+        m_block.append(value);
+        ++m_block_records;
+
+        if (m_block.size() >= m_block_size)
+        {
+            writeBlock();
+        }
+    }
+
+    /**
+     * @brief Writes out the last block and the index, syncs the file to disk and moves it into place
+     *
+     * @return true If the snapshot was written successfully
+     * @return false If writing the snapshot failed
+     */
+    bool finish()
+    {
+        if (m_fd < 0)
+        {
+            return false;
+        }
+        writeBlock();
+
+        // The index lets a reader find (and check) every block without scanning the file
+        std::string index;
+        for (size_t i = 0; i < m_index_offsets.size(); ++i)
+        {
+            appendU64(index, m_index_offsets[i]);
+            appendU32(index, m_index_counts[i]);
+        }
+        std::string footer;
+        appendU64(footer, m_offset);
+        appendU32(footer, static_cast<uint32_t>(m_index_offsets.size()));
+        appendU32(footer, Crc32c::compute(index.data(), index.size()));
+        footer.append("DSCI", 4);
+        writeOut(index);
+        writeOut(footer);
+
+        m_ok = m_ok && ::fsync(m_fd) == 0;
+        m_ok = ::close(m_fd) == 0 && m_ok;
+        m_fd = -1;
+        m_ok = m_ok && std::rename(m_tmp_path.c_str(), m_path.c_str()) == 0;
+        if (!m_ok)
+        {
+            ::unlink(m_tmp_path.c_str());
+        }
+        return m_ok;
+    }
+
+    static void appendU32(std::string& out, uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            out.push_back(static_cast<char>(value >> (8 * i)));
+        }
+    }
+
+    static void appendU64(std::string& out, uint64_t value)
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            out.push_back(static_cast<char>(value >> (8 * i)));
+        }
+    }
+
+private:
+    std::string m_path;
+    std::string m_tmp_path;
+    bool m_compress;
+    size_t m_block_size;
+    int m_fd;
+    bool m_ok;
+
+    std::string m_block;
+    uint32_t m_block_records;
+    uint64_t m_offset;
+    std::vector<uint64_t> m_index_offsets;
+    std::vector<uint32_t> m_index_counts;
+
+    void writeBlock()
+    {
+        if (m_block_records == 0)
+        {
+            return;
+        }
+
+        uint32_t flags = 0;
+        const std::string* stored = &m_block;
+        std::string compressed;
+        if (m_compress)
+        {
+            uLongf compressedSize = compressBound(static_cast<uLong>(m_block.size()));
+            compressed.resize(compressedSize);
+            int status = compress2(reinterpret_cast<Bytef*>(&compressed[0]), &compressedSize,
+                                   reinterpret_cast<const Bytef*>(m_block.data()), static_cast<uLong>(m_block.size()), Z_BEST_SPEED);
+            if (status == Z_OK && compressedSize < m_block.size())
+            {
+                compressed.resize(compressedSize);
+                stored = &compressed;
+                flags |= BLOCK_COMPRESSED;
+            }
+        }
+
+        std::string header;
+        appendU32(header, flags);
+        appendU32(header, m_block_records);
+        appendU32(header, static_cast<uint32_t>(stored->size()));
+        appendU32(header, static_cast<uint32_t>(m_block.size()));
+        appendU32(header, Crc32c::compute(stored->data(), stored->size()));
+
+        m_index_offsets.push_back(m_offset);
+        m_index_counts.push_back(m_block_records);
+        writeOut(header);
+        writeOut(*stored);
+
+        m_block.clear();
+        m_block_records = 0;
+    }
+
+    void writeOut(const std::string& data)
+    {
+        size_t written = 0;
+        while (m_ok && written < data.size())
+        {
+            ssize_t result = ::write(m_fd, data.data() + written, data.size() - written);
+            if (result < 0)
+            {
+                m_ok = false;
+                break;
+            }
+            written += static_cast<size_t>(result);
+        }
+        m_offset += data.size();
+    }
+};
+
+/**
+ * @brief Reads snapshot files written by CacheSnapshotWriter. \n
+ * The file is memory mapped and walked through the block index, so reading it takes no
+ * system calls per record. Every block is checked against its checksum before it is used.
+ */
+class CacheSnapshotReader
+{
+public:
+    typedef std::function<void(const std::string& key, const std::string& value, bool modified)> entry_callback;
+
+    /**
+     * @brief Reads every entry of a snapshot, in the order they were written
+     *
+     * @param path The file name of the snapshot
+     * @param callback Called with every entry in the snapshot
+     * @return true If the whole snapshot was read
+     * @return false If the snapshot could not be opened or is corrupt (entries from blocks before
+     * the corrupt one may already have been passed to the callback)
+     */
+    static bool read(const std::string& path, const entry_callback& callback)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < CacheSnapshotWriter::HEADER_SIZE + CacheSnapshotWriter::FOOTER_SIZE)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        size_t size = static_cast<size_t>(info.st_size);
+        void* mapping = ::mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            return false;
+        }
+        // The blocks are read front to back, once
+        ::madvise(mapping, size, MADV_SEQUENTIAL);
+
+        bool success = readMapped(static_cast<const unsigned char*>(mapping), size, callback);
+        ::munmap(mapping, size);
+        return success;
+    }
+
+private:
+    static bool readMapped(const unsigned char* data, size_t size, const entry_callback& callback)
+    {
+        if (std::memcmp(data, "DSCS", 4) != 0 || readU32(data + 4) != CacheSnapshotWriter::VERSION)
+        {
+            return false;
+        }
+
+        const unsigned char* footer = data + size - CacheSnapshotWriter::FOOTER_SIZE;
+        if (std::memcmp(footer + 16, "DSCI", 4) != 0)
+        {
+            return false;
+        }
+        uint64_t indexOffset = readU64(footer);
+        uint64_t blockCount = readU32(footer + 8);
+        // Checked piece by piece, so that no sum of values read from the file can wrap around
+        if (indexOffset < CacheSnapshotWriter::HEADER_SIZE ||
+            indexOffset > size - CacheSnapshotWriter::FOOTER_SIZE ||
+            blockCount * CacheSnapshotWriter::INDEX_ENTRY_SIZE != size - CacheSnapshotWriter::FOOTER_SIZE - indexOffset ||
+            Crc32c::compute(data + indexOffset, blockCount * CacheSnapshotWriter::INDEX_ENTRY_SIZE) != readU32(footer + 12))
+        {
+            return false;
+        }
+
+        std::string decompressed;
+        std::string key;
+        std::string value;
+        for (uint64_t b = 0; b < blockCount; ++b)
+        {
+            const unsigned char* entry = data + indexOffset + b * CacheSnapshotWriter::INDEX_ENTRY_SIZE;
+            uint64_t offset = readU64(entry);
+            if (offset < CacheSnapshotWriter::HEADER_SIZE || offset > indexOffset ||
+                indexOffset - offset < CacheSnapshotWriter::BLOCK_HEADER_SIZE)
+            {
+                return false;
+            }
+
+            const unsigned char* header = data + offset;
+            uint32_t flags = readU32(header);
+            uint32_t records = readU32(header + 4);
+            uint32_t storedSize = readU32(header + 8);
+            uint32_t rawSize = readU32(header + 12);
+            const unsigned char* stored = header + CacheSnapshotWriter::BLOCK_HEADER_SIZE;
+            if (records != readU32(entry + 8) || storedSize > indexOffset - offset - CacheSnapshotWriter::BLOCK_HEADER_SIZE ||
+                Crc32c::compute(stored, storedSize) != readU32(header + 16))
+            {
+                return false;
+            }
+
+            const unsigned char* raw = stored;
+            if (flags & CacheSnapshotWriter::BLOCK_COMPRESSED)
+            {
+                decompressed.resize(rawSize);
+                uLongf decompressedSize = rawSize;
+                if (uncompress(reinterpret_cast<Bytef*>(&decompressed[0]), &decompressedSize, stored, storedSize) != Z_OK ||
+                    decompressedSize != rawSize)
+                {
+                    return false;
+                }
+                raw = reinterpret_cast<const unsigned char*>(decompressed.data());
+            }
+            else if (storedSize != rawSize)
+            {
+                return false;
+            }
+
+            // Walk the records of the block
+            const unsigned char* pos = raw;
+            const unsigned char* end = raw + rawSize;
+            for (uint32_t r = 0; r < records; ++r)
+            {
+                if (end - pos < 9)
+                {
+                    return false;
+                }
+                bool modified = (pos[0] & CacheSnapshotWriter::FLAG_MODIFIED) != 0;
+                uint32_t keySize = readU32(pos + 1);
+                uint32_t valueSize = readU32(pos + 5);
+                pos += 9;
+                if (static_cast<uint64_t>(end - pos) < static_cast<uint64_t>(keySize) + valueSize)
+                {
+                    return false;
+                }
+                key.assign(reinterpret_cast<const char*>(pos), keySize);
+                value.assign(reinterpret_cast<const char*>(pos + keySize), valueSize);
+                pos += keySize + valueSize;
+                callback(key, value, modified);
+            }
+        }
+
+        return true;
+    }
+
+    static uint32_t readU32(const unsigned char* bytes)
+    {
+        return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) |
+               (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+    }
+
+    static uint64_t readU64(const unsigned char* bytes)
+    {
+        return static_cast<uint64_t>(readU32(bytes)) | (static_cast<uint64_t>(readU32(bytes + 4)) << 32);
+    }
+};
+
+#endif /* _CACHE_SNAPSHOT_ */
@@ -0,0 +1,195 @@
+#ifndef _COMPRESSED_CACHE_
+#define _COMPRESSED_CACHE_
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <functional>
+#include <iterator>
+
+#include "ValueCodec.h"
+
+/**
+ * @brief A byte bounded LRU cache that keeps its values compressed. \n
+ *
+ * Used as a second tier behind the DataStore LRU: values evicted from memory are compressed into
+ * it, and a hit decompresses the value and hands it back (removing it from this tier), which is
+ * far cheaper than reading it from the database. Values that do not compress are kept as they are.
+ *
+ */
+class CompressedCache
+{
+public:
+    typedef std::function<void(const std::string& key, const std::string& data, bool compressed)> evict_callback;
+
+    /**
+     * @brief Construct a new Compressed Cache object
+     *
+     * @param max_bytes The maximum number of bytes (keys, values and bookkeeping) to keep
+     * @param codec The codec to compress values with (must outlive the cache)
+     * @param on_evict Called with every value that is evicted to make room, as it is stored in 
+     * the cache (so it can be passed on to a further tier without recompressing it)
+     */
+    CompressedCache(size_t max_bytes, const ValueCodec& codec, const evict_callback& on_evict = evict_callback()) :
+        m_max_bytes(max_bytes),
+        m_bytes(0),
+        m_codec(codec),
+        m_on_evict(on_evict)
+    {
+    }
+
+    /**
+     * @brief Adds (or replaces) a value, evicting the least recently added values if needed
+     *
+     * @param key The key of the value
+     * @param value The value to keep
+     */
+    void put(const std::string& key, const std::string& value)
+    {
+        erase(key);
+
+        Entry entry;
+        entry.key = key;
+        entry.compressed = m_codec.encode(value, entry.data);
+        if (!entry.compressed)
+        {
+            entry.data = value;
+        }
+        entry.data.shrink_to_fit();
+
+        // Values too big for the whole tier are not worth evicting everything for
+        size_t bytes = entryBytes(entry);
+        if (bytes > m_max_bytes)
+        {
+            if (m_on_evict)
+            {
+                m_on_evict(entry.key, entry.data, entry.compressed);
+            }
+            return;
+        }
+
+        while (m_bytes + bytes > m_max_bytes && !m_list.empty())
+        {
+            auto lastItr = std::prev(m_list.end());
+            if (m_on_evict)
+            {
+                m_on_evict(lastItr->key, lastItr->data, lastItr->compressed);
+            }
+            removeEntry(lastItr);
+        }
+
+        m_list.push_front(std::move(entry));
+        m_map[key] = m_list.begin();
+        m_bytes += bytes;
+    }
+
+    /**
+     * @brief Removes a value from the cache and returns it
+     *
+     * @param key The key of the value
+     * @param value The (decompressed) value
+     * @return true If the value was in the cache
+     * @return false If the value was not in the cache
+     */
+    bool take(const std::string& key, std::string& value)
+    {
+        auto mapItr = m_map.find(key);
+        if (mapItr == m_map.end())
+        {
+            return false;
+        }
+
+        const Entry& entry = *mapItr->second;
+        bool success = true;
+        if (entry.compressed)
+        {
+            success = m_codec.decode(entry.data.data(), entry.data.size(), value);
+        }
+        else
+        {
+            value = entry.data;
+        }
+        removeEntry(mapItr->second);
+        return success;
+    }
+
+    /**
+     * @brief Removes a value from the cache
+     *
+     * @param key The key of the value
+     * @return true If the value was in the cache
+     * @return false If the value was not in the cache
+     */
+    bool erase(const std::string& key)
+    {
+        auto mapItr = m_map.find(key);
+        if (mapItr == m_map.end())
+        {
+            return false;
+        }
+        removeEntry(mapItr->second);
+        return true;
+    }
+
+    /**
+     * @brief Removes every value from the cache
+     */
+    void clear()
+    {
+        m_list.clear();
+        m_map.clear();
+        m_bytes = 0;
+    }
+
+    /**
+     * @brief Gets the number of values in the cache
+     *
+     * @return size_t The number of values
+     */
+    size_t size() const
+    {
+        return m_map.size();
+    }
+
+    /**
+     * @brief Gets the number of bytes the cache accounts for
+     *
+     * @return size_t The number of bytes
+     */
+    size_t bytes() const
+    {
+        return m_bytes;
+    }
+
+private:
+    struct Entry
+    {
+        std::string key;
+        std::string data;
+        bool compressed;
+    };
+
+    // Rough cost of the list node, map node and string headers of an entry
+    static const size_t ENTRY_OVERHEAD = 128;
+
+    size_t m_max_bytes;
+    size_t m_bytes;
+    const ValueCodec& m_codec;
+    evict_callback m_on_evict;
+    std::list<Entry> m_list;
+    std::unordered_map<std::string, std::list<Entry>::iterator> m_map;
+
+    static size_t entryBytes(const Entry& entry)
+    {
+        return ENTRY_OVERHEAD + 2 * entry.key.size() + entry.data.capacity();
+    }
+
+    void removeEntry(std::list<Entry>::iterator entryItr)
+    {
+        m_bytes -= entryBytes(*entryItr);
+        m_map.erase(entryItr->key);
+        m_list.erase(entryItr);
+    }
+};
+
+#endif /* _COMPRESSED_CACHE_ */
@@ -0,0 +1,110 @@
+#ifndef _CRC32C_
+#define _CRC32C_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define DATASTORE_HAVE_SSE42_CRC 1
+#endif
+
+/**
+ * @brief CRC32C (Castagnoli) checksums. \n
+ *
+ * Uses the SSE4.2 crc32 instruction when the CPU supports it, and a table driven
+ * implementation otherwise. Both produce the same (standard, reflected) CRC32C.
+ *
+ */
+class Crc32c
+{
+public:
+    /**
+     * @brief Computes the CRC32C of a buffer
+     *
+     * @param data The data to checksum
+     * @param size The number of bytes to checksum
+     * @param crc The CRC of any preceding data, to checksum a buffer in pieces
+     * @return uint32_t The CRC32C
+     */
+    static uint32_t compute(const void* data, size_t size, uint32_t crc = 0)
+    {
+#ifdef DATASTORE_HAVE_SSE42_CRC
+        static const bool hardware = __builtin_cpu_supports("sse4.2");
+        if (hardware)
+        {
+            return computeHardware(static_cast<const unsigned char*>(data), size, crc);
+        }
+#endif
+        return computeSoftware(static_cast<const unsigned char*>(data), size, crc);
+    }
+
+    /**
+     * @brief Computes the CRC32C of a buffer without the crc32 instruction
+     *
+     * @param data The data to checksum
+     * @param size The number of bytes to checksum
+     * @param crc The CRC of any preceding data
+     * @return uint32_t The CRC32C
+     */
+    static uint32_t computeSoftware(const unsigned char* data, size_t size, uint32_t crc = 0)
+    {
+        static const Table table;
+
+        crc = ~crc;
+        for (size_t i = 0; i < size; ++i)
+        {
+            crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+private:
+    struct Table
+    {
+        uint32_t entries[256];
+
+        Table()
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; ++bit)
+                {
+                    crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78u : crc >> 1;
+                }
+                entries[i] = crc;
+            }
+        }
+    };
+
+#ifdef DATASTORE_HAVE_SSE42_CRC
+    __attribute__((target("sse4.2")))
+    static uint32_t computeHardware(const unsigned char* data, size_t size, uint32_t crc)
+    {
+        uint64_t crc64 = ~crc;
+
+        // Eight bytes at a time, then the remainder one byte at a time
+        while (size >= 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, data, 8);
+            crc64 = _mm_crc32_u64(crc64, word);
+            data += 8;
+            size -= 8;
+        }
+
+        uint32_t crc32 = static_cast<uint32_t>(crc64);
+        while (size > 0)
+        {
+            crc32 = _mm_crc32_u8(crc32, *data);
+            ++data;
+            --size;
+        }
+        return ~crc32;
+    }
+#endif
+};
+
+#endif /* _CRC32C_ */
@@ -3,10 +3,169 @@
 
 #include <iostream>
 #include <sstream>
+#include <fstream>
 #include <list>
+#include <vector>
 #include <unordered_map>
+#include <set>
+#include <memory>
+#include <stdexcept>
+#include <algorithm>
+#include <iterator>
+#include <functional>
+#include <cstdint>
+#include <thread>
+#include <chrono>
+#include <cerrno>
 #include <sqlite3.h> 
 
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ParallelFor.h"
+#include "KeyHash.h"
+#include "HugePageArena.h"
+#include "CacheSnapshot.h"
+#include "ValueCodec.h"
+#include "CompressedCache.h"
+#include "FlashCache.h"
+#include "SharedCacheSegment.h"
+#include "ReadAheadVfs.h"
+
+/**
+ * @brief Tuning options for a DataStore and the sqlite database backing it
+ */
+struct DataStoreOptions
+{
+    /** Name of a registered sqlite VFS to open the database with (empty for the default VFS) */
+    std::string vfs;
+
+    /** Database page size in bytes, applied when the database is created (0 for the sqlite default) */
+    int page_size = 0;
+
+    /** Size of sqlite's own page cache in KiB (0 for the sqlite default) */
+    int page_cache_kb = 0;
+
+    /** Maximum number of bytes of the database file to access through memory mapped I/O (0 to disable) */
+    long long mmap_size = 0;
+
+    /** 
+     * Open the database files through a ReadAheadVfs layer (over vfs), which has the kernel read 
+     * this many bytes ahead of scans while leaving single key lookups alone (0 to disable). Has no 
+     * effect on the part of the file accessed through mmap_size.
+     */
+    long long read_ahead_bytes = 0;
+
+    /** 
+     * Number of database files to spread the keys over by hash. Each partition has its own 
+     * connection and file lock, so writes to different partitions do not serialize. With more 
+     * than one partition, partition i is stored in "<dataStoreName>.<i>". The same number of 
+     * partitions must be used every time a given data store is opened.
+     */
+    size_t partitions = 1;
+
+    /** 
+     * Keep the modified cache entries in an ordered index as well, so range scans find the 
+     * cached values in their range without looking through the whole cache
+     */
+    bool ordered_index = false;
+
+    /** Compress values (with deflate) before writing them to the database */
+    bool compression = false;
+
+    /** Values smaller than this many bytes are always written uncompressed */
+    size_t compression_min_size = 64;
+
+    /** The zlib compression level (1 is fastest, 9 is smallest) */
+    int compression_level = 1;
+
+    /** 
+     * Size in bytes of a second cache tier that keeps values evicted from the LRU cache in 
+     * compressed form, so they can be served without going to the database (0 to disable)
+     */
+    size_t compressed_tier_bytes = 0;
+
+    /** 
+     * File (ideally on a local SSD) for a cache tier below the in memory ones, kept as a 
+     * circular log of evicted values. The file is recreated on open and removed on close.
+     */
+    std::string flash_tier_path;
+
+    /** Size in bytes of the flash cache tier file (0 to disable) */
+    size_t flash_tier_bytes = 0;
+
+    /** 
+     * Name of a POSIX shared memory segment (e.g. "/datastore") to share cached values through 
+     * with every other process on the host that uses the same name (empty to disable). Values 
+     * are published to it when they are put or read from the database, and it is checked before 
+     * the database on a miss.
+     */
+    std::string shared_segment_name;
+
+    /** Number of slots in the shared segment, if this process is the one to create it */
+    size_t shared_segment_slots = 65536;
+
+    /** Bytes per slot (for the key and value) in the shared segment, if this process is the one to create it */
+    size_t shared_segment_slot_size = 1024;
+
+    /** 
+     * Watch for writes made to the database through other connections (usually by other 
+     * processes), and drop the cached copies of just the keys they changed. Turning this on 
+     * installs triggers that log every changed key in a changes table, which every writer to the 
+     * database fills from then on, whether or not it watches for changes itself. The writer's 
+     * database is put in WAL mode, so the readers do not block it (nor it them).
+     */
+    bool change_tracking = false;
+
+    /** Minimum number of milliseconds between two checks for changes (0 to check on every read) */
+    int change_check_interval_ms = 0;
+
+    /** 
+     * Number of changes the log keeps (set by the first process to turn change tracking on for a 
+     * database). A process that falls further behind than that drops everything it has cached.
+     */
+    long long change_log_size = 100000;
+
+    /** 
+     * Open the database read only, e.g. for a replica that serves reads from a file another 
+     * process writes to. put and the other write operations throw std::logic_error, and 
+     * nothing is ever tracked as modified or written back. Combine with change_tracking (which 
+     * the writer must have turned on as well) to follow the writer's changes.
+     */
+    bool read_only = false;
+
+    /** 
+     * Size in bytes of address space to reserve for an arena backed by 2 MiB huge pages, that the 
+     * nodes and buckets of the LRU cache's list and hash table are allocated from, to cut TLB 
+     * misses on lookups in large caches (0 to allocate them from the heap). The keys and values 
+     * themselves stay on the heap. Memory is only used as the cache grows, and allocations that 
+     * no longer fit go to the heap.
+     */
+    size_t cache_arena_bytes = 0;
+
+    /** 
+     * Back the cache arena with pages from hugetlbfs (which have to be reserved beforehand, e.g. 
+     * through /proc/sys/vm/nr_hugepages) rather than transparent huge pages. Falls back to 
+     * transparent huge pages if not enough are reserved.
+     */
+    bool cache_arena_hugetlbfs = false;
+
+    /** 
+     * Put the database in WAL (write-ahead log) mode, so readers on other connections never block 
+     * the writer and each see a single committed point in time. snapshot then copies the data store 
+     * as it was at the call, however much it is written to while the copy is made. Always on with 
+     * change_tracking, since the database is then shared with other connections.
+     */
+    bool wal = false;
+
+    /** 
+     * Milliseconds to keep retrying when the database is locked by another connection, before a 
+     * read or write fails with SQLITE_BUSY
+     */
+    int busy_timeout_ms = 5000;
+};
+
 /**
  * @brief A data storage class utilizing an LRU Cache in front of a sqlite database. \n 
  * 
@@ -17,33 +176,72 @@ class DataStore
 {
 public:
     typedef std::pair<std::string, std::string> key_val_pair;
-    typedef std::list<key_val_pair>::iterator list_itr;
+    typedef std::list<key_val_pair, ArenaAllocator<key_val_pair>> cache_list;
+    typedef cache_list::iterator list_itr;
+    // Called with a key changed through another connection, or nullptr if any key may have changed
+    typedef std::function<void(const std::string* key)> change_callback;
 
     /**
      * @brief Construct a new Data Store object
      * 
      * @param max_cache_size The maximum size of the LRU cache
      * @param dataStoreName The name to use for the sqlite database (defaults to "DataStore.db")
+     * @param options Tuning options for the sqlite backing store
      */
-    DataStore(size_t max_cache_size, std::string dataStoreName = "DataStore.db") :
-        m_max_cache_size(max_cache_size) 
+    DataStore(size_t max_cache_size, std::string dataStoreName = "DataStore.db", 
+              const DataStoreOptions& options = DataStoreOptions()) :
+        m_cache_arena(options.cache_arena_bytes > 0 ? new HugePageArena(options.cache_arena_bytes, options.cache_arena_hugetlbfs) : nullptr),
+        m_cache_list(ArenaAllocator<key_val_pair>(m_cache_arena.get())),
+        m_cache_map(0, std::hash<std::string>(), std::equal_to<std::string>(), ArenaAllocator<std::pair<const std::string, list_itr>>(m_cache_arena.get())),
+        m_max_cache_size(max_cache_size),
+        m_options(options),
+        m_codec(options.compression_min_size, options.compression_level)
     {
-        // Initialize database
-        int status = sqlite3_open(dataStoreName.c_str(), &m_db);
-        if (status)
+        if (!m_options.shared_segment_name.empty())
         {
-            throw std::runtime_error("Failed to open database: " + std::string(sqlite3_errmsg(m_db)));
+            m_shared_segment.reset(new SharedCacheSegment(m_options.shared_segment_name, m_options.shared_segment_slots, 
+                                                          m_options.shared_segment_slot_size));
         }
 
-        // Create the table in the database to store the values (but only if it does not already exist)
-        char* errMsg = nullptr;
-        const char* createTblSql = "CREATE TABLE IF NOT EXISTS data (key CHAR PRIMARY KEY, value TEXT)";
-        status = sqlite3_exec(m_db, createTblSql, NULL, nullptr, &errMsg);
-        if (status != SQLITE_OK)
+        // Values evicted from memory go to the flash tier (if there is one) on their way out
+        if (!m_options.flash_tier_path.empty() && m_options.flash_tier_bytes > 0)
         {
-            std::string error(errMsg);
-            sqlite3_free(errMsg);
-            throw std::runtime_error("SQL error ocurred: " + error);
+            m_flash_tier.reset(new FlashCache(m_options.flash_tier_path, m_options.flash_tier_bytes));
+        }
+        if (m_options.compressed_tier_bytes > 0)
+        {
+            CompressedCache::evict_callback toFlash;
+            if (m_flash_tier)
+            {
+                toFlash = [this](const std::string& key, const std::string& data, bool compressed) {
+                    m_flash_tier->put(key, data, compressed);
+                };
+            }
+            m_compressed_tier.reset(new CompressedCache(m_options.compressed_tier_bytes, m_codec, toFlash));
+        }
+
+        if (m_options.partitions == 0)
+        {
+            throw std::invalid_argument("A data store needs at least one partition");
+        }
+
+        // Initialize the database for each partition
+        try
+        {
+            for (size_t i = 0; i < m_options.partitions; ++i)
+            {
+                m_dbs.push_back(openDatabase(partitionPath(dataStoreName, i, m_options.partitions)));
+            }
+            loadDictionaries();
+            if (m_options.change_tracking)
+            {
+                startWatchingChanges();
+            }
+        }
+        catch (...)
+        {
+            closeDatabases();
+            throw;
         }
     }
 
@@ -53,61 +251,27 @@ public:
     ~DataStore()
     {
         // Purge the cache to persistent storage
-        if (!m_cache_list.empty())
+        if (!m_cache_list.empty() && !m_options.read_only)
         {
             purgeToStorage();
         }
         // Close out database and clean up memory
-        sqlite3_close(m_db);
+        closeDatabases();
     }
 
+    DataStore(const DataStore&) = delete;
+    DataStore& operator=(const DataStore&) = delete;
+
     /**
-     * @brief Store a value into the data store
+     * @brief Store a value into the data store (throws std::logic_error if it is read only)
      * 
      * @param key Key to reference item by
      * @param value Value to store
      */
     void put(const std::string& key, const std::string& value)
     {
-        // Look for the item in the cache
-        auto mapItr = m_cache_map.find(key);
-
-        // Add the item to the history list at the front (because it was just accessed)
-        m_cache_list.push_front(key_val_pair(key, value));
-
-        if (mapItr != m_cache_map.end())
-        {
-            // Remove it from it's old position in the list if it existed
-            m_cache_list.erase(mapItr->second);
-        }
-
-        // Add the list location to the cache
-        m_cache_map[key] = m_cache_list.begin();
-
-        // Mark it as modified
-        m_modification_map[key] = true;
-
-        // If we are exceeding the size of the cache, we need to purge the oldest 
-        // element to the persistent store
-        if (m_cache_map.size() > m_max_cache_size)
-        {
-            // Get the last element in the history list (least recently used)
-            // and remove it from the cache.
-            auto end_itr = m_cache_list.rbegin();
-            m_cache_map.erase(end_itr->first);
-            m_modification_map.erase(end_itr->first);
-
-            // Save the data and remove it from the history list
-            key_val_pair lastElem = m_cache_list.back();
-            m_cache_list.pop_back();
-
-            // Write the data to the persistent store, only if it has
-            // been modified
-            if (isModified(lastElem.first))
-            {
-                writeToDB(lastElem.first, lastElem.second);
-            }
-        }
+        requireWritable();
+        cacheValue(key, value, true);
     }
 
     /**
@@ -118,6 +282,8 @@ public:
      */
     std::string get(const std::string& key)
     {
+        checkForChanges();
+
         // Look for the item in the cache
         auto mapItr = m_cache_map.find(key);
         if (mapItr != m_cache_map.end())
@@ -128,17 +294,16 @@ public:
         }
         else 
         {
-            // Cache miss, get value from persistent store and put it in cache
+            // Cache miss, get value from the lower cache tiers or the persistent store and put it in cache
             std::string value;
-            bool success = readFromDB(key, value);
+            bool success = takeFromTiers(key, value) || readFromDB(key, value);
             if (success)
             {
                 // If we succesfully retrieved the value, put it into the cache as the 
                 // most recently accessed item. Then, get that item from the cache
-                // and return the value
-                put(key, value);
-                // Since we just retrieved it from the database, it isnt really modified, yet
-                m_modification_map[key] = false; 
+                // and return the value. Since we just retrieved it from the database, 
+                // it isnt really modified, yet
+                cacheValue(key, value, false);
 
                 mapItr = m_cache_map.find(key);
                 if (mapItr != m_cache_map.end())
@@ -155,140 +320,2151 @@ public:
     }
 
     /**
-     * @brief Checks to see if the provided value exists in the cache. \n
-     * Note: this does not check if it exists in the persistent storage
+     * @brief Remove a value from the data store (throws std::logic_error if it is read only). \n
+     * The value is dropped from the cache and the lower cache tiers, and deleted from the 
+     * persistent store.
      * 
-     * @param key The key to check for
-     * @return true if the key is in the cache
-     * @return false if the key is not in the cache
+     * @param key The key to remove
+     * @return true If the key existed
+     * @return false If the key did not exist (or deleting it from the persistent store failed)
      */
-    bool isInCache(const std::string& key)
+    bool erase(const std::string& key)
     {
-        return m_cache_map.find(key) != m_cache_map.end();
+        requireWritable();
+
+        bool found = false;
+        auto mapItr = m_cache_map.find(key);
+        if (mapItr != m_cache_map.end())
+        {
+            found = true;
+            list_itr listItr = mapItr->second;
+            m_modified_index.erase(&key);
+            m_modification_map.erase(key);
+            m_cache_map.erase(mapItr);
+            m_cache_list.erase(listItr);
+        }
+        invalidateTiers(key);
+
+        return deleteFromDB(key) || found;
     }
 
     /**
-     * @brief Gets the current size of the cache
+     * @brief Get several values from the data store at once. \n
+     * All of the keys that miss the cache are looked up in the persistent store 
+     * with a single batched query rather than one query per key.
      * 
-     * @return size_t The current size of the cache
+     * @param keys The keys to retrieve
+     * @return std::vector<std::string> The stored values, in the same order as the keys 
+     * (empty strings for keys that do not exist)
      */
-    size_t size()
+    std::vector<std::string> getMany(const std::vector<std::string>& keys)
     {
-        return m_cache_map.size();
-    }
+        checkForChanges();
 
-private:
-    std::list<key_val_pair> m_cache_list;
-    std::unordered_map<std::string, list_itr> m_cache_map;
-    std::unordered_map<std::string, bool> m_modification_map; 
+        std::vector<std::string> values(keys.size());
+        std::vector<std::string> missedKeys;
 
-    size_t m_max_cache_size;
+        // Serve everything we can from the cache first
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            auto mapItr = m_cache_map.find(keys[i]);
+            if (mapItr != m_cache_map.end())
+            {
+                m_cache_list.splice(m_cache_list.begin(), m_cache_list, mapItr->second);
+                values[i] = mapItr->second->second;
+            }
+            else
+            {
+                missedKeys.push_back(keys[i]);
+            }
+        }
+
+        if (missedKeys.empty())
+        {
+            return values;
+        }
+
+        // Look up the misses in the lower cache tiers, then all of the rest in one go
+        std::unordered_map<std::string, std::string> found;
+        std::vector<std::string> dbKeys;
+        for (const std::string& key : missedKeys)
+        {
+            std::string value;
+            if (takeFromTiers(key, value))
+            {
+                found[key] = value;
+            }
+            else
+            {
+                dbKeys.push_back(key);
+            }
+        }
+        if (!dbKeys.empty())
+        {
+            readManyFromDB(dbKeys, found);
+        }
+
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            auto foundItr = found.find(keys[i]);
+            if (foundItr == found.end())
+            {
+                continue;
+            }
+            values[i] = foundItr->second;
+
+            // Put it into the cache as the most recently accessed item (unless a 
+            // duplicate key already did), but since we just retrieved it from the 
+            // database, it isnt really modified
+            if (!isInCache(keys[i]))
+            {
+                cacheValue(keys[i], foundItr->second, false);
+            }
+        }
 
-    sqlite3 *m_db;
+        return values;
+    }
 
     /**
-     * @brief Writes a value to the persistent store
+     * @brief Loads values from the persistent store into the cache until it is full 
+     * (or the store runs out of values). The partitions are read in parallel.
      * 
-     * @param key The key to write
-     * @param value The value to save
-     * @return true If the write was successful
-     * @return false If the write failed
+     * @return size_t The number of values that were loaded
      */
-    bool writeToDB(const std::string& key, const std::string& value)
+    size_t warmUp()
     {
-        std::stringstream ss;
-        ss << "INSERT OR REPLACE INTO data (key, value) VALUES ( '" << key << "', '" << value << "' );";
+        if (m_cache_map.size() >= m_max_cache_size)
+        {
+            return 0;
+        }
 
-        char* errMsg = nullptr;
-        int status = sqlite3_exec(m_db, ss.str().c_str(), NULL, nullptr, &errMsg);
-        if (status != SQLITE_OK)
+        // Split what is left of the cache evenly over the partitions
+        size_t room = m_max_cache_size - m_cache_map.size();
+        size_t perPartition = (room + m_dbs.size() - 1) / m_dbs.size();
+
+        std::vector<std::vector<key_val_pair>> loaded(m_dbs.size());
+        parallelFor(m_dbs.size(), [this, &loaded, perPartition](size_t i) {
+            readSomeFromPartition(m_dbs[i], perPartition, loaded[i]);
+        });
+
+        // Add them as unmodified entries, without displacing anything already cached
+        size_t count = 0;
+        for (const std::vector<key_val_pair>& partition : loaded)
         {
-            std::cerr << "SQL error ocurred: " << std::string(errMsg) << std::endl;
-            sqlite3_free(errMsg);
-            return false;
+            for (const key_val_pair& entry : partition)
+            {
+                if (m_cache_map.size() >= m_max_cache_size)
+                {
+                    return count;
+                }
+                if (isInCache(entry.first))
+                {
+                    continue;
+                }
+                m_cache_list.push_back(entry);
+                m_cache_map[entry.first] = std::prev(m_cache_list.end());
+                setModified(entry.first, false);
+                ++count;
+            }
         }
 
-        return true;
+        return count;
     }
 
     /**
-     * @brief Retrieves a value from the persistant store
+     * @brief Writes every modified value in the cache to the persistent store, keeping 
+     * the values in the cache but marking them as unmodified
      * 
-     * @param key The key to retrieve
-     * @param value The value that was retrieved
-     * @return true If the retrieve was successful
-     * @return false If the retrieve failed
+     * @return true If the flush was successful
+     * @return false If the flush failed (the values are left marked as modified)
      */
-    bool readFromDB(const std::string& key, std::string& value)
+    bool flush()
     {
-        std::stringstream ss;
-        ss << "SELECT value FROM data WHERE key = '" << key << "' LIMIT 1;";
-
-        // Created the prepared SQL statement
-        sqlite3_stmt *stmt;
-        int status = sqlite3_prepare_v2(m_db, ss.str().c_str(), -1, &stmt, NULL);
-        if (status != SQLITE_OK) {
-            std::cerr << "SQL error ocurred: " << std::string(sqlite3_errmsg(m_db));
-            sqlite3_finalize(stmt);
+        if (!purgeToStorage())
+        {
             return false;
         }
 
-        // Execute the statement
-        while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {
-            value = std::string((char *)sqlite3_column_text(stmt, 0));
-        }
-        if (status != SQLITE_DONE) {
-            std::cerr << "SQL error ocurred: " << std::string(sqlite3_errmsg(m_db));
-            sqlite3_finalize(stmt);
-            return false;
+        for (auto& modified : m_modification_map)
+        {
+            modified.second = false;
         }
-
-        // Clean up after executing the statment
-        sqlite3_finalize(stmt);
-
+        m_modified_index.clear();
         return true;
     }
 
     /**
-     * @brief Purges the remaining elements in the cache to the persistent storage
-     * 
-     * @return true If purge was succesful
-     * @return false If purge failed
+     * @brief A read transaction held open on every partition of a data store, each on a connection 
+     * of its own, which keeps seeing the data store as it was when it was pinned while the data 
+     * store goes on being written to. Made by pinSnapshot.
      */
-    bool purgeToStorage()
+    class PinnedSnapshot
     {
-        bool dataAdded = false;
+    public:
+        ~PinnedSnapshot()
+        {
+            for (sqlite3* reader : m_readers)
+            {
+                sqlite3_exec(reader, "COMMIT;", NULL, nullptr, nullptr);
+                sqlite3_close(reader);
+            }
+        }
 
-        std::stringstream ss;
-        ss << "INSERT OR REPLACE INTO data (key, value) VALUES ";
-        for (auto listItr = m_cache_list.begin(); listItr != m_cache_list.end(); ++listItr)
+        PinnedSnapshot(const PinnedSnapshot&) = delete;
+        PinnedSnapshot& operator=(const PinnedSnapshot&) = delete;
+
+        /**
+         * @brief Copies the pinned state of the data store to new database files, with the sqlite 
+         * online backup API a few pages at a time. The copy uses the same file layout as the data 
+         * store (one file per partition).
+         * 
+         * @param path The name of the copy
+         * @param pages_per_step The number of pages to copy at a time
+         * @param between_steps Called between every batch of pages, e.g. to let other work run
+         * @return true If the copy was successful
+         * @return false If the copy failed
+         */
+        bool copyTo(const std::string& path, int pages_per_step = 64, 
+                    const std::function<void()>& between_steps = std::function<void()>()) const
         {
-            // Only write it back out to the persistent storage if it has been modified
-            if (isModified(listItr->first))
+            for (size_t i = 0; i < m_readers.size(); ++i)
             {
-                ss << "( '" << listItr->first << "', '" << listItr->second << "' ),";
-                dataAdded = true;
+                if (!backupPartition(m_readers[i], partitionPath(path, i, m_readers.size()), pages_per_step, between_steps))
+                {
+                    return false;
+                }
             }
+            return true;
+        }
+
+    private:
+        friend class DataStore;
+
+        PinnedSnapshot() {}
+
+        std::vector<sqlite3*> m_readers;
+    };
+
+    /**
+     * @brief Flushes the cache and pins the data store as it is now, so it can be copied later 
+     * (or slowly) without being locked, while it goes on being written to. Only works in WAL mode.
+     * 
+     * @return std::unique_ptr<PinnedSnapshot> The pinned snapshot, or nullptr if the database is 
+     * not in WAL mode or pinning it failed
+     */
+    std::unique_ptr<PinnedSnapshot> pinSnapshot()
+    {
+        if (!m_wal || (!m_options.read_only && !flush()))
+        {
+            return nullptr;
         }
-        ss.seekp(-1, std::ios_base::end); // Remove the extra comma for the last value
-        ss << ";"; // Add the semicolon to finish the SQL statement
 
-        // Only perform the write if there is data to write
-        if (dataAdded)
+        std::unique_ptr<PinnedSnapshot> pinned(new PinnedSnapshot());
+        const char* vfs = m_options.vfs.empty() ? NULL : m_options.vfs.c_str();
+        for (sqlite3* db : m_dbs)
         {
+            sqlite3* reader = nullptr;
+            int status = sqlite3_open_v2(sqlite3_db_filename(db, "main"), &reader, SQLITE_OPEN_READONLY, vfs);
+            if (status != SQLITE_OK)
+            {
+                std::cerr << "Failed to open snapshot reader: " << std::string(sqlite3_errstr(status)) << std::endl;
+                sqlite3_close(reader);
+                return nullptr;
+            }
+            pinned->m_readers.push_back(reader);
+
+            // The read transaction only starts at the first read, and from then on sees the 
+            // database as it was at that read
+            sqlite3_busy_timeout(reader, m_options.busy_timeout_ms);
             char* errMsg = nullptr;
-            int status = sqlite3_exec(m_db, ss.str().c_str(), NULL, nullptr, &errMsg);
+            status = sqlite3_exec(reader, "BEGIN; SELECT COUNT(*) FROM sqlite_master;", NULL, nullptr, &errMsg);
             if (status != SQLITE_OK)
             {
                 std::cerr << "SQL error ocurred: " << std::string(errMsg) << std::endl;
                 sqlite3_free(errMsg);
-                return false;
+                return nullptr;
             }
         }
+        return pinned;
+    }
+
+    /**
+     * @brief Takes a copy of the data store while it stays open. \n
+     * The cache is flushed first, then each partition is copied with the sqlite online 
+     * backup API a few pages at a time, so the database is never locked for long. 
+     * The copy uses the same file layout as the data store (one file per partition). \n
+     * With the wal option the copy is of the data store as it was at the call, even if it is 
+     * written to (e.g. from between_steps) during the copy. Without it, writes made to the data 
+     * store during the copy (including evictions) may or may not end up in it.
+     * 
+     * @param path The name of the snapshot database
+     * @param pages_per_step The number of pages to copy at a time
+     * @param between_steps Called between every batch of pages, e.g. to let other work run
+     * @return true If the snapshot was successful
+     * @return false If the snapshot failed
+     */
+    bool snapshot(const std::string& path, int pages_per_step = 64, 
+                  const std::function<void()>& between_steps = std::function<void()>())
+    {
+        if (m_wal)
+        {
+            std::unique_ptr<PinnedSnapshot> pinned = pinSnapshot();
+            return pinned && pinned->copyTo(path, pages_per_step, between_steps);
+        }
+
+        if (!m_options.read_only && !flush())
+        {
+            return false;
+        }
 
+        for (size_t i = 0; i < m_dbs.size(); ++i)
+        {
+            if (!backupPartition(m_dbs[i], partitionPath(path, i, m_dbs.size()), pages_per_step, between_steps))
+            {
+                return false;
+            }
+        }
         return true;
     }
 
+    /**
+     * @brief Sets a function that change tracking calls for every key it finds was changed 
+     * through another connection, e.g. to drop copies of the value kept outside the data store. 
+     * It is called with nullptr when the data store fell too far behind to know which keys 
+     * changed. Only used with the change_tracking option.
+     * 
+     * @param callback The function to call (empty to stop calling one)
+     */
+    void setChangeCallback(const change_callback& callback)
+    {
+        m_change_callback = callback;
+    }
+
+    /**
+     * @brief Checks whether the database is in WAL mode (see the wal option)
+     * 
+     * @return true If every partition is in WAL mode
+     * @return false If it is not
+     */
+    bool walMode() const
+    {
+        return m_wal;
+    }
+
+    /**
+     * @brief Writes the contents of the cache (most recently used first) to a snapshot file
+     * 
+     * @param path The file name of the snapshot
+     * @return true If the snapshot was written successfully
+     * @return false If writing the snapshot failed
+     */
+    bool saveCache(const std::string& path)
+    {
+        CacheSnapshotWriter writer(path);
+        for (auto listItr = m_cache_list.begin(); listItr != m_cache_list.end(); ++listItr)
+        {
+            writer.add(listItr->first, listItr->second, isModified(listItr->first));
+        }
+        return writer.finish();
+    }
+
+    /**
+     * @brief Writes the contents of the cache to a snapshot file from a forked child process. \n
+     * The child works on a copy-on-write image of the cache taken at the moment of the call, 
+     * so the data store can keep being used while the snapshot is written. The child never 
+     * touches the sqlite connections it inherits and leaves with _exit, so nothing is flushed 
+     * or closed twice.
+     * 
+     * @param path The file name of the snapshot
+     * @return pid_t The process id of the child (to pass to waitForBackgroundSave), or -1 if 
+     * the fork failed
+     */
+    pid_t backgroundSave(const std::string& path)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            _exit(saveCache(path) ? 0 : 1);
+        }
+        return pid;
+    }
+
+    /**
+     * @brief Waits for a snapshot started with backgroundSave to finish
+     * 
+     * @param pid The process id returned by backgroundSave
+     * @return true If the snapshot was written successfully
+     * @return false If writing the snapshot failed
+     */
+    static bool waitForBackgroundSave(pid_t pid)
+    {
+        if (pid <= 0)
+        {
+            return false;
+        }
+
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0)
+        {
+            if (errno != EINTR)
+            {
+                return false;
+            }
+        }
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    /**
+     * @brief Loads the entries of a cache snapshot into the cache, behind anything that is 
+     * already cached. Entries that were modified when the snapshot was taken are still 
+     * treated as modified, so they are written to the database in time.
+     * 
+     * @param path The file name of the snapshot
+     * @return size_t The number of entries that were loaded
+     */
+    size_t restoreCache(const std::string& path)
+    {
+        requireWritable();
+        size_t count = 0;
+        bool success = CacheSnapshotReader::read(path, [this, &count](const std::string& key, const std::string& value, bool modified) {
+            if (isInCache(key))
+            {
+                return;
+            }
+            invalidateTiers(key);
+            if (m_cache_map.size() >= m_max_cache_size)
+            {
+                // Nowhere to keep it, so make sure a modified value is not lost
+                if (modified)
+                {
+                    writeToDB(key, value);
+                }
+                return;
+            }
+            m_cache_list.push_back(key_val_pair(key, value));
+            m_cache_map[key] = std::prev(m_cache_list.end());
+            setModified(key, modified);
+            ++count;
+        });
+        if (!success)
+        {
+            std::cerr << "Failed to read cache snapshot: " << path << std::endl;
+        }
+        return count;
+    }
+
+    /**
+     * @brief Visits every value in the data store in key order, without changing the order of 
+     * the LRU cache. \n
+     * Values are streamed from the persistent store (merging the partitions), with modified 
+     * values from the cache taking the place of their stored copies, so only the modified 
+     * cache entries are gathered up front. The data store must not be changed from the callback.
+     * 
+     * @param callback Called with every key/value pair. Return false to stop early.
+     * @return true If every value was visited (or the callback stopped early)
+     * @return false If reading the persistent store failed
+     */
+    bool forEach(const std::function<bool(const std::string& key, const std::string& value)>& callback)
+    {
+        return forEachInRange(nullptr, nullptr, callback);
+    }
+
+    /**
+     * @brief Visits every value with a key in [start_key, end_key) in key order (see forEach)
+     * 
+     * @param start_key The first key of the range
+     * @param end_key The key just past the end of the range
+     * @param callback Called with every key/value pair in the range. Return false to stop early.
+     * @return true If every value was visited (or the callback stopped early)
+     * @return false If reading the persistent store failed
+     */
+    bool scan(const std::string& start_key, const std::string& end_key, 
+              const std::function<bool(const std::string& key, const std::string& value)>& callback)
+    {
+        return forEachInRange(&start_key, &end_key, callback);
+    }
+
+    /**
+     * @brief Visits every value with a key that starts with a prefix in key order (see forEach)
+     * 
+     * @param prefix The prefix of the keys to visit
+     * @param callback Called with every key/value pair with the prefix. Return false to stop early.
+     * @return true If every value was visited (or the callback stopped early)
+     * @return false If reading the persistent store failed
+     */
+    bool scanPrefix(const std::string& prefix, 
+                    const std::function<bool(const std::string& key, const std::string& value)>& callback)
+    {
+        // The first string after every string with the prefix: drop any trailing 0xff bytes 
+        // and increment the last byte that is left. If nothing is left there is no end.
+        std::string end = prefix;
+        while (!end.empty() && static_cast<unsigned char>(end.back()) == 0xff)
+        {
+            end.pop_back();
+        }
+        if (end.empty())
+        {
+            return forEachInRange(&prefix, nullptr, callback);
+        }
+        end.back() = static_cast<char>(static_cast<unsigned char>(end.back()) + 1);
+        return forEachInRange(&prefix, &end, callback);
+    }
+
+    /**
+     * @brief Writes the full contents of the data store (the cache and everything in the 
+     * persistent store) to a snapshot file, in key order
+     * 
+     * @param path The file name of the snapshot
+     * @param compress Whether to compress the blocks of the snapshot
+     * @return true If the snapshot was written successfully
+     * @return false If writing the snapshot failed
+     */
+    bool dump(const std::string& path, bool compress = false)
+    {
+        CacheSnapshotWriter writer(path, compress);
+        bool success = forEach([&writer](const std::string& key, const std::string& value) {
+            writer.add(key, value, false);
+            return true;
+        });
+
+        return writer.finish() && success;
+    }
+
+    /**
+     * @brief Loads every entry of a snapshot written by dump into the persistent store. \n
+     * The entries are written in large transactions per partition. Values that are already 
+     * cached are replaced in the cache as well (and stay marked as modified if their 
+     * transaction fails, so they are written back later).
+     * 
+     * @param path The file name of the snapshot
+     * @return size_t The number of entries that were written to the persistent store
+     */
+    size_t load(const std::string& path)
+    {
+        requireWritable();
+        const size_t maxBatchSize = 10000;
+
+        std::vector<std::vector<key_val_pair>> batches(m_dbs.size());
+        size_t count = 0;
+        auto writeBatch = [this, &batches, &count](size_t partition) {
+            std::vector<const key_val_pair*> batch;
+            for (const key_val_pair& entry : batches[partition])
+            {
+                batch.push_back(&entry);
+            }
+            if (writeBatchToDB(m_dbs[partition], batch))
+            {
+                count += batch.size();
+            }
+            else
+            {
+                for (const key_val_pair& entry : batches[partition])
+                {
+                    if (isInCache(entry.first))
+                    {
+                        setModified(entry.first, true);
+                    }
+                }
+            }
+            batches[partition].clear();
+        };
+
+        bool success = CacheSnapshotReader::read(path, [&](const std::string& key, const std::string& value, bool) {
+            auto mapItr = m_cache_map.find(key);
+            if (mapItr != m_cache_map.end())
+            {
+                mapItr->second->second = value;
+                setModified(key, false);
+            }
+            invalidateTiers(key);
+
+            size_t partition = partitionOf(key);
+            batches[partition].push_back(key_val_pair(key, value));
+            if (batches[partition].size() >= maxBatchSize)
+            {
+                writeBatch(partition);
+            }
+        });
+        for (size_t i = 0; i < batches.size(); ++i)
+        {
+            if (!batches[i].empty())
+            {
+                writeBatch(i);
+            }
+        }
+
+        if (!success)
+        {
+            std::cerr << "Failed to read snapshot: " << path << std::endl;
+        }
+        return count;
+    }
+
+    /**
+     * @brief Loads a large number of values straight into the persistent store. \n
+     * This is much faster than calling put for every value: the input is sorted by key (so 
+     * every partition's primary key index is filled in order), syncing is turned off until the 
+     * last transaction, and every partition is filled in large transactions through one 
+     * prepared statement, with the partitions loaded in parallel. If a key appears more than 
+     * once, the last value wins. \n
+     * A partition whose transaction fails is rolled back to its last commit, and its keys are 
+     * not counted as loaded. Note: with syncing off, a power loss in the middle of a bulk load 
+     * can corrupt the database.
+     * 
+     * @tparam Iterator An input iterator over key/value pairs
+     * @param begin The first key/value pair to load
+     * @param end One past the last key/value pair to load
+     * @param cache_tail The number of values from the end of the input to also put in the cache
+     * @return size_t The number of distinct keys that were loaded
+     */
+    template <typename Iterator>
+    size_t bulkLoad(Iterator begin, Iterator end, size_t cache_tail = 0)
+    {
+        requireWritable();
+        std::vector<key_val_pair> entries;
+        for (; begin != end; ++begin)
+        {
+            entries.push_back(key_val_pair(begin->first, begin->second));
+        }
+        return bulkLoadEntries(entries, cache_tail);
+    }
+
+    /**
+     * @brief Loads a large number of values straight into the persistent store from a file 
+     * with one tab separated key and value per line (see the iterator version for details)
+     * 
+     * @param path The file name to load
+     * @param cache_tail The number of values from the end of the file to also put in the cache
+     * @return size_t The number of distinct keys that were loaded
+     */
+    size_t bulkLoad(const std::string& path, size_t cache_tail = 0)
+    {
+        requireWritable();
+        std::ifstream in(path);
+        if (!in)
+        {
+            std::cerr << "Failed to open bulk load file: " << path << std::endl;
+            return 0;
+        }
+
+        std::vector<key_val_pair> entries;
+        std::string line;
+        while (std::getline(in, line))
+        {
+            size_t tab = line.find('\t');
+            if (tab == std::string::npos)
+            {
+                continue;
+            }
+            entries.push_back(key_val_pair(line.substr(0, tab), line.substr(tab + 1)));
+        }
+        return bulkLoadEntries(entries, cache_tail);
+    }
+
+    /**
+     * @brief Trains a compression dictionary from a sample of the stored values and uses it to 
+     * compress values from now on. Values compressed with earlier dictionaries can still be read, 
+     * since every dictionary is kept in the database.
+     * 
+     * @param sample_count The number of values to sample
+     * @param max_size The maximum size of the dictionary
+     * @return true If a dictionary was trained and stored
+     * @return false If there was nothing to train on or storing the dictionary failed
+     */
+    bool trainCompressionDictionary(size_t sample_count = 500, size_t max_size = 16 * 1024)
+    {
+        requireWritable();
+        // Sample the cache first, then the partitions
+        std::vector<std::string> samples;
+        for (auto listItr = m_cache_list.begin(); listItr != m_cache_list.end() && samples.size() < sample_count; ++listItr)
+        {
+            samples.push_back(listItr->second);
+        }
+        for (size_t i = 0; i < m_dbs.size() && samples.size() < sample_count; ++i)
+        {
+            // Spread what is left of the sample evenly over the remaining partitions
+            size_t remaining = sample_count - samples.size();
+            size_t partitionsLeft = m_dbs.size() - i;
+            std::vector<key_val_pair> values;
+            readSomeFromPartition(m_dbs[i], (remaining + partitionsLeft - 1) / partitionsLeft, values);
+            for (const key_val_pair& entry : values)
+            {
+                samples.push_back(entry.second);
+            }
+        }
+
+        std::string dictionary = ValueCodec::trainDictionary(samples, max_size);
+        if (dictionary.empty())
+        {
+            return false;
+        }
+
+        // Every partition keeps its own copy, so each database file can be read on its own
+        for (sqlite3* db : m_dbs)
+        {
+            sqlite3_stmt *stmt;
+            int status = sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO dictionaries (id, dictionary) VALUES (?, ?);", -1, &stmt, NULL);
+            if (status == SQLITE_OK)
+            {
+                sqlite3_bind_int64(stmt, 1, ValueCodec::dictionaryId(dictionary));
+                sqlite3_bind_blob(stmt, 2, dictionary.data(), static_cast<int>(dictionary.size()), SQLITE_STATIC);
+                status = sqlite3_step(stmt);
+            }
+            sqlite3_finalize(stmt);
+            if (status != SQLITE_DONE)
+            {
+                std::cerr << "SQL error ocurred: " << std::string(sqlite3_errmsg(db)) << std::endl;
+                return false;
+            }
+        }
+
+        m_codec.addDictionary(dictionary, true);
+        return true;
+    }
+
+    /**
+     * @brief Hashes a key (see fnv1aHash)
+     * 
+     * @param key The key to hash
+     * @return uint64_t The hash of the key
+     */
+    static uint64_t hashKey(const std::string& key)
+    {
+        return fnv1aHash(key);
+    }
+
+    /**
+     * @brief Gets the number of values in the compressed cache tier
+     * 
+     * @return size_t The number of values (0 if there is no compressed tier)
+     */
+    size_t compressedTierSize() const
+    {
+        return m_compressed_tier ? m_compressed_tier->size() : 0;
+    }
+
+    /**
+     * @brief Gets the number of values in the flash cache tier
+     * 
+     * @return size_t The number of values (0 if there is no flash tier)
+     */
+    size_t flashTierSize() const
+    {
+        return m_flash_tier ? m_flash_tier->size() : 0;
+    }
+
+    /**
+     * @brief Checks to see if the provided value exists in the cache. \n
+     * Note: this does not check if it exists in the persistent storage
+     * 
+     * @param key The key to check for
+     * @return true if the key is in the cache
+     * @return false if the key is not in the cache
+     */
+    bool isInCache(const std::string& key)
+    {
+        return m_cache_map.find(key) != m_cache_map.end();
+    }
+
+    /**
+     * @brief Marks a cached value as just used (moving it to the front of the LRU cache), 
+     * without reading it. Nothing is loaded if the value is not in the cache.
+     * 
+     * @param key The key of the value
+     * @return true If the value was in the cache
+     * @return false If the value was not in the cache
+     */
+    bool touch(const std::string& key)
+    {
+        auto mapItr = m_cache_map.find(key);
+        if (mapItr == m_cache_map.end())
+        {
+            return false;
+        }
+        m_cache_list.splice(m_cache_list.begin(), m_cache_list, mapItr->second);
+        return true;
+    }
+
+    /**
+     * @brief Gets the current size of the cache
+     * 
+     * @return size_t The current size of the cache
+     */
+    size_t size()
+    {
+        return m_cache_map.size();
+    }
+
+    /**
+     * @brief Lookups of database pages in sqlite's own page cache (sized by the page_cache_kb 
+     * option), summed over all partitions
+     */
+    struct PageCacheStats
+    {
+        long long hits = 0;
+        long long misses = 0;
+    };
+
+    /**
+     * @brief Gets how often sqlite found the database pages it needed in its page cache, 
+     * rather than reading them from the file
+     * 
+     * @return PageCacheStats The page cache hits and misses since the data store was opened
+     */
+    PageCacheStats pageCacheStats() const
+    {
+        PageCacheStats stats;
+        for (sqlite3* db : m_dbs)
+        {
+            int current = 0;
+            int highwater = 0;
+            if (sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_HIT, &current, &highwater, 0) == SQLITE_OK)
+            {
+                stats.hits += current;
+            }
+            if (sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_MISS, &current, &highwater, 0) == SQLITE_OK)
+            {
+                stats.misses += current;
+            }
+        }
+        return stats;
+    }
+
+    /**
+     * @brief Gets how the database files were read, and how much the kernel was asked to read 
+     * ahead, summed over all partitions
+     * 
+     * @return ReadAheadVfs::Stats The reads since the data store was opened (all zero without 
+     * the read_ahead_bytes option)
+     */
+    ReadAheadVfs::Stats readAheadStats() const
+    {
+        ReadAheadVfs::Stats stats;
+        for (sqlite3* db : m_dbs)
+        {
+            sqlite3_file_control(db, "main", ReadAheadVfs::FCNTL_GET_STATS, &stats);
+        }
+        return stats;
+    }
+
+    /**
+     * @brief Gets how much memory the cache arena uses, and how much of it is on huge pages
+     * 
+     * @return HugePageArena::Stats The arena's stats (all zero without the cache_arena_bytes option)
+     */
+    HugePageArena::Stats cacheArenaStats() const
+    {
+        return m_cache_arena ? m_cache_arena->stats() : HugePageArena::Stats();
+    }
+
+private:
+    // The longest a snapshot waits between two tries to copy from a busy database
+    static constexpr int MAX_BACKOFF_MS = 100;
+
+    /**
+     * @brief A streaming cursor over the rows of a query on one partition
+     */
+    class PartitionCursor
+    {
+    public:
+        PartitionCursor() : m_owner(nullptr), m_db(nullptr), m_stmt(nullptr), m_valid(false) {}
+
+        ~PartitionCursor()
+        {
+            sqlite3_finalize(m_stmt);
+        }
+
+        PartitionCursor(const PartitionCursor&) = delete;
+        PartitionCursor& operator=(const PartitionCursor&) = delete;
+
+        /**
+         * @brief Starts the query and moves to its first row
+         * 
+         * @param owner The data store the partition belongs to
+         * @param db The database of the partition
+         * @param sql The query, which must return the key and value columns
+         * @param params Values to bind to the parameters of the query, in order
+         * @return true If the query was started
+         * @return false If the query failed
+         */
+        bool open(const DataStore* owner, sqlite3* db, const char* sql, 
+                  const std::vector<const std::string*>& params = std::vector<const std::string*>())
+        {
+            m_owner = owner;
+            m_db = db;
+            if (sqlite3_prepare_v2(db, sql, -1, &m_stmt, NULL) != SQLITE_OK)
+            {
+                std::cerr << "SQL error ocurred: " << std::string(sqlite3_errmsg(db));
+                return false;
+            }
+            for (size_t i = 0; i < params.size(); ++i)
+            {
+                sqlite3_bind_text(m_stmt, static_cast<int>(i + 1), params[i]->c_str(), static_cast<int>(params[i]->size()), SQLITE_STATIC);
+            }
+            return next();
+        }
+
+        /**
+         * @brief Moves to the next row
+         * 
+         * @return true If the cursor moved (valid() tells whether there was another row)
+         * @return false If the query failed
+         */
+        bool next()
+        {
+            int status = sqlite3_step(m_stmt);
+            m_valid = status == SQLITE_ROW;
+            if (m_valid)
+            {
+                m_key.assign((const char *)sqlite3_column_text(m_stmt, 0), sqlite3_column_bytes(m_stmt, 0));
+                m_owner->columnValue(m_stmt, 1, m_value);
+            }
+            else if (status != SQLITE_DONE)
+            {
+                std::cerr << "SQL error ocurred: " << std::string(sqlite3_errmsg(m_db));
+                return false;
+            }
+            return true;
+        }
+
+        bool valid() const { return m_valid; }
+        const std::string& key() const { return m_key; }
+        const std::string& value() const { return m_value; }
+
+    private:
+        const DataStore* m_owner;
+        sqlite3* m_db;
+        sqlite3_stmt* m_stmt;
+        bool m_valid;
+        std::string m_key;
+        std::string m_value;
+    };
+
+    // Declared before the cache, which is allocated from it
+    std::unique_ptr<HugePageArena> m_cache_arena;
+    cache_list m_cache_list;
+    std::unordered_map<std::string, list_itr, std::hash<std::string>, std::equal_to<std::string>, 
+                       ArenaAllocator<std::pair<const std::string, list_itr>>> m_cache_map;
+    std::unordered_map<std::string, bool> m_modification_map; 
+
+    /**
+     * @brief Orders pointers to keys by the keys they point to
+     */
+    struct KeyPointerLess
+    {
+        bool operator()(const std::string* a, const std::string* b) const
+        {
+            return *a < *b;
+        }
+    };
+    // The keys of the modified cache entries in key order (only kept with the ordered_index 
+    // option). The pointers are to the keys of m_cache_map, which do not move while cached.
+    std::set<const std::string*, KeyPointerLess> m_modified_index;
+
+    size_t m_max_cache_size;
+    DataStoreOptions m_options;
+
+    std::vector<sqlite3*> m_dbs;
+    // Whether the partitions are in WAL mode (with the wal option, or a read only store opened on a WAL database)
+    bool m_wal = false;
+    ValueCodec m_codec;
+    std::unique_ptr<CompressedCache> m_compressed_tier;
+    std::unique_ptr<FlashCache> m_flash_tier;
+    std::unique_ptr<SharedCacheSegment> m_shared_segment;
+
+    /**
+     * @brief How far this data store has followed the changes made to one partition by other connections
+     */
+    struct ChangeWatch
+    {
+        sqlite3_stmt* data_version = nullptr;
+        long long version = 0;
+        long long last_change = 0;
+    };
+    // One per partition (only with the change_tracking option)
+    std::vector<ChangeWatch> m_watches;
+    std::chrono::steady_clock::time_point m_last_change_check;
+    change_callback m_change_callback;
+
+    /**
+     * @brief Gets the partition that a key is stored in
+     * 
+     * @param key The key to look up
+     * @return size_t The index of the partition
+     */
+    size_t partitionOf(const std::string& key) const
+    {
+        if (m_dbs.size() == 1)
+        {
+            return 0;
+        }
+
+        return static_cast<size_t>(hashKey(key) % m_dbs.size());
+    }
+
+    /**
+     * @brief Gets the file name that a partition is stored in
+     * 
+     * @param name The name of the data store
+     * @param partition The index of the partition
+     * @param partitions The number of partitions
+     * @return std::string The file name of the partition
+     */
+    static std::string partitionPath(const std::string& name, size_t partition, size_t partitions)
+    {
+        return partitions == 1 ? name : name + "." + std::to_string(partition);
+    }
+
+    /**
+     * @brief Copies one partition of the persistent store to a new database file, 
+     * using the sqlite online backup API
+     * 
+     * @param db The database of the partition to copy
+     * @param path The file name to copy it to
+     * @param pages_per_step The number of pages to copy at a time
+     * @param between_steps Called between every batch of pages (may be empty)
+     * @return true If the copy was successful
+     * @return false If the copy failed
+     */
+    static bool backupPartition(sqlite3* db, const std::string& path, int pages_per_step, 
+                                const std::function<void()>& between_steps)
+    {
+        sqlite3* dest = nullptr;
+        int status = sqlite3_open(path.c_str(), &dest);
+        if (status != SQLITE_OK)
+        {
+            std::cerr << "Failed to open snapshot database: " << std::string(sqlite3_errmsg(dest)) << std::endl;
+            sqlite3_close(dest);
+            return false;
+        }
+
+        sqlite3_backup* backup = sqlite3_backup_init(dest, "main", db, "main");
+        if (!backup)
+        {
+            std::cerr << "SQL error ocurred: " << std::string(sqlite3_errmsg(dest)) << std::endl;
+            sqlite3_close(dest);
+            return false;
+        }
+
+        // Copy a batch of pages at a time. The source is only locked while a batch is being 
+        // copied, and writes made through the source connection in between are picked up by the 
+        // backup. If the source is busy, wait a little longer every time before trying again.
+        int backoff_ms = 1;
+        do
+        {
+            status = sqlite3_backup_step(backup, pages_per_step);
+            if (status == SQLITE_OK)
+            {
+                backoff_ms = 1;
+                if (between_steps)
+                {
+                    between_steps();
+                }
+            }
+            else if (status == SQLITE_BUSY || status == SQLITE_LOCKED)
+            {
+                sqlite3_sleep(backoff_ms);
+                backoff_ms = std::min(backoff_ms * 2, MAX_BACKOFF_MS);
+            }
+        } while (status == SQLITE_OK || status == SQLITE_BUSY || status == SQLITE_LOCKED);
+
+        sqlite3_backup_finish(backup);
+        if (status != SQLITE_DONE)
+        {
+            std::cerr << "SQL error ocurred: " << std::string(sqlite3_errstr(status)) << std::endl;
+            sqlite3_close(dest);
+            return false;
+        }
+
+        sqlite3_close(dest);
+        return true;
+    }
+
+    /**
+     * @brief Closes the database for every partition
+     */
+    void closeDatabases()
+    {
+        for (ChangeWatch& watch : m_watches)
+        {
+            sqlite3_finalize(watch.data_version);
+        }
+        m_watches.clear();
+        for (sqlite3* db : m_dbs)
+        {
+            sqlite3_close(db);
+        }
+        m_dbs.clear();
+    }
+
+    /**
+     * @brief Opens (and if necessary creates) a sqlite database and applies the 
+     * configured storage options to it
+     * 
+     * @param path The file name of the database
+     * @return sqlite3* The open database handle
+     */
+    sqlite3* openDatabase(const std::string& path)
+    {
+        sqlite3* db = nullptr;
+        std::string layered = m_options.read_ahead_bytes > 0 ? ReadAheadVfs::registerOver(m_options.vfs) : m_options.vfs;
+        const char* vfs = layered.empty() ? NULL : layered.c_str();
+        int flags = m_options.read_only ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+        int status = sqlite3_open_v2(path.c_str(), &db, flags, vfs);
+        if (status)
+        {
+            std::string error = db ? std::string(sqlite3_errmsg(db)) : std::string(sqlite3_errstr(status));
+            sqlite3_close(db);
+            throw std::runtime_error("Failed to open database: " + error);
+        }
+
+        if (m_options.read_ahead_bytes > 0)
+        {
+            sqlite3_int64 window = m_options.read_ahead_bytes;
+            sqlite3_file_control(db, "main", ReadAheadVfs::FCNTL_SET_WINDOW, &window);
+        }
+
+        // Wait for other connections (e.g. a writer and its replicas) rather than failing at once
+        sqlite3_busy_timeout(db, m_options.busy_timeout_ms);
+
+        std::stringstream ss;
+        // The page size only takes effect before the database is first written to
+        if (m_options.page_size > 0)
+        {
+            ss << "PRAGMA page_size = " << m_options.page_size << ";";
+        }
+        // Negative values are interpreted by sqlite as a size in KiB rather than pages
+        if (m_options.page_cache_kb > 0)
+        {
+            ss << "PRAGMA cache_size = -" << m_options.page_cache_kb << ";";
+        }
+        if (m_options.mmap_size > 0)
+        {
+            ss << "PRAGMA mmap_size = " << m_options.mmap_size << ";";
+        }
+        if ((m_options.wal || m_options.change_tracking) && !m_options.read_only)
+        {
+            ss << "PRAGMA journal_mode = WAL;";
+        }
+
+        // Create the table in the database to store the values (but only if it does not already exist), 
+        // and the one to keep the compression dictionaries in. A read only database must already have them.
+        if (!m_options.read_only)
+        {
+            ss << "CREATE TABLE IF NOT EXISTS data (key CHAR PRIMARY KEY, value TEXT);";
+            ss << "CREATE TABLE IF NOT EXISTS dictionaries (id INTEGER UNIQUE, dictionary BLOB);";
+        }
+
+        // Log the key of every write, whoever makes it, so readers can invalidate just those keys. 
+        // The log is trimmed every 256 changes rather than on every one.
+        if (m_options.change_tracking && !m_options.read_only)
+        {
+            ss << "CREATE TABLE IF NOT EXISTS changes (seq INTEGER PRIMARY KEY AUTOINCREMENT, key CHAR);";
+            ss << "CREATE TRIGGER IF NOT EXISTS data_inserted AFTER INSERT ON data BEGIN "
+                  "INSERT INTO changes (key) VALUES (new.key); END;";
+            ss << "CREATE TRIGGER IF NOT EXISTS data_updated AFTER UPDATE ON data BEGIN "
+                  "INSERT INTO changes (key) VALUES (new.key); END;";
+            ss << "CREATE TRIGGER IF NOT EXISTS data_deleted AFTER DELETE ON data BEGIN "
+                  "INSERT INTO changes (key) VALUES (old.key); END;";
+            ss << "CREATE TRIGGER IF NOT EXISTS changes_trimmed AFTER INSERT ON changes WHEN new.seq % 256 = 0 BEGIN "
+                  "DELETE FROM changes WHERE seq <= new.seq - " << m_options.change_log_size << "; END;";
+        }
+
+        char* errMsg = nullptr;
+        status = sqlite3_exec(db, ss.str().c_str(), NULL, nullptr, &errMsg);
+        if (status != SQLITE_OK)
+        {
+            std::string error(errMsg);
+            sqlite3_free(errMsg);
+            sqlite3_close(db);
+            throw std::runtime_error("SQL error ocurred: " + error);
+        }
+
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(db, "PRAGMA journal_mode;", -1, &stmt, NULL) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            bool wal = std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0))) == "wal";
+            m_wal = wal && (m_dbs.empty() || m_wal);
+        }
+        sqlite3_finalize(stmt);
+
+        return db;
+    }
+
+    /**
+     * @brief Hands a value that was evicted from the LRU cache (and is no longer modified) 
+     * to the lower cache tiers
+     * 
+     * @param key The key of the value
+     * @param value The value
+     */
+    void evictToTiers(const std::string& key, const std::string& value)
+    {
+        if (m_compressed_tier)
+        {
+            m_compressed_tier->put(key, value);
+        }
+        else if (m_flash_tier)
+        {
+            m_flash_tier->put(key, value, false);
+        }
+    }
+
+    /**
+     * @brief Takes a value out of the lower cache tiers, for it to go back into the LRU cache
+     * 
+     * @param key The key of the value
+     * @param value The value
+     * @return true If one of the tiers had the value
+     * @return false If none of the tiers had the value
+     */
+    bool takeFromTiers(const std::string& key, std::string& value)
+    {
+        if (m_compressed_tier && m_compressed_tier->take(key, value))
+        {
+            return true;
+        }
+
+        std::string data;
+        bool compressed = false;
+        if (m_flash_tier && m_flash_tier->take(key, data, compressed))
+        {
+            if (!compressed)
+            {
+                value.swap(data);
+                return true;
+            }
+            return m_codec.decode(data.data(), data.size(), value);
+        }
+
+        // The shared segment keeps its copy for the other processes
+        return m_shared_segment && m_shared_segment->get(key, value);
+    }
+
+    /**
+     * @brief Drops a value from the lower cache tiers (and the shared segment), because it has changed
+     * 
+     * @param key The key of the value
+     */
+    void invalidateTiers(const std::string& key)
+    {
+        if (m_compressed_tier)
+        {
+            m_compressed_tier->erase(key);
+        }
+        if (m_flash_tier)
+        {
+            m_flash_tier->erase(key);
+        }
+        if (m_shared_segment)
+        {
+            m_shared_segment->erase(key);
+        }
+    }
+
+    /**
+     * @brief Remembers where every partition's data version and change log are, so later 
+     * changes can be told apart
+     */
+    void startWatchingChanges()
+    {
+        m_watches.resize(m_dbs.size());
+        for (size_t i = 0; i < m_dbs.size(); ++i)
+        {
+            if (sqlite3_prepare_v2(m_dbs[i], "PRAGMA data_version;", -1, &m_watches[i].data_version, NULL) != SQLITE_OK)
+            {
+                throw std::runtime_error("SQL error ocurred: " + std::string(sqlite3_errmsg(m_dbs[i])));
+            }
+            if (!readDataVersion(i, m_watches[i].version) || !readLastChange(m_dbs[i], m_watches[i].last_change))
+            {
+                throw std::runtime_error("Failed to read the change log");
+            }
+        }
+        m_last_change_check = std::chrono::steady_clock::now();
+    }
+
+    /**
+     * @brief Drops the cached copies of the values that other connections have changed since the 
+     * last check (at most once per change_check_interval_ms). Modified values are kept, since 
+     * they will overwrite the other change when they are written back anyway.
+     */
+    void checkForChanges()
+    {
+        if (m_watches.empty())
+        {
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now - m_last_change_check < std::chrono::milliseconds(m_options.change_check_interval_ms))
+        {
+            return;
+        }
+        m_last_change_check = now;
+
+        // The data version only changes when another connection commits, so checking it is cheap
+        bool changed = false;
+        for (size_t i = 0; i < m_watches.size(); ++i)
+        {
+            long long version;
+            if (readDataVersion(i, version) && version != m_watches[i].version)
+            {
+                m_watches[i].version = version;
+                invalidateChanges(i);
+                changed = true;
+            }
+        }
+
+        // The other connection may have stored a new compression dictionary
+        if (changed)
+        {
+            loadDictionaries();
+        }
+    }
+
+    /**
+     * @brief Reads the data version of a partition
+     * 
+     * @param partition The index of the partition
+     * @param version The data version
+     * @return true If the data version was read
+     * @return false If the query failed
+     */
+    bool readDataVersion(size_t partition, long long& version)
+    {
+        sqlite3_stmt* stmt = m_watches[partition].data_version;
+        sqlite3_reset(stmt);
+        if (sqlite3_step(stmt) != SQLITE_ROW)
+        {
+            std::cerr << "SQL error ocurred: " << std::string(sqlite3_errmsg(m_dbs[partition]));
+            return false;
+        }
+        version = sqlite3_column_int64(stmt, 0);
+        sqlite3_reset(stmt);
+        return true;
+    }
+
+    /**
+     * @brief Reads the sequence number of the latest change in a partition's change log
+     * 
+     * @param db The database of the partition
+     * @param last_change The sequence number (0 if the log is empty)
+     * @return true If the sequence number was read
+     * @return false If the query failed
+     */
+    bool readLastChange(sqlite3* db, long long& last_change)
+    {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, "SELECT IFNULL(MAX(seq), 0) FROM changes;", -1, &stmt, NULL) != SQLITE_OK || 
+            sqlite3_step(stmt) != SQLITE_ROW)
+        {
+            std::cerr << "SQL error ocurred: " << std::string(sqlite3_errmsg(db));
+            sqlite3_finalize(stmt);
+            return false;
+        }
+        last_change = sqlite3_column_int64(stmt, 0);
+        sqlite3_finalize(stmt);
+        return true;
+    }
+
+    /**
+     * @brief Drops the cached copies of the keys in a partition's change log that are newer than 
+     * the last ones seen. If the log has been trimmed past them, every clean value of the 
+     * partition is dropped instead.
+     * 
+     * @param partition The index of the partition
+     * @return true If the change log was read
+     * @return false If the query failed
+     */
+    bool invalidateChanges(size_t partition)
+    {
+        sqlite3* db = m_dbs[partition];
+        ChangeWatch& watch = m_watches[partition];
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, "SELECT seq, key FROM changes WHERE seq > ? ORDER BY seq;", -1, &stmt, NULL) != SQLITE_OK)
+        {
+            std::cerr << "SQL error ocurred: " << std::string(sqlite3_errmsg(db));
+            sqlite3_finalize(stmt);
+            return false;
+        }
+        sqlite3_bind_int64(stmt, 1, watch.last_change);
+
+        int status;
+        bool first = true;
+        while ((status = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            long long seq = sqlite3_column_int64(stmt, 0);
+            if (first && seq > watch.last_change + 1)
+            {
+                // Some of the changes we have not seen are gone
+                dropCleanPartition(partition);
+                if (m_change_callback)
+                {
+                    m_change_callback(nullptr);
+                }
+            }
+            first = false;
+            watch.last_change = seq;
+
+            std::string key((const char *)sqlite3_column_text(stmt, 1), sqlite3_column_bytes(stmt, 1));
+            dropCleanEntry(key);
+            invalidateTiers(key);
+            if (m_change_callback)
+            {
+                m_change_callback(&key);
+            }
+        }
+        sqlite3_finalize(stmt);
+
+        if (status != SQLITE_DONE)
+        {
+            std::cerr << "SQL error ocurred: " << std::string(sqlite3_errmsg(db));
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Removes a value from the cache, unless it has been modified
+     * 
+     * @param key The key of the value
+     * @return true If the value was removed
+     * @return false If the value was not cached or has been modified
+     */
+    bool dropCleanEntry(const std::string& key)
+    {
+        auto mapItr = m_cache_map.find(key);
+        if (mapItr == m_cache_map.end() || isModified(key))
+        {
+            return false;
+        }
+        list_itr listItr = mapItr->second;
+        m_modification_map.erase(key);
+        m_cache_map.erase(mapItr);
+        m_cache_list.erase(listItr);
+        return true;
+    }
+
+    /**
+     * @brief Removes every value of a partition that has not been modified from the cache, and 
+     * empties this process's lower cache tiers
+     * 
+     * @param partition The index of the partition
+     */
+    void dropCleanPartition(size_t partition)
+    {
+        for (auto listItr = m_cache_list.begin(); listItr != m_cache_list.end();)
+        {
+            if (partitionOf(listItr->first) == partition && !isModified(listItr->first))
+            {
+                m_modification_map.erase(listItr->first);
+                m_cache_map.erase(listItr->first);
+                listItr = m_cache_list.erase(listItr);
+            }
+            else
+            {
+                ++listItr;
+            }
+        }
+
+        // The tiers can not be searched by partition. The shared segment is left alone: the 
+        // processes that kept up with the log have already dropped the changed keys from it.
+        if (m_compressed_tier)
+        {
+            m_compressed_tier->clear();
+        }
+        if (m_flash_tier)
+        {
+            m_flash_tier->clear();
+        }
+    }
+
+    /**
+     * @brief Reads a value column, decompressing it if it was stored compressed
+     * 
+     * @param stmt The statement to read from
+     * @param column The index of the value column
+     * @param value The value
+     * @return true If the value was read
+     * @return false If a compressed value could not be decompressed
+     */
+    bool columnValue(sqlite3_stmt* stmt, int column, std::string& value) const
+    {
+        const char* data = (const char *)sqlite3_column_blob(stmt, column);
+        size_t size = static_cast<size_t>(sqlite3_column_bytes(stmt, column));
+        if (sqlite3_column_type(stmt, column) != SQLITE_BLOB)
+        {
+            value.assign(data ? data : "", size);
+            return true;
+        }
+
+        if (!m_codec.decode(data, size, value))
+        {
+            std::cerr << "Failed to decompress a stored value" << std::endl;
+            value.clear();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Loads the compression dictionaries stored in every partition into the codec. 
+     * The most recently stored one is used to compress new values.
+     */
+    void loadDictionaries()
+    {
+        for (sqlite3* db : m_dbs)
+        {
+            sqlite3_stmt *stmt;
+            if (sqlite3_prepare_v2(db, "SELECT dictionary FROM dictionaries ORDER BY rowid;", -1, &stmt, NULL) != SQLITE_OK)
+            {
+                std::cerr << "SQL error ocurred: " << std::string(sqlite3_errmsg(db));
+                sqlite3_finalize(stmt);
+                continue;
+            }
+            while (sqlite3_step(stmt) == SQLITE_ROW)
+            {
+                m_codec.addDictionary(std::string((const char *)sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0)), true);
+            }
+            sqlite3_finalize(stmt);
+        }
+    }
+
+    /**
+     * @brief Writes a value to the persistent store
+     * 
+     * @param key The key to write
+     * @param value The value to save
+     * @return true If the write was successful
+     * @return false If the write failed
+     */
+    bool writeToDB(const std::string& key, const std::string& value)
+    {
+        key_val_pair entry(key, value);
+        return writeBatchToDB(m_dbs[partitionOf(key)], std::vector<const key_val_pair*>(1, &entry));
+    }
+
+    /**
+     * @brief Writes a batch of values to one partition of the persistent store in a 
+     * single transaction
+     * 
+     * @param db The database of the partition the values belong to
+     * @param batch The key/value pairs to write
+     * @return true If the write was successful
+     * @return false If the write failed
+     */
+    bool writeBatchToDB(sqlite3* db, const std::vector<const key_val_pair*>& batch)
+    {
+        char* errMsg = nullptr;
+        int status = sqlite3_exec(db, "BEGIN;", NULL, nullptr, &errMsg);
+        if (status != SQLITE_OK)
+        {
+            std::cerr << "SQL error ocurred: " << std::string(errMsg) << std::endl;
+            sqlite3_free(errMsg);
+            return false;
+        }
+
+        // Created the prepared SQL statement, which is reused for every value in the batch
+        sqlite3_stmt *stmt;
+        status = sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO data (key, value) VALUES (?, ?);", -1, &stmt, NULL);
+        if (status == SQLITE_OK)
+        {
+            std::string compressed;
+            for (const key_val_pair* entry : batch)
+            {
+                sqlite3_bind_text(stmt, 1, entry->first.c_str(), static_cast<int>(entry->first.size()), SQLITE_STATIC);
+                // Compressed values are stored as blobs, and everything else as text
+                if (m_options.compression && m_codec.encode(entry->second, compressed))
+                {
+                    sqlite3_bind_blob(stmt, 2, compressed.data(), static_cast<int>(compressed.size()), SQLITE_STATIC);
+                }
+                else
+                {
+                    sqlite3_bind_text(stmt, 2, entry->second.c_str(), static_cast<int>(entry->second.size()), SQLITE_STATIC);
+                }
+                status = sqlite3_step(stmt);
+                sqlite3_reset(stmt);
+                if (status != SQLITE_DONE)
+                {
+                    break;
+                }
+            }
+        }
+        if (status != SQLITE_OK && status != SQLITE_DONE)
+        {
+            std::cerr << "SQL error ocurred: " << std::string(sqlite3_errmsg(db)) << std::endl;
+            sqlite3_finalize(stmt);
+            sqlite3_exec(db, "ROLLBACK;", NULL, nullptr, nullptr);
+            return false;
+        }
+
+        // Clean up after executing the statment
+        sqlite3_finalize(stmt);
+
+        status = sqlite3_exec(db, "COMMIT;", NULL, nullptr, &errMsg);
+        if (status != SQLITE_OK)
+        {
+            std::cerr << "SQL error ocurred: " << std::string(errMsg) << std::endl;
+            sqlite3_free(errMsg);
+            sqlite3_exec(db, "ROLLBACK;", NULL, nullptr, nullptr);
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Deletes a value from the persistent store
+     * 
+     * @param key The key to delete
+     * @return true If the key was deleted
+     * @return false If the key does not exist or the delete failed
+     */
+    bool deleteFromDB(const std::string& key)
+    {
+        sqlite3* db = m_dbs[partitionOf(key)];
+
+        sqlite3_stmt *stmt;
+        int status = sqlite3_prepare_v2(db, "DELETE FROM data WHERE key = ?;", -1, &stmt, NULL);
+        if (status == SQLITE_OK)
+        {
+            sqlite3_bind_text(stmt, 1, key.c_str(), static_cast<int>(key.size()), SQLITE_STATIC);
+            status = sqlite3_step(stmt);
+        }
+        sqlite3_finalize(stmt);
+        if (status != SQLITE_DONE)
+        {
+            std::cerr << "SQL error ocurred: " << std::string(sqlite3_errmsg(db)) << std::endl;
+            return false;
+        }
+
+        return sqlite3_changes(db) > 0;
+    }
+
+    /**
+     * @brief Retrieves a value from the persistant store
+     * 
+     * @param key The key to retrieve
+     * @param value The value that was retrieved
+     * @return true If the key was found
+     * @return false If the key does not exist or the retrieve failed
+     */
+    bool readFromDB(const std::string& key, std::string& value)
+    {
+        sqlite3* db = m_dbs[partitionOf(key)];
+
+        // Created the prepared SQL statement
+        sqlite3_stmt *stmt;
+        int status = sqlite3_prepare_v2(db, "SELECT value FROM data WHERE key = ? LIMIT 1;", -1, &stmt, NULL);
+        if (status != SQLITE_OK) {
+            std::cerr << "SQL error ocurred: " << std::string(sqlite3_errmsg(db));
+            sqlite3_finalize(stmt);
+            return false;
+        }
+        sqlite3_bind_text(stmt, 1, key.c_str(), static_cast<int>(key.size()), SQLITE_STATIC);
+
+        // Execute the statement
+        bool found = false;
+        while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {
+            found = columnValue(stmt, 0, value);
+        }
+        if (status != SQLITE_DONE) {
+            std::cerr << "SQL error ocurred: " << std::string(sqlite3_errmsg(db));
+            sqlite3_finalize(stmt);
+            return false;
+        }
+
+        // Clean up after executing the statment
+        sqlite3_finalize(stmt);
+
+        return found;
+    }
+
+    /**
+     * @brief Retrieves several values from the persistant store using batched 
+     * "SELECT ... WHERE key IN (...)" queries with bound parameters
+     * 
+     * @param keys The keys to retrieve
+     * @param values The key/value pairs that were found
+     * @return true If the retrieve was successful
+     * @return false If the retrieve failed
+     */
+    bool readManyFromDB(const std::vector<std::string>& keys, std::unordered_map<std::string, std::string>& values)
+    {
+        // Group the keys by the partition they are stored in
+        std::vector<std::vector<const std::string*>> partitionKeys(m_dbs.size());
+        for (const std::string& key : keys)
+        {
+            partitionKeys[partitionOf(key)].push_back(&key);
+        }
+
+        bool success = true;
+        for (size_t i = 0; i < m_dbs.size(); ++i)
+        {
+            if (!partitionKeys[i].empty())
+            {
+                success = readManyFromPartition(m_dbs[i], partitionKeys[i], values) && success;
+            }
+        }
+
+        return success;
+    }
+
+    /**
+     * @brief Retrieves several values from one partition of the persistant store
+     * 
+     * @param db The database of the partition the keys belong to
+     * @param keys The keys to retrieve
+     * @param values The key/value pairs that were found
+     * @return true If the retrieve was successful
+     * @return false If the retrieve failed
+     */
+    bool readManyFromPartition(sqlite3* db, const std::vector<const std::string*>& keys, 
+                               std::unordered_map<std::string, std::string>& values)
+    {
+        // Stay well below SQLITE_MAX_VARIABLE_NUMBER (999 on older builds)
+        const size_t maxBatchSize = 500;
+
+        for (size_t start = 0; start < keys.size(); start += maxBatchSize)
+        {
+            size_t count = std::min(maxBatchSize, keys.size() - start);
+
+            std::stringstream ss;
+            ss << "SELECT key, value FROM data WHERE key IN (";
+            for (size_t i = 0; i < count; ++i)
+            {
+                ss << (i == 0 ? "?" : ",?");
+            }
+            ss << ");";
+
+            // Created the prepared SQL statement
+            sqlite3_stmt *stmt;
+            int status = sqlite3_prepare_v2(db, ss.str().c_str(), -1, &stmt, NULL);
+            if (status != SQLITE_OK) {
+                std::cerr << "SQL error ocurred: " << std::string(sqlite3_errmsg(db));
+                sqlite3_finalize(stmt);
+                return false;
+            }
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                const std::string& key = *keys[start + i];
+                sqlite3_bind_text(stmt, static_cast<int>(i + 1), key.c_str(), static_cast<int>(key.size()), SQLITE_TRANSIENT);
+            }
+
+            // Execute the statement
+            while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {
+                std::string key((const char *)sqlite3_column_text(stmt, 0), sqlite3_column_bytes(stmt, 0));
+                columnValue(stmt, 1, values[key]);
+            }
+            if (status != SQLITE_DONE) {
+                std::cerr << "SQL error ocurred: " << std::string(sqlite3_errmsg(db));
+                sqlite3_finalize(stmt);
+                return false;
+            }
+
+            // Clean up after executing the statment
+            sqlite3_finalize(stmt);
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Reads up to a given number of values from one partition of the persistant store
+     * 
+     * @param db The database of the partition to read from
+     * @param limit The maximum number of values to read
+     * @param values The key/value pairs that were read
+     * @return true If the retrieve was successful
+     * @return false If the retrieve failed
+     */
+    bool readSomeFromPartition(sqlite3* db, size_t limit, std::vector<key_val_pair>& values)
+    {
+        // Created the prepared SQL statement
+        sqlite3_stmt *stmt;
+        int status = sqlite3_prepare_v2(db, "SELECT key, value FROM data LIMIT ?;", -1, &stmt, NULL);
+        if (status != SQLITE_OK) {
+            std::cerr << "SQL error ocurred: " << std::string(sqlite3_errmsg(db));
+            sqlite3_finalize(stmt);
+            return false;
+        }
+        sqlite3_bind_int64(stmt, 1, static_cast<sqlite3_int64>(limit));
+
+        // Execute the statement
+        while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {
+            values.push_back(key_val_pair(std::string((const char *)sqlite3_column_text(stmt, 0), sqlite3_column_bytes(stmt, 0)), ""));
+            columnValue(stmt, 1, values.back().second);
+        }
+        if (status != SQLITE_DONE) {
+            std::cerr << "SQL error ocurred: " << std::string(sqlite3_errmsg(db));
+            sqlite3_finalize(stmt);
+            return false;
+        }
+
+        // Clean up after executing the statment
+        sqlite3_finalize(stmt);
+
+        return true;
+    }
+
+    /**
+     * @brief Loads key/value pairs into the persistent store (see bulkLoad)
+     * 
+     * @param entries The key/value pairs to load (reordered by this call)
+     * @param cache_tail The number of values from the end of the input to also put in the cache
+     * @return size_t The number of distinct keys that were loaded
+     */
+    size_t bulkLoadEntries(std::vector<key_val_pair>& entries, size_t cache_tail)
+    {
+        // Remember the tail of the input before it gets reordered
+        cache_tail = std::min(cache_tail, std::min(entries.size(), m_max_cache_size));
+        std::vector<key_val_pair> tail(entries.end() - cache_tail, entries.end());
+
+        // Sort by key, keeping only the last value of any duplicate key
+        std::stable_sort(entries.begin(), entries.end(), [](const key_val_pair& a, const key_val_pair& b) {
+            return a.first < b.first;
+        });
+        std::vector<std::vector<const key_val_pair*>> batches(m_dbs.size());
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            if (i + 1 < entries.size() && entries[i].first == entries[i + 1].first)
+            {
+                continue;
+            }
+            batches[partitionOf(entries[i].first)].push_back(&entries[i]);
+        }
+
+        std::vector<char> written(m_dbs.size(), true);
+        parallelFor(m_dbs.size(), [this, &batches, &written](size_t i) {
+            if (!batches[i].empty())
+            {
+                written[i] = bulkWriteToPartition(m_dbs[i], batches[i]);
+            }
+        });
+
+        // Keep whatever is already cached in line with the store. Values whose partition failed 
+        // to load stay marked as modified in the cache, so they are still written back later.
+        size_t count = 0;
+        for (size_t i = 0; i < batches.size(); ++i)
+        {
+            for (const key_val_pair* entry : batches[i])
+            {
+                auto mapItr = m_cache_map.find(entry->first);
+                if (mapItr != m_cache_map.end())
+                {
+                    mapItr->second->second = entry->second;
+                    setModified(entry->first, !written[i]);
+                }
+                invalidateTiers(entry->first);
+            }
+            if (written[i])
+            {
+                count += batches[i].size();
+            }
+        }
+
+        // Put the tail in the cache, with the last value of the input as the most recently used
+        for (const key_val_pair& entry : tail)
+        {
+            cacheValue(entry.first, entry.second, !written[partitionOf(entry.first)]);
+        }
+
+        return count;
+    }
+
+    /**
+     * @brief Writes a sorted batch of values to one partition of the persistent store, committing 
+     * every so often. Only the last commit is synced to disk (the journal stays on, so a failed 
+     * transaction still rolls back cleanly).
+     * 
+     * @param db The database of the partition the values belong to
+     * @param batch The key/value pairs to write
+     * @return true If the write was successful
+     * @return false If the write failed (everything after the last commit is rolled back)
+     */
+    bool bulkWriteToPartition(sqlite3* db, const std::vector<const key_val_pair*>& batch)
+    {
+        const size_t maxTransactionSize = 100000;
+
+        // Remember the sync setting so it can be put back for the last transaction
+        int synchronous = 2;
+        sqlite3_stmt *stmt;
+        if (sqlite3_prepare_v2(db, "PRAGMA synchronous;", -1, &stmt, NULL) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            synchronous = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+        std::string restore = "PRAGMA synchronous = " + std::to_string(synchronous) + ";";
+        sqlite3_exec(db, "PRAGMA synchronous = OFF;", NULL, nullptr, nullptr);
+
+        bool success = true;
+        for (size_t start = 0; start < batch.size() && success; start += maxTransactionSize)
+        {
+            size_t end = std::min(batch.size(), start + maxTransactionSize);
+            if (end == batch.size())
+            {
+                sqlite3_exec(db, restore.c_str(), NULL, nullptr, nullptr);
+            }
+            success = writeBatchToDB(db, std::vector<const key_val_pair*>(batch.begin() + start, batch.begin() + end));
+        }
+        sqlite3_exec(db, restore.c_str(), NULL, nullptr, nullptr);
+
+        return success;
+    }
+
+    /**
+     * @brief Purges the remaining elements in the cache to the persistent storage. \n
+     * Each partition is written in its own transaction, and partitions are written in parallel.
+     * 
+     * @return true If purge was succesful
+     * @return false If purge failed
+     */
+    bool purgeToStorage()
+    {
+        // Group the modified elements by the partition they belong to
+        std::vector<std::vector<const key_val_pair*>> batches(m_dbs.size());
+        for (auto listItr = m_cache_list.begin(); listItr != m_cache_list.end(); ++listItr)
+        {
+            // Only write it back out to the persistent storage if it has been modified
+            if (isModified(listItr->first))
+            {
+                batches[partitionOf(listItr->first)].push_back(&*listItr);
+            }
+        }
+
+        // Every partition has its own connection, so they can be written concurrently
+        std::vector<char> results(m_dbs.size(), 1);
+        parallelFor(m_dbs.size(), [this, &batches, &results](size_t i) {
+            if (!batches[i].empty())
+            {
+                results[i] = writeBatchToDB(m_dbs[i], batches[i]);
+            }
+        });
+
+        return std::find(results.begin(), results.end(), 0) == results.end();
+    }
+
+    /**
+     * @brief Visits every value with a key in a range in key order (see forEach)
+     * 
+     * @param start_key The first key of the range (nullptr for no lower bound)
+     * @param end_key The key just past the end of the range (nullptr for no upper bound)
+     * @param callback Called with every key/value pair in the range. Return false to stop early.
+     * @return true If every value was visited (or the callback stopped early)
+     * @return false If reading the persistent store failed
+     */
+    bool forEachInRange(const std::string* start_key, const std::string* end_key, 
+                        const std::function<bool(const std::string& key, const std::string& value)>& callback)
+    {
+        auto inRange = [start_key, end_key](const std::string& key) {
+            return (!start_key || key >= *start_key) && (!end_key || key < *end_key);
+        };
+
+        // The modified values in the cache that are in range, in key order
+        std::vector<const key_val_pair*> modified;
+        if (m_options.ordered_index)
+        {
+            auto indexItr = start_key ? m_modified_index.lower_bound(start_key) : m_modified_index.begin();
+            for (; indexItr != m_modified_index.end() && inRange(**indexItr); ++indexItr)
+            {
+                modified.push_back(&*m_cache_map.find(**indexItr)->second);
+            }
+        }
+        else
+        {
+            for (auto listItr = m_cache_list.begin(); listItr != m_cache_list.end(); ++listItr)
+            {
+                if (inRange(listItr->first) && isModified(listItr->first))
+                {
+                    modified.push_back(&*listItr);
+                }
+            }
+            std::sort(modified.begin(), modified.end(), [](const key_val_pair* a, const key_val_pair* b) {
+                return a->first < b->first;
+            });
+        }
+
+        // A cursor over every partition, each already in key order
+        std::stringstream ss;
+        ss << "SELECT key, value FROM data WHERE 1";
+        std::vector<const std::string*> bounds;
+        if (start_key)
+        {
+            ss << " AND key >= ?";
+            bounds.push_back(start_key);
+        }
+        if (end_key)
+        {
+            ss << " AND key < ?";
+            bounds.push_back(end_key);
+        }
+        ss << " ORDER BY key;";
+        std::string sql = ss.str();
+
+        std::vector<PartitionCursor> cursors(m_dbs.size());
+        for (size_t i = 0; i < m_dbs.size(); ++i)
+        {
+            if (!cursors[i].open(this, m_dbs[i], sql.c_str(), bounds))
+            {
+                return false;
+            }
+        }
+
+        size_t nextModified = 0;
+        while (true)
+        {
+            // Find the smallest key across the partitions
+            PartitionCursor* smallest = nullptr;
+            for (PartitionCursor& cursor : cursors)
+            {
+                if (cursor.valid() && (!smallest || cursor.key() < smallest->key()))
+                {
+                    smallest = &cursor;
+                }
+            }
+
+            bool useModified = nextModified < modified.size() && 
+                               (!smallest || modified[nextModified]->first <= smallest->key());
+            if (!useModified && !smallest)
+            {
+                break;
+            }
+
+            bool keepGoing;
+            if (useModified)
+            {
+                const key_val_pair* entry = modified[nextModified++];
+                // The stored copy (if any) is out of date
+                if (smallest && smallest->key() == entry->first && !smallest->next())
+                {
+                    return false;
+                }
+                keepGoing = callback(entry->first, entry->second);
+            }
+            else
+            {
+                keepGoing = callback(smallest->key(), smallest->value());
+                if (!smallest->next())
+                {
+                    return false;
+                }
+            }
+
+            if (!keepGoing)
+            {
+                break;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Marks a cached key as modified or unmodified
+     * 
+     * @param key The key to mark
+     * @param modified Whether it has been modified since it was last written to the persistent store
+     */
+    void setModified(const std::string& key, bool modified)
+    {
+        // Nothing is ever modified in a read only data store
+        if (m_options.read_only)
+        {
+            return;
+        }
+
+        m_modification_map[key] = modified;
+        if (!m_options.ordered_index)
+        {
+            return;
+        }
+
+        auto mapItr = m_cache_map.find(key);
+        if (modified && mapItr != m_cache_map.end())
+        {
+            m_modified_index.insert(&mapItr->first);
+        }
+        else
+        {
+            m_modified_index.erase(&key);
+        }
+    }
+
+    /**
+     * @brief Adds a value to the cache as the most recently used one (replacing any older copy), 
+     * evicting the least recently used value if the cache is full
+     * 
+     * @param key Key to reference item by
+     * @param value Value to store
+     * @param modified Whether the value still has to be written to the persistent store
+     */
+    void cacheValue(const std::string& key, const std::string& value, bool modified)
+    {
+        // Look for the item in the cache
+        auto mapItr = m_cache_map.find(key);
+
+        // Any copy in the lower cache tiers is out of date now
+        if (mapItr == m_cache_map.end())
+        {
+            invalidateTiers(key);
+        }
+
+        // Let the other processes have the new value
+        if (m_shared_segment)
+        {
+            m_shared_segment->put(key, value);
+        }
+
+        // Add the item to the history list at the front (because it was just accessed)
+        m_cache_list.push_front(key_val_pair(key, value));
+
+        if (mapItr != m_cache_map.end())
+        {
+            // Remove it from it's old position in the list if it existed
+            m_cache_list.erase(mapItr->second);
+        }
+
+        // Add the list location to the cache
+        m_cache_map[key] = m_cache_list.begin();
+
+        setModified(key, modified);
+
+        // If we are exceeding the size of the cache, we need to purge the oldest 
+        // elements to the persistent store
+        while (m_cache_map.size() > m_max_cache_size)
+        {
+            // Get the last element in the history list (least recently used)
+            // and write it back first if it has been modified. If that fails 
+            // (e.g. another connection keeps the database locked), it stays 
+            // cached and modified, and the cache stays over its size until a 
+            // later write back succeeds.
+            key_val_pair lastElem = m_cache_list.back();
+            if (isModified(lastElem.first) && !writeToDB(lastElem.first, lastElem.second))
+            {
+                break;
+            }
+
+            m_modified_index.erase(&lastElem.first);
+            m_cache_map.erase(lastElem.first);
+            m_modification_map.erase(lastElem.first);
+            m_cache_list.pop_back();
+
+            // Keep it around in the lower cache tiers
+            evictToTiers(lastElem.first, lastElem.second);
+        }
+    }
+
+    /**
+     * @brief Throws if the data store was opened read only
+     */
+    void requireWritable() const
+    {
+        if (m_options.read_only)
+        {
+            throw std::logic_error("The data store is read only");
+        }
+    }
+
     /**
      * @brief Checks to see if the provided key has been modified
      * 
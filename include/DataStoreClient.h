@@ -0,0 +1,507 @@
+#ifndef _DATASTORE_CLIENT_
+#define _DATASTORE_CLIENT_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <stdexcept>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "HashRing.h"
+
+/**
+ * @brief One connection to a DataStoreServer (or any memcached server), speaking the meta
+ * protocol. \n
+ *
+ * Any number of threads can make calls on the connection at once. Whoever finds the connection
+ * idle sends everything that is queued up in one write and reads the responses back in order,
+ * while the others wait for theirs, so concurrent calls are pipelined automatically. On an I/O
+ * error or timeout every queued call fails and the connection is opened again by the next call.
+ *
+ */
+class ClientConnection
+{
+public:
+    /**
+     * @brief A request and the response to it
+     */
+    struct Call
+    {
+        std::string request;
+        // The first word of the response (VA, EN, HD, NS, NF ...) and the value, if there was one
+        std::string status;
+        std::string value;
+        bool done = false;
+        bool failed = false;
+    };
+
+    /**
+     * @brief Construct a new Client Connection object. The connection is opened on first use.
+     *
+     * @param address "<host>:<port>" or "unix:<path>"
+     * @param io_timeout_ms How long a send or receive can block before the batch fails (0 waits
+     * forever)
+     */
+    ClientConnection(const std::string& address, int io_timeout_ms = 0) :
+        m_address(address),
+        m_io_timeout_ms(io_timeout_ms),
+        m_fd(-1),
+        m_busy(false),
+        m_offset(0)
+    {
+    }
+
+    ~ClientConnection()
+    {
+        disconnect();
+    }
+
+    ClientConnection(const ClientConnection&) = delete;
+    ClientConnection& operator=(const ClientConnection&) = delete;
+
+    /**
+     * @brief Sends requests that each get exactly one response, and waits for the responses
+     *
+     * @param calls The requests, which are filled in with their responses
+     */
+    void call(std::vector<Call>& calls)
+    {
+        if (calls.empty())
+        {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (Call& call : calls)
+        {
+            m_queue.push_back(&call);
+        }
+
+        // Responses come back in order, so once the last call is done they all are
+        while (!calls.back().done)
+        {
+            if (m_busy)
+            {
+                m_cv.wait(lock);
+                continue;
+            }
+
+            m_busy = true;
+            std::vector<Call*> batch;
+            batch.swap(m_queue);
+            lock.unlock();
+            // The batch has to be finished and m_busy cleared even if exchange throws, or every
+            // waiter would block forever
+            bool success = false;
+            try
+            {
+                success = exchange(batch);
+            }
+            catch (...)
+            {
+                disconnect();
+            }
+            lock.lock();
+            for (Call* call : batch)
+            {
+                call->failed = !success;
+                call->done = true;
+            }
+            m_busy = false;
+            m_cv.notify_all();
+        }
+
+        if (calls.back().failed)
+        {
+            throw std::runtime_error("Request to " + m_address + " failed");
+        }
+    }
+
+private:
+    std::string m_address;
+    int m_io_timeout_ms;
+    int m_fd;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::vector<Call*> m_queue;
+    bool m_busy;
+
+    // Input that has been received but not parsed yet (only used by the thread sending a batch)
+    std::string m_input;
+    size_t m_offset;
+
+    bool exchange(std::vector<Call*>& batch)
+    {
+        if (m_fd < 0 && !connect())
+        {
+            return false;
+        }
+
+        std::string requests;
+        for (Call* call : batch)
+        {
+            requests += call->request;
+        }
+        bool success = writeAll(requests);
+        for (size_t i = 0; i < batch.size() && success; ++i)
+        {
+            success = readResponse(*batch[i]);
+        }
+
+        if (!success)
+        {
+            disconnect();
+        }
+        return success;
+    }
+
+    bool connect()
+    {
+        if (m_address.compare(0, 5, "unix:") == 0)
+        {
+            sockaddr_un address = sockaddr_un();
+            address.sun_family = AF_UNIX;
+            std::string path = m_address.substr(5);
+            if (path.size() >= sizeof(address.sun_path))
+            {
+                return false;
+            }
+            std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+            m_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (m_fd >= 0 && ::connect(m_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+            {
+                disconnect();
+            }
+            if (m_fd >= 0)
+            {
+                setTimeouts();
+            }
+            return m_fd >= 0;
+        }
+
+        size_t colon = m_address.rfind(':');
+        if (colon == std::string::npos)
+        {
+            return false;
+        }
+        addrinfo hints = addrinfo();
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addresses = nullptr;
+        if (getaddrinfo(m_address.substr(0, colon).c_str(), m_address.substr(colon + 1).c_str(), &hints, &addresses) != 0)
+        {
+            return false;
+        }
+        for (addrinfo* address = addresses; address && m_fd < 0; address = address->ai_next)
+        {
+            m_fd = ::socket(address->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (m_fd >= 0 && ::connect(m_fd, address->ai_addr, address->ai_addrlen) != 0)
+            {
+                disconnect();
+            }
+        }
+        freeaddrinfo(addresses);
+
+        int on = 1;
+        if (m_fd >= 0)
+        {
+            setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            setTimeouts();
+        }
+        return m_fd >= 0;
+    }
+
+    // A send or receive that times out fails with EAGAIN, which fails the batch
+    void setTimeouts()
+    {
+        if (m_io_timeout_ms <= 0)
+        {
+            return;
+        }
+        timeval timeout = timeval();
+        timeout.tv_sec = m_io_timeout_ms / 1000;
+        timeout.tv_usec = (m_io_timeout_ms % 1000) * 1000;
+        setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(m_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+
+    void disconnect()
+    {
+        if (m_fd >= 0)
+        {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+        m_input.clear();
+        m_offset = 0;
+    }
+
+    bool writeAll(const std::string& data)
+    {
+        size_t written = 0;
+        while (written < data.size())
+        {
+            ssize_t count = ::send(m_fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                return false;
+            }
+            written += static_cast<size_t>(count);
+        }
+        return true;
+    }
+
+    // Makes sure at least size bytes of input are waiting to be parsed
+    bool fill(size_t size)
+    {
+        if (m_offset > 0 && m_offset == m_input.size())
+        {
+            m_input.clear();
+            m_offset = 0;
+        }
+        char buffer[64 * 1024];
+        while (m_input.size() - m_offset < size)
+        {
+            ssize_t count = ::recv(m_fd, buffer, sizeof(buffer), 0);
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                return false;
+            }
+            m_input.append(buffer, static_cast<size_t>(count));
+        }
+        return true;
+    }
+
+    bool readLine(std::string& line)
+    {
+        size_t newline;
+        while ((newline = m_input.find("\r\n", m_offset)) == std::string::npos)
+        {
+            if (!fill(m_input.size() - m_offset + 1))
+            {
+                return false;
+            }
+        }
+        line.assign(m_input, m_offset, newline - m_offset);
+        m_offset = newline + 2;
+        return true;
+    }
+
+    bool readResponse(Call& call)
+    {
+        std::string line;
+        if (!readLine(line))
+        {
+            return false;
+        }
+        call.status = line.substr(0, line.find(' '));
+        if (call.status != "VA")
+        {
+            // Errors are answered in place of the request, but leave the connection usable
+            return true;
+        }
+
+        size_t size = static_cast<size_t>(std::strtoull(line.c_str() + 3, NULL, 10));
+        if (!fill(size + 2))
+        {
+            return false;
+        }
+        call.value.assign(m_input, m_offset, size);
+        m_offset += size + 2;
+        return true;
+    }
+};
+
+/**
+ * @brief A client for one or more DataStoreServer instances, with the same interface as a
+ * DataStore (put, get, getMany and erase). \n
+ *
+ * Keys are spread over the servers with a consistent hash ring, so adding a server only moves a
+ * small share of the keys. Every server gets a small pool of connections that calls are spread
+ * over; calls made at the same time on one connection are pipelined, and getMany sends all of
+ * the keys for a server as one pipeline. A failed request throws std::runtime_error.
+ *
+ */
+class DataStoreClient
+{
+public:
+    /**
+     * @brief Construct a new Data Store Client object
+     *
+     * @param servers The addresses of the servers ("<host>:<port>" or "unix:<path>")
+     * @param connections_per_server The number of connections to open to each server
+     * @param io_timeout_ms How long a send or receive can block before the request fails (0
+     * waits forever)
+     */
+    DataStoreClient(const std::vector<std::string>& servers, size_t connections_per_server = 4, int io_timeout_ms = 0) :
+        m_next(0)
+    {
+        if (servers.empty() || connections_per_server == 0)
+        {
+            throw std::invalid_argument("A data store client needs at least one server and connection");
+        }
+        for (const std::string& server : servers)
+        {
+            m_ring.addNode(server);
+            std::vector<std::unique_ptr<ClientConnection>> pool;
+            for (size_t i = 0; i < connections_per_server; ++i)
+            {
+                pool.push_back(std::unique_ptr<ClientConnection>(new ClientConnection(server, io_timeout_ms)));
+            }
+            m_pools.push_back(std::move(pool));
+        }
+    }
+
+    DataStoreClient(const DataStoreClient&) = delete;
+    DataStoreClient& operator=(const DataStoreClient&) = delete;
+
+    /**
+     * @brief Store a value into the data store
+     *
+     * @param key Key to reference item by
+     * @param value Value to store
+     */
+    void put(const std::string& key, const std::string& value)
+    {
+        checkKey(key);
+        std::vector<ClientConnection::Call> calls(1);
+        calls[0].request = "ms " + key + " " + std::to_string(value.size()) + "\r\n" + value + "\r\n";
+        connectionFor(m_ring.nodeOf(key)).call(calls);
+        if (calls[0].status != "HD")
+        {
+            throw std::runtime_error("Failed to store " + key + ": " + calls[0].status);
+        }
+    }
+
+    /**
+     * @brief Get a value from the data store
+     *
+     * @param key The key to retrieve
+     * @return std::string The stored value or empty string if the key does not exist
+     */
+    std::string get(const std::string& key)
+    {
+        checkKey(key);
+        std::vector<ClientConnection::Call> calls(1);
+        calls[0].request = "mg " + key + " v\r\n";
+        connectionFor(m_ring.nodeOf(key)).call(calls);
+        return calls[0].value;
+    }
+
+    /**
+     * @brief Get several values from the data store at once. The keys for every server are
+     * sent as one pipeline.
+     *
+     * @param keys The keys to retrieve
+     * @return std::vector<std::string> The stored values, in the same order as the keys
+     * (empty strings for keys that do not exist)
+     */
+    std::vector<std::string> getMany(const std::vector<std::string>& keys)
+    {
+        std::vector<std::vector<size_t>> positions(m_pools.size());
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            checkKey(keys[i]);
+            positions[m_ring.nodeOf(keys[i])].push_back(i);
+        }
+
+        std::vector<std::string> values(keys.size());
+        for (size_t server = 0; server < m_pools.size(); ++server)
+        {
+            if (positions[server].empty())
+            {
+                continue;
+            }
+            std::vector<ClientConnection::Call> calls(positions[server].size());
+            for (size_t j = 0; j < calls.size(); ++j)
+            {
+                calls[j].request = "mg " + keys[positions[server][j]] + " v\r\n";
+            }
+            connectionFor(server).call(calls);
+            for (size_t j = 0; j < calls.size(); ++j)
+            {
+                values[positions[server][j]] = std::move(calls[j].value);
+            }
+        }
+        return values;
+    }
+
+    /**
+     * @brief Remove a value from the data store
+     *
+     * @param key The key to remove
+     * @return true If the key existed
+     * @return false If the key did not exist
+     */
+    bool erase(const std::string& key)
+    {
+        checkKey(key);
+        std::vector<ClientConnection::Call> calls(1);
+        calls[0].request = "md " + key + "\r\n";
+        connectionFor(m_ring.nodeOf(key)).call(calls);
+        return calls[0].status == "HD";
+    }
+
+    /**
+     * @brief Gets the number of servers
+     *
+     * @return size_t The number of servers
+     */
+    size_t serverCount() const
+    {
+        return m_pools.size();
+    }
+
+private:
+    HashRing m_ring;
+    std::vector<std::vector<std::unique_ptr<ClientConnection>>> m_pools;
+    std::atomic<size_t> m_next;
+
+    ClientConnection& connectionFor(size_t server)
+    {
+        std::vector<std::unique_ptr<ClientConnection>>& pool = m_pools[server];
+        return *pool[m_next.fetch_add(1, std::memory_order_relaxed) % pool.size()];
+    }
+
+    /**
+     * @brief Throws if a key can not be sent in the text based protocol
+     */
+    static void checkKey(const std::string& key)
+    {
+        if (key.empty() || key.size() > 250)
+        {
+            throw std::invalid_argument("Keys must be 1 to 250 bytes long");
+        }
+        for (char c : key)
+        {
+            if (static_cast<unsigned char>(c) <= ' ' || c == 0x7f)
+            {
+                throw std::invalid_argument("Keys can not contain spaces or control characters");
+            }
+        }
+    }
+};
+
+#endif /* _DATASTORE_CLIENT_ */
@@ -0,0 +1,498 @@
+#ifndef _EVENT_LOOP_SERVER_
+#define _EVENT_LOOP_SERVER_
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <unordered_map>
+#include <stdexcept>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "OutputQueue.h"
+
+/**
+ * @brief Handles the requests of one client connection of an EventLoopServer
+ */
+class ProtocolHandler
+{
+public:
+    virtual ~ProtocolHandler() {}
+
+    /**
+     * @brief Handles every complete request at the start of the input. Clients may pipeline
+     * several requests without waiting for the responses, so there may be many of them.
+     *
+     * @param data The input received so far
+     * @param size The size of the input
+     * @param output The queue to append the responses to
+     * @param close Set to true to close the connection once the responses have been sent
+     * @return size_t The number of bytes of input that were used (the rest is handed back
+     * once more input has arrived)
+     */
+    virtual size_t process(const char* data, size_t size, OutputQueue& output, bool& close) = 0;
+};
+
+/**
+ * @brief A TCP or Unix socket server running one epoll event loop per thread. \n
+ *
+ * With TCP, every loop has its own listening socket bound to the same port with SO_REUSEPORT, so
+ * the kernel spreads new connections over the loops. A Unix socket is shared by all of the loops
+ * (with EPOLLEXCLUSIVE, so only one of them wakes up for a new connection). A connection stays on
+ * the loop that accepted it. Input is handed to the connection's ProtocolHandler as it arrives;
+ * while responses are waiting to be sent, the connection is not read from any further. \n
+ *
+ * A connection is read from at most READ_BUDGET bytes per wakeup. The loops are level
+ * triggered, so a connection with more waiting is simply reported again, after the others that
+ * are ready have had their turn. A connection whose unhandled input grows past max_input (a
+ * request bigger than any handler accepts, or a client that never finishes one) is closed.
+ *
+ */
+class EventLoopServer
+{
+public:
+    typedef std::function<std::unique_ptr<ProtocolHandler>()> handler_factory;
+
+    /**
+     * @brief Construct a new Event Loop Server object and start serving
+     *
+     * @param address "<host>:<port>" to listen on TCP (port 0 picks a free port), or
+     * "unix:<path>" to listen on a Unix socket (any file at the path is replaced)
+     * @param factory Creates the handler for every new connection (called from the loop threads)
+     * @param threads The number of event loops (0 for one per core)
+     * @param max_input The most input a connection can have waiting to be handled before it is
+     * closed
+     */
+    EventLoopServer(const std::string& address, const handler_factory& factory, size_t threads = 0, size_t max_input = DEFAULT_MAX_INPUT) :
+        m_factory(factory),
+        m_max_input(max_input),
+        m_port(0),
+        m_stop_fd(-1)
+    {
+        if (threads == 0)
+        {
+            threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+
+        try
+        {
+            m_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (m_stop_fd < 0)
+            {
+                throw std::runtime_error("Failed to create eventfd: " + std::string(strerror(errno)));
+            }
+
+            if (address.compare(0, 5, "unix:") == 0)
+            {
+                m_unix_path = address.substr(5);
+                m_listen_fds.push_back(listenUnix(m_unix_path));
+            }
+            else
+            {
+                size_t colon = address.rfind(':');
+                if (colon == std::string::npos)
+                {
+                    throw std::invalid_argument("Expected <host>:<port> or unix:<path>, got: " + address);
+                }
+                std::string host = address.substr(0, colon);
+                std::string port = address.substr(colon + 1);
+                for (size_t i = 0; i < threads; ++i)
+                {
+                    // Every socket after the first binds to the port the first one got
+                    m_listen_fds.push_back(listenTcp(host, i == 0 ? port : std::to_string(m_port)));
+                }
+            }
+
+            for (size_t i = 0; i < threads; ++i)
+            {
+                m_epoll_fds.push_back(createLoop(m_listen_fds[i % m_listen_fds.size()], m_listen_fds.size() == 1 && threads > 1));
+            }
+        }
+        catch (...)
+        {
+            closeAll();
+            throw;
+        }
+
+        for (size_t i = 0; i < threads; ++i)
+        {
+            m_threads.push_back(std::thread(&EventLoopServer::run, this, m_epoll_fds[i], m_listen_fds[i % m_listen_fds.size()]));
+        }
+    }
+
+    /**
+     * @brief Destroy the Event Loop Server object, closing every connection
+     */
+    ~EventLoopServer()
+    {
+        stop();
+        closeAll();
+    }
+
+    // Comfortably more than the largest request MemcachedProtocol or RespProtocol accepts
+    static constexpr size_t DEFAULT_MAX_INPUT = 128 * 1024 * 1024;
+
+    EventLoopServer(const EventLoopServer&) = delete;
+    EventLoopServer& operator=(const EventLoopServer&) = delete;
+
+    /**
+     * @brief Stops every event loop and waits for them to finish. Connections are closed
+     * without sending any responses that are still queued.
+     */
+    void stop()
+    {
+        uint64_t one = 1;
+        if (m_stop_fd >= 0 && ::write(m_stop_fd, &one, sizeof(one)) < 0)
+        {
+            std::cerr << "Failed to stop the event loops: " << strerror(errno) << std::endl;
+        }
+        for (std::thread& thread : m_threads)
+        {
+            if (thread.joinable())
+            {
+                thread.join();
+            }
+        }
+    }
+
+    /**
+     * @brief Gets the TCP port the server listens on
+     *
+     * @return uint16_t The port (0 for a Unix socket)
+     */
+    uint16_t port() const
+    {
+        return m_port;
+    }
+
+private:
+    // The most bytes to read from a connection at a time
+    static const size_t READ_SIZE = 64 * 1024;
+    // The most bytes to read from a connection per wakeup, so one busy client can not starve
+    // the others on its loop
+    static const size_t READ_BUDGET = 64 * 1024;
+
+    struct Connection
+    {
+        std::unique_ptr<ProtocolHandler> handler;
+        std::string input;
+        OutputQueue output;
+        bool closing = false;
+        bool writing = false;
+    };
+
+    handler_factory m_factory;
+    size_t m_max_input;
+    uint16_t m_port;
+    std::string m_unix_path;
+    int m_stop_fd;
+    std::vector<int> m_listen_fds;
+    std::vector<int> m_epoll_fds;
+    std::vector<std::thread> m_threads;
+
+    void closeAll()
+    {
+        for (int fd : m_epoll_fds)
+        {
+            ::close(fd);
+        }
+        m_epoll_fds.clear();
+        for (int fd : m_listen_fds)
+        {
+            ::close(fd);
+        }
+        m_listen_fds.clear();
+        if (!m_unix_path.empty())
+        {
+            ::unlink(m_unix_path.c_str());
+            m_unix_path.clear();
+        }
+        if (m_stop_fd >= 0)
+        {
+            ::close(m_stop_fd);
+            m_stop_fd = -1;
+        }
+    }
+
+    int listenTcp(const std::string& host, const std::string& port)
+    {
+        addrinfo hints = addrinfo();
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        addrinfo* addresses = nullptr;
+        int status = getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &addresses);
+        if (status != 0)
+        {
+            throw std::runtime_error("Failed to resolve " + host + ": " + gai_strerror(status));
+        }
+
+        int fd = ::socket(addresses->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int on = 1;
+        if (fd < 0 ||
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0 ||
+            ::bind(fd, addresses->ai_addr, addresses->ai_addrlen) != 0 ||
+            ::listen(fd, SOMAXCONN) != 0)
+        {
+            std::string error = strerror(errno);
+            freeaddrinfo(addresses);
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+            throw std::runtime_error("Failed to listen on " + host + ":" + port + ": " + error);
+        }
+        freeaddrinfo(addresses);
+
+        sockaddr_storage bound;
+        socklen_t length = sizeof(bound);
+        getsockname(fd, reinterpret_cast<sockaddr*>(&bound), &length);
+        m_port = ntohs(bound.ss_family == AF_INET6 ? reinterpret_cast<sockaddr_in6*>(&bound)->sin6_port
+                                                   : reinterpret_cast<sockaddr_in*>(&bound)->sin_port);
+        return fd;
+    }
+
+    static int listenUnix(const std::string& path)
+    {
+        sockaddr_un address = sockaddr_un();
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+        {
+            throw std::invalid_argument("Unix socket path is too long: " + path);
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        ::unlink(path.c_str());
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0 ||
+            ::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            ::listen(fd, SOMAXCONN) != 0)
+        {
+            std::string error = strerror(errno);
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+            throw std::runtime_error("Failed to listen on " + path + ": " + error);
+        }
+        return fd;
+    }
+
+    int createLoop(int listen_fd, bool shared)
+    {
+        int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0)
+        {
+            throw std::runtime_error("Failed to create epoll instance: " + std::string(strerror(errno)));
+        }
+
+        epoll_event event = epoll_event();
+        uint32_t events = EPOLLIN;
+        if (shared)
+        {
+            events |= EPOLLEXCLUSIVE;
+        }
+        event.events = events;
+        event.data.fd = listen_fd;
+        bool added = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) == 0;
+
+        // The stop eventfd is never read, so once written it wakes every loop
+        event.events = EPOLLIN;
+        event.data.fd = m_stop_fd;
+        added = added && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, m_stop_fd, &event) == 0;
+        if (!added)
+        {
+            std::string error = strerror(errno);
+            ::close(epoll_fd);
+            throw std::runtime_error("Failed to set up event loop: " + error);
+        }
+        return epoll_fd;
+    }
+
+    void run(int epoll_fd, int listen_fd)
+    {
+        std::unordered_map<int, Connection> connections;
+        epoll_event events[64];
+        bool running = true;
+        while (running)
+        {
+            int count = epoll_wait(epoll_fd, events, 64, -1);
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                std::cerr << "epoll_wait failed: " << strerror(errno) << std::endl;
+                break;
+            }
+
+            for (int i = 0; i < count; ++i)
+            {
+                int fd = events[i].data.fd;
+                if (fd == m_stop_fd)
+                {
+                    running = false;
+                }
+                else if (fd == listen_fd)
+                {
+                    acceptConnections(epoll_fd, listen_fd, connections);
+                }
+                else
+                {
+                    auto connectionItr = connections.find(fd);
+                    if (connectionItr != connections.end() && !service(epoll_fd, fd, connectionItr->second, events[i].events))
+                    {
+                        ::close(fd);
+                        connections.erase(connectionItr);
+                    }
+                }
+            }
+        }
+
+        for (auto& connection : connections)
+        {
+            ::close(connection.first);
+        }
+    }
+
+    void acceptConnections(int epoll_fd, int listen_fd, std::unordered_map<int, Connection>& connections)
+    {
+        while (true)
+        {
+            int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                {
+                    continue;
+                }
+                return;
+            }
+
+            // Responses are written whole, so there is nothing to gain from Nagle's algorithm
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+            epoll_event event = epoll_event();
+            event.events = EPOLLIN | EPOLLRDHUP;
+            event.data.fd = fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+            {
+                ::close(fd);
+                continue;
+            }
+            connections[fd].handler = m_factory();
+        }
+    }
+
+    /**
+     * @brief Reads what a connection has sent, handles it and sends the responses
+     *
+     * @return true If the connection stays open
+     * @return false If the connection should be closed
+     */
+    bool service(int epoll_fd, int fd, Connection& connection, uint32_t events)
+    {
+        if ((events & EPOLLERR) || ((events & EPOLLHUP) && !(events & EPOLLIN)))
+        {
+            return false;
+        }
+
+        if (!connection.writing && (events & (EPOLLIN | EPOLLRDHUP)))
+        {
+            if (!readInput(fd, connection))
+            {
+                return false;
+            }
+
+            bool close = false;
+            size_t used = connection.handler->process(connection.input.data(), connection.input.size(), connection.output, close);
+            connection.input.erase(0, used);
+            if (close)
+            {
+                connection.closing = true;
+                connection.input.clear();
+            }
+            else if (connection.input.size() > m_max_input)
+            {
+                return false;
+            }
+        }
+
+        if (!connection.output.send(fd))
+        {
+            return false;
+        }
+
+        bool writing = !connection.output.empty();
+        if (!writing && connection.closing)
+        {
+            return false;
+        }
+        if (writing != connection.writing)
+        {
+            // Wait for room to send the rest, without reading anything more in the meantime
+            epoll_event event = epoll_event();
+            event.events = writing ? EPOLLOUT : (EPOLLIN | EPOLLRDHUP);
+            event.data.fd = fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+            connection.writing = writing;
+        }
+        return true;
+    }
+
+    static bool readInput(int fd, Connection& connection)
+    {
+        char buffer[READ_SIZE];
+        size_t total = 0;
+        while (total < READ_BUDGET)
+        {
+            size_t size = std::min(sizeof(buffer), READ_BUDGET - total);
+            ssize_t count = ::read(fd, buffer, size);
+            if (count > 0)
+            {
+                connection.input.append(buffer, static_cast<size_t>(count));
+                total += static_cast<size_t>(count);
+                if (static_cast<size_t>(count) < size)
+                {
+                    return true;
+                }
+            }
+            else if (count == 0)
+            {
+                // The client is done sending, but still gets the responses to what it sent
+                connection.closing = true;
+                return true;
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return true;
+            }
+            else if (errno != EINTR)
+            {
+                return false;
+            }
+        }
+        // Whatever is left is reported again by the next epoll_wait
+        return true;
+    }
+};
+
+#endif /* _EVENT_LOOP_SERVER_ */
@@ -0,0 +1,263 @@
+#ifndef _FLASH_CACHE_
+#define _FLASH_CACHE_
+
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <iterator>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Crc32c.h"
+
+/**
+ * @brief A cache tier kept in a preallocated file on local flash, written as a circular log. \n
+ *
+ * Values are appended at the write position, which wraps around to the start of the file when it
+ * reaches the end; whatever was in the way is overwritten and dropped from the in memory key to
+ * offset index. Every record carries a CRC32C, so a read never returns a torn or stale record.
+ * The index only lives in memory, so the file is recreated when the cache is created and removed
+ * when it is destroyed.
+ *
+ */
+class FlashCache
+{
+public:
+    /**
+     * @brief Construct a new Flash Cache object
+     *
+     * @param path The file to keep the cache in
+     * @param capacity The size of the file in bytes
+     */
+    FlashCache(const std::string& path, size_t capacity) :
+        m_path(path),
+        m_capacity(capacity),
+        m_write_pos(0)
+    {
+        m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (m_fd < 0)
+        {
+            throw std::runtime_error("Failed to open flash cache file: " + path);
+        }
+
+        // Reserve all of the space up front, so writes never need to allocate blocks
+        if (posix_fallocate(m_fd, 0, static_cast<off_t>(capacity)) != 0)
+        {
+            ::close(m_fd);
+            ::unlink(path.c_str());
+            throw std::runtime_error("Failed to allocate flash cache file: " + path);
+        }
+    }
+
+    /**
+     * @brief Destroy the Flash Cache object, removing its file
+     */
+    ~FlashCache()
+    {
+        ::close(m_fd);
+        ::unlink(m_path.c_str());
+    }
+
+    FlashCache(const FlashCache&) = delete;
+    FlashCache& operator=(const FlashCache&) = delete;
+
+    /**
+     * @brief Appends a value to the log, replacing any older copy
+     *
+     * @param key The key of the value
+     * @param data The value (or its compressed form)
+     * @param compressed Whether data is compressed, to be handed back by take
+     * @return true If the value was written
+     * @return false If the value does not fit in the cache or the write failed
+     */
+    bool put(const std::string& key, const std::string& data, bool compressed)
+    {
+        erase(key);
+
+        size_t size = HEADER_SIZE + key.size() + data.size();
+        if (size > m_capacity)
+        {
+            return false;
+        }
+
+        // Wrap around when the record does not fit in what is left of the file
+        if (m_write_pos + size > m_capacity)
+        {
+            dropRange(m_write_pos, m_capacity);
+            m_write_pos = 0;
+        }
+        dropRange(m_write_pos, m_write_pos + size);
+
+        std::string record(HEADER_SIZE, '\0');
+        writeU32(&record[4], static_cast<uint32_t>(key.size()));
+        writeU32(&record[8], static_cast<uint32_t>(data.size()));
+        record[12] = compressed ? 1 : 0;
+        record += key;
+        record += data;
+        writeU32(&record[0], Crc32c::compute(record.data() + 4, record.size() - 4));
+
+        if (!writeAll(record, m_write_pos))
+        {
+            return false;
+        }
+
+        m_index[key] = Location{m_write_pos, size};
+        m_offsets[m_write_pos] = key;
+        m_write_pos += size;
+        return true;
+    }
+
+    /**
+     * @brief Reads a value back and removes it from the cache
+     *
+     * @param key The key of the value
+     * @param data The value (or its compressed form)
+     * @param compressed Whether data is compressed
+     * @return true If the value was in the cache
+     * @return false If the value was not in the cache (or its record was damaged)
+     */
+    bool take(const std::string& key, std::string& data, bool& compressed)
+    {
+        auto indexItr = m_index.find(key);
+        if (indexItr == m_index.end())
+        {
+            return false;
+        }
+        Location location = indexItr->second;
+        erase(key);
+
+        std::string record(location.size, '\0');
+        ssize_t result = ::pread(m_fd, &record[0], location.size, static_cast<off_t>(location.offset));
+        if (result != static_cast<ssize_t>(location.size) ||
+            readU32(&record[0]) != Crc32c::compute(record.data() + 4, record.size() - 4))
+        {
+            return false;
+        }
+
+        uint32_t keySize = readU32(&record[4]);
+        uint32_t dataSize = readU32(&record[8]);
+        if (HEADER_SIZE + keySize + dataSize != location.size || record.compare(HEADER_SIZE, keySize, key) != 0)
+        {
+            return false;
+        }
+        compressed = record[12] != 0;
+        data.assign(record, HEADER_SIZE + keySize, dataSize);
+        return true;
+    }
+
+    /**
+     * @brief Drops a value from the cache (its space is reused when the log wraps around)
+     *
+     * @param key The key of the value
+     * @return true If the value was in the cache
+     * @return false If the value was not in the cache
+     */
+    bool erase(const std::string& key)
+    {
+        auto indexItr = m_index.find(key);
+        if (indexItr == m_index.end())
+        {
+            return false;
+        }
+        m_offsets.erase(indexItr->second.offset);
+        m_index.erase(indexItr);
+        return true;
+    }
+
+    /**
+     * @brief Drops every value from the cache
+     */
+    void clear()
+    {
+        m_index.clear();
+        m_offsets.clear();
+    }
+
+    /**
+     * @brief Gets the number of values in the cache
+     *
+     * @return size_t The number of values
+     */
+    size_t size() const
+    {
+        return m_index.size();
+    }
+
+private:
+    // CRC32C, key size, data size (uint32) and a flags byte
+    static const size_t HEADER_SIZE = 13;
+
+    struct Location
+    {
+        uint64_t offset;
+        size_t size;
+    };
+
+    std::string m_path;
+    size_t m_capacity;
+    int m_fd;
+    uint64_t m_write_pos;
+    std::unordered_map<std::string, Location> m_index;
+    // The key of the record starting at every offset, to find what a write overwrites
+    std::map<uint64_t, std::string> m_offsets;
+
+    /**
+     * @brief Drops every record that overlaps a range of the file from the index
+     */
+    void dropRange(uint64_t start, uint64_t end)
+    {
+        // A record starting before the range may still reach into it
+        auto offsetItr = m_offsets.lower_bound(start);
+        if (offsetItr != m_offsets.begin())
+        {
+            auto previous = std::prev(offsetItr);
+            auto indexItr = m_index.find(previous->second);
+            if (indexItr != m_index.end() && previous->first + indexItr->second.size > start)
+            {
+                offsetItr = previous;
+            }
+        }
+
+        while (offsetItr != m_offsets.end() && offsetItr->first < end)
+        {
+            m_index.erase(offsetItr->second);
+            offsetItr = m_offsets.erase(offsetItr);
+        }
+    }
+
+    bool writeAll(const std::string& data, uint64_t offset)
+    {
+        size_t written = 0;
+        while (written < data.size())
+        {
+            ssize_t result = ::pwrite(m_fd, data.data() + written, data.size() - written, static_cast<off_t>(offset + written));
+            if (result < 0)
+            {
+                return false;
+            }
+            written += static_cast<size_t>(result);
+        }
+        return true;
+    }
+
+    static void writeU32(char* out, uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            out[i] = static_cast<char>(value >> (8 * i));
+        }
+    }
+
+    static uint32_t readU32(const char* in)
+    {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(in);
+        return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) |
+               (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+    }
+};
+
+#endif /* _FLASH_CACHE_ */
@@ -0,0 +1,106 @@
+#ifndef _HASH_RING_
+#define _HASH_RING_
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <cstdint>
+#include <stdexcept>
+
+#include "KeyHash.h"
+
+/**
+ * @brief A consistent hash ring that maps keys to nodes. \n
+ *
+ * Every node is placed on the ring at many pseudo random points, and a key belongs to the node
+ * of the first point at or after the key's hash. Adding a node only moves the keys that now
+ * fall just before its points, roughly 1/n of them, and all of them move to the new node. Nodes
+ * can be weighted, which scales their number of points and so their share of the keys.
+ *
+ */
+class HashRing
+{
+public:
+    /**
+     * @brief Construct a new Hash Ring object
+     *
+     * @param points_per_node The number of points each node gets on the ring (more points
+     * spread the keys more evenly)
+     */
+    HashRing(size_t points_per_node = 160) : m_points_per_node(points_per_node) {}
+
+    /**
+     * @brief Adds a node to the ring
+     *
+     * @param name The name of the node, which decides where its points are (so the same names
+     * always give the same ring)
+     * @param weight The node's share of the keys relative to a node of weight 1
+     * @return size_t The index of the node
+     */
+    size_t addNode(const std::string& name, double weight = 1.0)
+    {
+        if (!(weight > 0))
+        {
+            throw std::invalid_argument("Node weights must be positive");
+        }
+        size_t node = m_nodes.size();
+        m_nodes.push_back(name);
+        size_t points = std::max(static_cast<size_t>(1), static_cast<size_t>(m_points_per_node * weight + 0.5));
+        for (size_t i = 0; i < points; ++i)
+        {
+            m_points.push_back(std::make_pair(hash(name + "#" + std::to_string(i)), node));
+        }
+        std::sort(m_points.begin(), m_points.end());
+        return node;
+    }
+
+    /**
+     * @brief Gets the node a key belongs to
+     *
+     * @param key The key
+     * @return size_t The index of the node (the ring must not be empty)
+     */
+    size_t nodeOf(const std::string& key) const
+    {
+        auto pointItr = std::lower_bound(m_points.begin(), m_points.end(), std::make_pair(hash(key), static_cast<size_t>(0)));
+        return pointItr == m_points.end() ? m_points.front().second : pointItr->second;
+    }
+
+    /**
+     * @brief Gets the name of a node
+     *
+     * @param node The index of the node
+     * @return const std::string& The name of the node
+     */
+    const std::string& nodeName(size_t node) const
+    {
+        return m_nodes[node];
+    }
+
+    /**
+     * @brief Gets the number of nodes on the ring
+     *
+     * @return size_t The number of nodes
+     */
+    size_t size() const
+    {
+        return m_nodes.size();
+    }
+
+private:
+    size_t m_points_per_node;
+    std::vector<std::string> m_nodes;
+    std::vector<std::pair<uint64_t, size_t>> m_points;
+
+    /**
+     * @brief Hashes a string onto the ring. FNV-1a on its own leaves similar strings (like the
+     * point names of one node) close together, so its result is mixed further.
+     */
+    static uint64_t hash(const std::string& text)
+    {
+        return mixHash(fnv1aHash(text));
+    }
+};
+
+#endif /* _HASH_RING_ */
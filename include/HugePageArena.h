@@ -0,0 +1,349 @@
+#ifndef _HUGE_PAGE_ARENA_
+#define _HUGE_PAGE_ARENA_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+
+#include <sys/mman.h>
+
+/**
+ * @brief A region of memory backed by 2 MiB huge pages that many small objects are allocated
+ * from, so that walking between them (e.g. probing a hash table) needs far fewer TLB entries. \n
+ *
+ * The whole size is reserved as address space up front, but memory is only committed as it is
+ * used. The region comes from hugetlbfs when asked for and enough huge pages are reserved, and
+ * otherwise is ordinary memory that transparent huge pages are requested for with madvise. Freed
+ * blocks are kept on free lists by size and handed out again, and a freed large block (such as an
+ * outgrown hash table bucket array) is split up to serve smaller requests. Neighbouring free
+ * blocks are not merged. The arena is not thread safe.
+ *
+ */
+class HugePageArena
+{
+public:
+    static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    /**
+     * @brief How much of the arena is used, and how much of that is on huge pages
+     */
+    struct Stats
+    {
+        size_t reserved_bytes = 0;
+        size_t used_bytes = 0;
+        size_t huge_page_bytes = 0;
+        bool hugetlbfs = false;
+
+        /**
+         * @brief Gets the share of the used memory that is backed by huge pages
+         */
+        double coverage() const
+        {
+            if (used_bytes == 0)
+            {
+                return 0;
+            }
+            return huge_page_bytes >= used_bytes ? 1.0 : static_cast<double>(huge_page_bytes) / used_bytes;
+        }
+    };
+
+    /**
+     * @brief Construct a new Huge Page Arena object
+     *
+     * @param size The number of bytes to reserve (rounded up to whole huge pages)
+     * @param hugetlbfs Whether to try pages from hugetlbfs before transparent huge pages
+     */
+    HugePageArena(size_t size, bool hugetlbfs = false) :
+        m_base(nullptr),
+        m_size((size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE),
+        m_used(0),
+        m_hugetlbfs(false),
+        m_small_free(SMALL_CLASSES, nullptr)
+    {
+        if (m_size == 0)
+        {
+            throw std::invalid_argument("A huge page arena needs a size");
+        }
+
+        if (hugetlbfs)
+        {
+            void* mapping = mmap(NULL, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (mapping != MAP_FAILED)
+            {
+                m_base = static_cast<char*>(mapping);
+                m_hugetlbfs = true;
+                return;
+            }
+        }
+
+        // Map a huge page more than needed, so the region can start on a huge page boundary
+        size_t padded = m_size + HUGE_PAGE_SIZE;
+        void* mapping = mmap(NULL, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mapping == MAP_FAILED)
+        {
+            throw std::runtime_error("Failed to reserve " + std::to_string(m_size) + " bytes for a huge page arena");
+        }
+        uintptr_t start = reinterpret_cast<uintptr_t>(mapping);
+        uintptr_t aligned = (start + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        if (aligned > start)
+        {
+            munmap(mapping, aligned - start);
+        }
+        if (aligned + m_size < start + padded)
+        {
+            munmap(reinterpret_cast<void*>(aligned + m_size), start + padded - aligned - m_size);
+        }
+        m_base = reinterpret_cast<char*>(aligned);
+#ifdef MADV_HUGEPAGE
+        madvise(m_base, m_size, MADV_HUGEPAGE);
+#endif
+    }
+
+    ~HugePageArena()
+    {
+        munmap(m_base, m_size);
+    }
+
+    HugePageArena(const HugePageArena&) = delete;
+    HugePageArena& operator=(const HugePageArena&) = delete;
+
+    /**
+     * @brief Allocates a block from the arena
+     *
+     * @param size The size of the block
+     * @return void* The block (aligned for any type), or nullptr if the arena is full
+     */
+    void* allocate(size_t size)
+    {
+        size = roundSize(size);
+        void* block = nullptr;
+        if (size <= MAX_SMALL_SIZE)
+        {
+            FreeBlock*& head = m_small_free[size / ALIGNMENT - 1];
+            if (head)
+            {
+                block = head;
+                head = head->next;
+                return block;
+            }
+        }
+        else
+        {
+            block = takeLarge(size);
+            if (block)
+            {
+                return block;
+            }
+        }
+
+        if (m_size - m_used < size)
+        {
+            // Small blocks can still be cut from a large free one once the arena is full
+            return size <= MAX_SMALL_SIZE ? takeLarge(size) : nullptr;
+        }
+        block = m_base + m_used;
+        m_used += size;
+        return block;
+    }
+
+    /**
+     * @brief Returns a block to the arena
+     *
+     * @param block The block, from allocate
+     * @param size The size it was allocated with
+     */
+    void deallocate(void* block, size_t size)
+    {
+        size = roundSize(size);
+        if (size <= MAX_SMALL_SIZE)
+        {
+            FreeBlock* freed = static_cast<FreeBlock*>(block);
+            freed->next = m_small_free[size / ALIGNMENT - 1];
+            m_small_free[size / ALIGNMENT - 1] = freed;
+        }
+        else
+        {
+            m_large_free[size].push_back(block);
+        }
+    }
+
+    /**
+     * @brief Checks whether a block was allocated from the arena
+     */
+    bool contains(const void* block) const
+    {
+        const char* address = static_cast<const char*>(block);
+        return address >= m_base && address < m_base + m_size;
+    }
+
+    /**
+     * @brief Gets how much of the arena is used, and how much of that is on huge pages. The huge
+     * pages given by the kernel are read from /proc/self/smaps.
+     *
+     * @return Stats The arena's stats
+     */
+    Stats stats() const
+    {
+        Stats stats;
+        stats.reserved_bytes = m_size;
+        stats.used_bytes = m_used;
+        stats.hugetlbfs = m_hugetlbfs;
+        if (m_hugetlbfs)
+        {
+            stats.huge_page_bytes = (m_used + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+            return stats;
+        }
+
+        // The kernel may have merged the arena with the mappings next to it, or split it up, so
+        // every mapping overlapping it counts (but for no more than the part that overlaps)
+        uintptr_t base = reinterpret_cast<uintptr_t>(m_base);
+        std::ifstream smaps("/proc/self/smaps");
+        std::string line;
+        size_t overlap = 0;
+        while (std::getline(smaps, line))
+        {
+            // Every mapping starts with a "<start>-<end> ..." line, and its fields follow
+            size_t dash = line.find('-');
+            if (dash != std::string::npos && line.find(':') > line.find(' '))
+            {
+                uintptr_t start = std::stoull(line.substr(0, dash), nullptr, 16);
+                uintptr_t end = std::stoull(line.substr(dash + 1, line.find(' ') - dash - 1), nullptr, 16);
+                overlap = std::min(end, base + m_size) > std::max(start, base) ? std::min(end, base + m_size) - std::max(start, base) : 0;
+            }
+            else if (overlap > 0 && line.compare(0, 14, "AnonHugePages:") == 0)
+            {
+                std::istringstream field(line.substr(14));
+                size_t kb = 0;
+                field >> kb;
+                stats.huge_page_bytes += std::min(kb * 1024, overlap);
+            }
+        }
+        return stats;
+    }
+
+private:
+    static const size_t ALIGNMENT = alignof(std::max_align_t);
+    static const size_t MAX_SMALL_SIZE = 512;
+    static const size_t SMALL_CLASSES = MAX_SMALL_SIZE / ALIGNMENT;
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    char* m_base;
+    size_t m_size;
+    // Everything below this offset has been handed out at some point
+    size_t m_used;
+    bool m_hugetlbfs;
+
+    // Freed blocks by size, in steps of ALIGNMENT up to MAX_SMALL_SIZE
+    std::vector<FreeBlock*> m_small_free;
+    // Freed blocks larger than that (hash table bucket arrays and the like), by size
+    std::map<size_t, std::vector<void*>> m_large_free;
+
+    static size_t roundSize(size_t size)
+    {
+        return size == 0 ? ALIGNMENT : (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    /**
+     * @brief Takes the smallest large free block that fits, and puts what is left of it back
+     *
+     * @param size The rounded size to take
+     * @return void* The block, or nullptr if no large free block is big enough
+     */
+    void* takeLarge(size_t size)
+    {
+        auto freeItr = m_large_free.lower_bound(size);
+        if (freeItr == m_large_free.end())
+        {
+            return nullptr;
+        }
+        size_t found = freeItr->first;
+        void* block = freeItr->second.back();
+        freeItr->second.pop_back();
+        if (freeItr->second.empty())
+        {
+            m_large_free.erase(freeItr);
+        }
+        if (found > size)
+        {
+            deallocate(static_cast<char*>(block) + size, found - size);
+        }
+        return block;
+    }
+};
+
+/**
+ * @brief A standard allocator that allocates from a HugePageArena, and from the heap when it
+ * has no arena or the arena is full
+ *
+ * @tparam T The type to allocate
+ */
+template <class T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ArenaAllocator(HugePageArena* arena = nullptr) noexcept : m_arena(arena) {}
+
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept : m_arena(other.arena()) {}
+
+    T* allocate(size_t count)
+    {
+        if (m_arena)
+        {
+            void* block = m_arena->allocate(count * sizeof(T));
+            if (block)
+            {
+                return static_cast<T*>(block);
+            }
+        }
+        return static_cast<T*>(::operator new(count * sizeof(T)));
+    }
+
+    void deallocate(T* block, size_t count)
+    {
+        if (m_arena && m_arena->contains(block))
+        {
+            m_arena->deallocate(block, count * sizeof(T));
+            return;
+        }
+        ::operator delete(block);
+    }
+
+    HugePageArena* arena() const
+    {
+        return m_arena;
+    }
+
+private:
+    HugePageArena* m_arena;
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+    return a.arena() == b.arena();
+}
+
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+    return a.arena() != b.arena();
+}
+
+#endif /* _HUGE_PAGE_ARENA_ */
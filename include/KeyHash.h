@@ -0,0 +1,47 @@
+#ifndef _KEY_HASH_
+#define _KEY_HASH_
+
+#include <string>
+#include <cstdint>
+
+/**
+ * @brief Hashes a key with 64 bit FNV-1a. \n
+ * Used rather than std::hash wherever the hash outlives the process (such as the partition a
+ * key is stored in, or its slot in a shared memory segment), since FNV-1a gives the same result
+ * across builds, platforms and processes.
+ *
+ * @param key The key to hash
+ * @return uint64_t The hash of the key
+ */
+inline uint64_t fnv1aHash(const std::string& key)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : key)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Scrambles a hash so that every bit of the result depends on every bit of the input
+ * (the splitmix64 finalizer). \n
+ * FNV-1a on its own leaves similar keys with related hashes, so two different reductions of the
+ * same FNV-1a hash (say, one picking a shard and one picking a partition) are correlated. Mixing
+ * it first makes one of them independent of the other.
+ *
+ * @param hash The hash to mix
+ * @return uint64_t The mixed hash
+ */
+inline uint64_t mixHash(uint64_t hash)
+{
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+#endif /* _KEY_HASH_ */
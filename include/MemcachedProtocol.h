@@ -0,0 +1,421 @@
+#ifndef _MEMCACHED_PROTOCOL_
+#define _MEMCACHED_PROTOCOL_
+
+#include <string>
+#include <vector>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#include "EventLoopServer.h"
+#include "ShardedDataStore.h"
+
+/**
+ * @brief Serves a ShardedDataStore over the memcached text and meta protocols. \n
+ *
+ * Text commands: get, gets, set, add, replace, delete, version and quit. Meta commands: mg, ms,
+ * md and mn, with the k, s, v, q, f and O flags (and the E, R and S modes of ms). The keys of a
+ * multi key get are looked up with one getMany. The data store keeps nothing but the value, so
+ * client flags are always returned as 0, expiry times are ignored, cas values are always 0, and
+ * an empty value reads as a miss. add and replace check for the key and store it in two steps,
+ * so two clients racing on the same key may both succeed.
+ *
+ */
+class MemcachedProtocol : public ProtocolHandler
+{
+public:
+    /**
+     * @brief Construct a new Memcached Protocol object
+     *
+     * @param store The data store to serve (must outlive the handler)
+     */
+    MemcachedProtocol(ShardedDataStore& store) : m_store(store) {}
+
+    size_t process(const char* data, size_t size, OutputQueue& output, bool& close) override
+    {
+        size_t used = 0;
+        while (used < size && !close)
+        {
+            size_t consumed = processRequest(data + used, size - used, output, close);
+            if (consumed == 0)
+            {
+                break;
+            }
+            used += consumed;
+        }
+        return used;
+    }
+
+private:
+    // memcached's own limits on a command line and a key
+    static const size_t MAX_LINE = 2048;
+    static const size_t MAX_KEY = 250;
+    static const size_t MAX_VALUE = 64 * 1024 * 1024;
+
+    ShardedDataStore& m_store;
+
+    /**
+     * @brief Handles the request at the start of the input
+     *
+     * @return size_t The size of the request (0 if it has not all arrived yet)
+     */
+    size_t processRequest(const char* data, size_t size, OutputQueue& output, bool& close)
+    {
+        const char* newline = static_cast<const char*>(std::memchr(data, '\n', size));
+        if (!newline)
+        {
+            if (size > MAX_LINE)
+            {
+                output += "CLIENT_ERROR line too long\r\n";
+                close = true;
+                return size;
+            }
+            return 0;
+        }
+        size_t lineSize = static_cast<size_t>(newline - data) + 1;
+        size_t length = lineSize - 1;
+        if (length > 0 && data[length - 1] == '\r')
+        {
+            --length;
+        }
+
+        std::vector<std::string> tokens = split(data, length);
+        if (tokens.empty())
+        {
+            return lineSize;
+        }
+        // Nothing but a key is ever allowed to be that long
+        for (size_t i = 1; i < tokens.size(); ++i)
+        {
+            if (tokens[i].size() > MAX_KEY)
+            {
+                output += "CLIENT_ERROR bad command line format\r\n";
+                return lineSize;
+            }
+        }
+
+        const std::string& command = tokens[0];
+        if (command == "get" || command == "gets")
+        {
+            textGet(tokens, command == "gets", output);
+        }
+        else if (command == "set" || command == "add" || command == "replace")
+        {
+            return textStore(tokens, data, size, lineSize, output, close);
+        }
+        else if (command == "delete")
+        {
+            textDelete(tokens, output);
+        }
+        else if (command == "mg")
+        {
+            metaGet(tokens, output);
+        }
+        else if (command == "ms")
+        {
+            return metaSet(tokens, data, size, lineSize, output, close);
+        }
+        else if (command == "md")
+        {
+            metaDelete(tokens, output);
+        }
+        else if (command == "mn")
+        {
+            output += "MN\r\n";
+        }
+        else if (command == "version")
+        {
+            output += "VERSION 1.0.0\r\n";
+        }
+        else if (command == "quit")
+        {
+            close = true;
+        }
+        else
+        {
+            output += "ERROR\r\n";
+        }
+        return lineSize;
+    }
+
+    void textGet(const std::vector<std::string>& tokens, bool cas, OutputQueue& output)
+    {
+        if (tokens.size() < 2)
+        {
+            output += "ERROR\r\n";
+            return;
+        }
+
+        std::vector<std::string> keys(tokens.begin() + 1, tokens.end());
+        std::vector<std::string> values = keys.size() == 1 ? std::vector<std::string>(1, m_store.get(keys[0]))
+                                                           : m_store.getMany(keys);
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            if (values[i].empty())
+            {
+                continue;
+            }
+            output += "VALUE " + keys[i] + " 0 " + std::to_string(values[i].size()) + (cas ? " 0\r\n" : "\r\n");
+            output.appendValue(std::move(values[i]));
+            output += "\r\n";
+        }
+        output += "END\r\n";
+    }
+
+    size_t textStore(const std::vector<std::string>& tokens, const char* data, size_t size, size_t lineSize,
+                     OutputQueue& output, bool& close)
+    {
+        size_t bytes;
+        if (tokens.size() < 5 || tokens.size() > 6 || !parseSize(tokens[4], bytes))
+        {
+            output += "CLIENT_ERROR bad command line format\r\n";
+            return lineSize;
+        }
+
+        std::string value;
+        size_t used = dataBlock(data, size, lineSize, bytes, value, output, close);
+        if (used == 0 || close)
+        {
+            return used;
+        }
+
+        bool noreply = tokens.size() == 6 && tokens[5] == "noreply";
+        bool stored = store(tokens[0] == "add" ? 'E' : tokens[0] == "replace" ? 'R' : 'S', tokens[1], value);
+        if (!noreply)
+        {
+            output += stored ? "STORED\r\n" : "NOT_STORED\r\n";
+        }
+        return used;
+    }
+
+    void textDelete(const std::vector<std::string>& tokens, OutputQueue& output)
+    {
+        if (tokens.size() < 2 || tokens.size() > 3)
+        {
+            output += "CLIENT_ERROR bad command line format\r\n";
+            return;
+        }
+        bool deleted = m_store.erase(tokens[1]);
+        if (tokens.size() != 3 || tokens[2] != "noreply")
+        {
+            output += deleted ? "DELETED\r\n" : "NOT_FOUND\r\n";
+        }
+    }
+
+    void metaGet(const std::vector<std::string>& tokens, OutputQueue& output)
+    {
+        if (tokens.size() < 2)
+        {
+            output += "CLIENT_ERROR bad command line format\r\n";
+            return;
+        }
+
+        std::string value = m_store.get(tokens[1]);
+        bool quiet = hasFlag(tokens, 2, 'q');
+        if (value.empty())
+        {
+            if (!quiet)
+            {
+                output += "EN\r\n";
+            }
+            return;
+        }
+
+        std::string flags;
+        for (size_t i = 2; i < tokens.size(); ++i)
+        {
+            switch (tokens[i][0])
+            {
+            case 'k': flags += " k" + tokens[1]; break;
+            case 's': flags += " s" + std::to_string(value.size()); break;
+            case 'f': flags += " f0"; break;
+            case 'O': flags += " " + tokens[i]; break;
+            default: break;
+            }
+        }
+
+        if (hasFlag(tokens, 2, 'v'))
+        {
+            output += "VA " + std::to_string(value.size()) + flags + "\r\n";
+            output.appendValue(std::move(value));
+            output += "\r\n";
+        }
+        else
+        {
+            output += "HD" + flags + "\r\n";
+        }
+    }
+
+    size_t metaSet(const std::vector<std::string>& tokens, const char* data, size_t size, size_t lineSize,
+                   OutputQueue& output, bool& close)
+    {
+        size_t bytes;
+        if (tokens.size() < 3 || !parseSize(tokens[2], bytes))
+        {
+            output += "CLIENT_ERROR bad command line format\r\n";
+            return lineSize;
+        }
+
+        std::string value;
+        size_t used = dataBlock(data, size, lineSize, bytes, value, output, close);
+        if (used == 0 || close)
+        {
+            return used;
+        }
+
+        char mode = 'S';
+        std::string flags;
+        for (size_t i = 3; i < tokens.size(); ++i)
+        {
+            switch (tokens[i][0])
+            {
+            case 'M': mode = tokens[i].size() > 1 ? static_cast<char>(toupper(tokens[i][1])) : mode; break;
+            case 'k': flags += " k" + tokens[1]; break;
+            case 'O': flags += " " + tokens[i]; break;
+            default: break;
+            }
+        }
+        if (mode != 'S' && mode != 'E' && mode != 'R')
+        {
+            output += "CLIENT_ERROR invalid mode for ms\r\n";
+            return used;
+        }
+
+        bool stored = store(mode, tokens[1], value);
+        if (!stored)
+        {
+            output += "NS" + flags + "\r\n";
+        }
+        else if (!hasFlag(tokens, 3, 'q'))
+        {
+            output += "HD" + flags + "\r\n";
+        }
+        return used;
+    }
+
+    void metaDelete(const std::vector<std::string>& tokens, OutputQueue& output)
+    {
+        if (tokens.size() < 2)
+        {
+            output += "CLIENT_ERROR bad command line format\r\n";
+            return;
+        }
+
+        std::string flags;
+        for (size_t i = 2; i < tokens.size(); ++i)
+        {
+            if (tokens[i][0] == 'k')
+            {
+                flags += " k" + tokens[1];
+            }
+            else if (tokens[i][0] == 'O')
+            {
+                flags += " " + tokens[i];
+            }
+        }
+
+        if (!m_store.erase(tokens[1]))
+        {
+            output += "NF" + flags + "\r\n";
+        }
+        else if (!hasFlag(tokens, 2, 'q'))
+        {
+            output += "HD" + flags + "\r\n";
+        }
+    }
+
+    /**
+     * @brief Stores a value
+     *
+     * @param mode 'S' to always store it, 'E' (add) only if the key does not exist, and 'R'
+     * (replace) only if it does
+     * @return true If the value was stored
+     */
+    bool store(char mode, const std::string& key, const std::string& value)
+    {
+        if (mode != 'S' && m_store.get(key).empty() != (mode == 'E'))
+        {
+            return false;
+        }
+        m_store.put(key, value);
+        return true;
+    }
+
+    /**
+     * @brief Reads the data block that follows a storage command line
+     *
+     * @return size_t The size of the command line and data block (0 if the block has not all
+     * arrived yet)
+     */
+    static size_t dataBlock(const char* data, size_t size, size_t lineSize, size_t bytes, std::string& value,
+                            OutputQueue& output, bool& close)
+    {
+        if (bytes > MAX_VALUE)
+        {
+            // The value can not be skipped without reading it all, so give up on the connection
+            output += "SERVER_ERROR object too large for cache\r\n";
+            close = true;
+            return size;
+        }
+        if (size < lineSize + bytes + 2)
+        {
+            return 0;
+        }
+        if (data[lineSize + bytes] != '\r' || data[lineSize + bytes + 1] != '\n')
+        {
+            output += "CLIENT_ERROR bad data chunk\r\n";
+            close = true;
+            return size;
+        }
+        value.assign(data + lineSize, bytes);
+        return lineSize + bytes + 2;
+    }
+
+    static std::vector<std::string> split(const char* line, size_t length)
+    {
+        std::vector<std::string> tokens;
+        size_t start = 0;
+        while (start < length)
+        {
+            while (start < length && line[start] == ' ')
+            {
+                ++start;
+            }
+            size_t end = start;
+            while (end < length && line[end] != ' ')
+            {
+                ++end;
+            }
+            if (end > start)
+            {
+                tokens.push_back(std::string(line + start, end - start));
+            }
+            start = end;
+        }
+        return tokens;
+    }
+
+    static bool parseSize(const std::string& text, size_t& value)
+    {
+        if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos)
+        {
+            return false;
+        }
+        value = static_cast<size_t>(std::strtoull(text.c_str(), NULL, 10));
+        return true;
+    }
+
+    static bool hasFlag(const std::vector<std::string>& tokens, size_t first, char flag)
+    {
+        for (size_t i = first; i < tokens.size(); ++i)
+        {
+            if (tokens[i][0] == flag)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+#endif /* _MEMCACHED_PROTOCOL_ */
@@ -0,0 +1,80 @@
+#ifndef _NUMA_
+#define _NUMA_
+
+#include <sched.h>
+
+#ifdef DATASTORE_HAVE_NUMA
+#include <numa.h>
+#endif
+
+/**
+ * @brief Gets the number of NUMA nodes in the machine. \n
+ * Without libnuma (or on a machine without NUMA support) everything is on a single node 0.
+ *
+ * @return int The number of nodes
+ */
+inline int numaNodeCount()
+{
+#ifdef DATASTORE_HAVE_NUMA
+    if (numa_available() >= 0)
+    {
+        return numa_num_configured_nodes();
+    }
+#endif
+    return 1;
+}
+
+/**
+ * @brief Gets the NUMA node of the CPU the calling thread is running on
+ *
+ * @return int The node
+ */
+inline int currentNumaNode()
+{
+#ifdef DATASTORE_HAVE_NUMA
+    if (numa_available() >= 0)
+    {
+        int cpu = sched_getcpu();
+        int node = cpu < 0 ? 0 : numa_node_of_cpu(cpu);
+        return node < 0 ? 0 : node;
+    }
+#endif
+    return 0;
+}
+
+/**
+ * @brief Restricts the calling thread to the CPUs of a NUMA node and makes it allocate its memory
+ * there, so whatever it touches first ends up local to the node
+ *
+ * @param node The node
+ * @return true If the thread was bound to the node
+ * @return false If NUMA is not available (the thread is left as it was)
+ */
+inline bool bindToNumaNode(int node)
+{
+#ifdef DATASTORE_HAVE_NUMA
+    if (numa_available() >= 0 && numa_run_on_node(node) == 0)
+    {
+        numa_set_preferred(node);
+        return true;
+    }
+#endif
+    (void)node;
+    return false;
+}
+
+/**
+ * @brief Undoes bindToNumaNode, letting the calling thread run and allocate anywhere again
+ */
+inline void unbindFromNumaNode()
+{
+#ifdef DATASTORE_HAVE_NUMA
+    if (numa_available() >= 0)
+    {
+        numa_run_on_node(-1);
+        numa_set_localalloc();
+    }
+#endif
+}
+
+#endif /* _NUMA_ */
@@ -0,0 +1,189 @@
+#ifndef _OUTPUT_QUEUE_
+#define _OUTPUT_QUEUE_
+
+#include <string>
+#include <deque>
+#include <memory>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/**
+ * @brief The responses waiting to be sent on a connection, sent with sendmsg straight from the
+ * buffers they are in. \n
+ *
+ * Small pieces (protocol framing, short values) are copied together into owned chunks, which is
+ * cheaper than giving each its own iovec. Large values are kept in reference counted buffers that
+ * the queue points at without copying them, and that stay alive until the last of their bytes
+ * has been sent. \n
+ *
+ * This only saves copies on the way out. The data store's cache holds plain strings, so a value
+ * served from it has still been copied once, out of the cache under the shard lock, before it
+ * gets here; what the queue saves is copying it again into a response buffer (and again when
+ * that buffer grows while responses pile up).
+ *
+ */
+class OutputQueue
+{
+public:
+    // Values at least this big are sent from their own buffer rather than copied (below it, a
+    // memcpy costs less than the iovec and the reference count)
+    static const size_t SHARE_THRESHOLD = 4096;
+
+    OutputQueue() : m_offset(0), m_size(0) {}
+
+    /**
+     * @brief Appends a copy of some text
+     *
+     * @param data The text
+     * @param size The size of the text
+     */
+    void append(const char* data, size_t size)
+    {
+        if (size == 0)
+        {
+            return;
+        }
+        if (m_segments.empty() || m_segments.back().shared)
+        {
+            m_segments.push_back(Segment());
+        }
+        m_segments.back().owned.append(data, size);
+        m_size += size;
+    }
+
+    OutputQueue& operator+=(const std::string& text)
+    {
+        append(text.data(), text.size());
+        return *this;
+    }
+
+    OutputQueue& operator+=(const char* text)
+    {
+        append(text, std::char_traits<char>::length(text));
+        return *this;
+    }
+
+    /**
+     * @brief Appends a value, taking it over rather than copying it if it is large
+     *
+     * @param value The value
+     */
+    void appendValue(std::string&& value)
+    {
+        if (value.size() < SHARE_THRESHOLD)
+        {
+            append(value.data(), value.size());
+            return;
+        }
+        appendShared(std::make_shared<const std::string>(std::move(value)));
+    }
+
+    /**
+     * @brief Appends a buffer without copying it. The queue holds a reference until it has been sent.
+     *
+     * @param buffer The buffer
+     */
+    void appendShared(const std::shared_ptr<const std::string>& buffer)
+    {
+        if (!buffer || buffer->empty())
+        {
+            return;
+        }
+        Segment segment;
+        segment.shared = buffer;
+        m_segments.push_back(std::move(segment));
+        m_size += buffer->size();
+    }
+
+    /**
+     * @brief Checks whether everything has been sent
+     */
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    /**
+     * @brief Gets the number of bytes waiting to be sent
+     */
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    /**
+     * @brief Sends as much as the socket takes without blocking
+     *
+     * @param fd The (non blocking) socket
+     * @return true If everything was sent, or the socket is full
+     * @return false If the connection failed
+     */
+    bool send(int fd)
+    {
+        while (!m_segments.empty())
+        {
+            iovec iov[MAX_IOV];
+            size_t count = 0;
+            for (auto segmentItr = m_segments.begin(); segmentItr != m_segments.end() && count < MAX_IOV; ++segmentItr)
+            {
+                size_t skip = count == 0 ? m_offset : 0;
+                iov[count].iov_base = const_cast<char*>(segmentItr->data() + skip);
+                iov[count].iov_len = segmentItr->size() - skip;
+                ++count;
+            }
+
+            msghdr message = msghdr();
+            message.msg_iov = iov;
+            message.msg_iovlen = count;
+            ssize_t sent = ::sendmsg(fd, &message, MSG_NOSIGNAL);
+            if (sent < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            consume(static_cast<size_t>(sent));
+        }
+        return true;
+    }
+
+private:
+    static const size_t MAX_IOV = 64;
+
+    struct Segment
+    {
+        std::string owned;
+        std::shared_ptr<const std::string> shared;
+
+        const char* data() const { return shared ? shared->data() : owned.data(); }
+        size_t size() const { return shared ? shared->size() : owned.size(); }
+    };
+
+    std::deque<Segment> m_segments;
+    // How much of the first segment has already been sent
+    size_t m_offset;
+    size_t m_size;
+
+    void consume(size_t sent)
+    {
+        m_size -= sent;
+        while (sent > 0)
+        {
+            size_t left = m_segments.front().size() - m_offset;
+            if (sent < left)
+            {
+                m_offset += sent;
+                return;
+            }
+            sent -= left;
+            m_segments.pop_front();
+            m_offset = 0;
+        }
+    }
+};
+
+#endif /* _OUTPUT_QUEUE_ */
@@ -0,0 +1,58 @@
+#ifndef _PARALLEL_FOR_
+#define _PARALLEL_FOR_
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+/**
+ * @brief Runs a task for every index in [0, count) on a bounded set of worker threads. \n
+ * The calling thread takes part in the work, and no more than one thread per hardware core 
+ * (or max_threads, if smaller) is ever used, regardless of how many tasks there are.
+ * 
+ * @param count The number of tasks to run
+ * @param task The task to run, called with the index of the task
+ * @param max_threads The maximum number of threads to use (0 to use one per hardware core)
+ */
+inline void parallelFor(size_t count, const std::function<void(size_t)>& task, size_t max_threads = 0)
+{
+    if (max_threads == 0)
+    {
+        max_threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+    size_t threads = std::min(count, max_threads);
+
+    // Nothing to gain from extra threads
+    if (threads <= 1)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            task(i);
+        }
+        return;
+    }
+
+    // Workers pull the next task index until they run out
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++)
+        {
+            task(i);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threads; ++i)
+    {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : workers)
+    {
+        thread.join();
+    }
+}
+
+#endif /* _PARALLEL_FOR_ */
@@ -0,0 +1,356 @@
+#ifndef _PARTITIONED_DATASTORE_
+#define _PARTITIONED_DATASTORE_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <algorithm>
+#include <stdexcept>
+
+#include "HashRing.h"
+
+/**
+ * @brief Spreads keys over several data stores with a consistent hash ring, to grow past what
+ * one store (or one host) can hold. \n
+ *
+ * The nodes can be anything with the DataStore interface (put, get, getMany and erase): local
+ * DataStore or ShardedDataStore instances, or DataStoreClient connections to remote servers.
+ * Nodes are weighted, so a larger host can take a larger share of the keys. \n
+ *
+ * Adding a node only moves the keys that the ring now gives to it. They are moved lazily: a key
+ * that is not on its new node is looked for on the nodes that owned it before each earlier resize
+ * (the most recent first), and moved over when it is found. \n
+ *
+ * Every key missing from its owner (including keys that do not exist at all) costs one ring
+ * lookup per kept ring, and a get on every earlier owner, so the number of kept rings is capped.
+ * Once everything has been moved (e.g. by reading every key, or with migrateKeys), dropOldRings
+ * forgets the earlier rings and brings misses back to a single get. Calls may be made from
+ * several threads if the nodes allow it.
+ *
+ */
+template <class Node>
+class PartitionedDataStore
+{
+public:
+    /**
+     * @brief Construct a new Partitioned Data Store object
+     *
+     * @param points_per_node The number of points each node gets on the ring
+     * @param max_rings The most rings (the current one and those from before earlier resizes)
+     * to keep looking for keys in
+     */
+    PartitionedDataStore(size_t points_per_node = 160, size_t max_rings = 8) :
+        m_max_rings(std::max(static_cast<size_t>(1), max_rings)),
+        m_rings(1, HashRing(points_per_node)) {}
+
+    PartitionedDataStore(const PartitionedDataStore&) = delete;
+    PartitionedDataStore& operator=(const PartitionedDataStore&) = delete;
+
+    /**
+     * @brief Adds a node, which takes over its share of the keys. Throws std::logic_error if
+     * max_rings rings are kept already (see dropOldRings).
+     *
+     * @param name The name of the node (which decides where it goes on the ring)
+     * @param node The node
+     * @param weight The node's share of the keys relative to a node of weight 1
+     * @return size_t The index of the node
+     */
+    size_t addNode(const std::string& name, std::unique_ptr<Node> node, double weight = 1.0)
+    {
+        if (!node)
+        {
+            throw std::invalid_argument("Partitioned data store nodes can not be null");
+        }
+        std::unique_lock<std::shared_mutex> lock(m_mutex);
+        if (m_rings.size() >= m_max_rings && m_rings.back().size() > 0)
+        {
+            throw std::logic_error("Too many resizes with keys left to move, migrate them and drop the old rings first");
+        }
+        HashRing ring = m_rings.back();
+        size_t index = ring.addNode(name, weight);
+        m_nodes.push_back(std::move(node));
+        // The first node replaces the empty ring, as there are no keys to find on it
+        if (m_rings.back().size() == 0)
+        {
+            m_rings.back() = std::move(ring);
+        }
+        else
+        {
+            m_rings.push_back(std::move(ring));
+        }
+        return index;
+    }
+
+    /**
+     * @brief Store a value into the data store
+     *
+     * @param key Key to reference item by
+     * @param value Value to store
+     */
+    void put(const std::string& key, const std::string& value)
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        size_t owner = ownerOf(key);
+        std::vector<size_t> previous = previousOwnersOf(key, owner);
+        if (previous.empty())
+        {
+            m_nodes[owner]->put(key, value);
+            return;
+        }
+
+        // Make sure an older copy is not found (and moved over this one) later
+        std::lock_guard<std::mutex> migration_lock(m_migration_mutex);
+        m_nodes[owner]->put(key, value);
+        for (size_t node : previous)
+        {
+            m_nodes[node]->erase(key);
+        }
+    }
+
+    /**
+     * @brief Get a value from the data store
+     *
+     * @param key The key to retrieve
+     * @return std::string The stored value or empty string if the key does not exist
+     */
+    std::string get(const std::string& key)
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        size_t owner = ownerOf(key);
+        std::string value = m_nodes[owner]->get(key);
+        if (value.empty())
+        {
+            value = migrate(key, owner);
+        }
+        return value;
+    }
+
+    /**
+     * @brief Get several values from the data store at once, with one getMany per node
+     *
+     * @param keys The keys to retrieve
+     * @return std::vector<std::string> The stored values, in the same order as the keys
+     * (empty strings for keys that do not exist)
+     */
+    std::vector<std::string> getMany(const std::vector<std::string>& keys)
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        std::vector<size_t> owners(keys.size());
+        std::vector<std::vector<size_t>> positions(m_nodes.size());
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            owners[i] = ownerOf(keys[i]);
+            positions[owners[i]].push_back(i);
+        }
+
+        std::vector<std::string> values(keys.size());
+        for (size_t node = 0; node < m_nodes.size(); ++node)
+        {
+            if (positions[node].empty())
+            {
+                continue;
+            }
+            std::vector<std::string> node_keys;
+            node_keys.reserve(positions[node].size());
+            for (size_t position : positions[node])
+            {
+                node_keys.push_back(keys[position]);
+            }
+            std::vector<std::string> node_values = m_nodes[node]->getMany(node_keys);
+            for (size_t j = 0; j < node_values.size(); ++j)
+            {
+                values[positions[node][j]] = std::move(node_values[j]);
+            }
+        }
+
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            if (values[i].empty())
+            {
+                values[i] = migrate(keys[i], owners[i]);
+            }
+        }
+        return values;
+    }
+
+    /**
+     * @brief Remove a value from the data store
+     *
+     * @param key The key to remove
+     * @return true If the key existed
+     * @return false If the key did not exist
+     */
+    bool erase(const std::string& key)
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        size_t owner = ownerOf(key);
+        std::vector<size_t> previous = previousOwnersOf(key, owner);
+        if (previous.empty())
+        {
+            return m_nodes[owner]->erase(key);
+        }
+
+        // A migration in progress could put the old copy back on the owner after it was erased
+        std::lock_guard<std::mutex> migration_lock(m_migration_mutex);
+        bool found = m_nodes[owner]->erase(key);
+        for (size_t node : previous)
+        {
+            found = m_nodes[node]->erase(key) || found;
+        }
+        return found;
+    }
+
+    /**
+     * @brief Moves keys that are still on a node that owned them before a resize over to their
+     * current node now, rather than when they are next read
+     *
+     * @param keys The keys to move
+     * @return size_t The number of keys that were moved
+     */
+    size_t migrateKeys(const std::vector<std::string>& keys)
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        size_t moved = 0;
+        for (const std::string& key : keys)
+        {
+            size_t owner = ownerOf(key);
+            if (!previousOwnersOf(key, owner).empty() && m_nodes[owner]->get(key).empty() && !migrate(key, owner).empty())
+            {
+                ++moved;
+            }
+        }
+        return moved;
+    }
+
+    /**
+     * @brief Forgets the rings from before earlier resizes, so a key missing from its node is no
+     * longer looked for anywhere else. Any key not moved yet (see migrateKeys) is lost.
+     */
+    void dropOldRings()
+    {
+        std::unique_lock<std::shared_mutex> lock(m_mutex);
+        m_rings.erase(m_rings.begin(), m_rings.end() - 1);
+    }
+
+    /**
+     * @brief Gets the number of rings kept (the current one and those from before earlier resizes
+     * whose keys may not all have been moved)
+     *
+     * @return size_t The number of rings
+     */
+    size_t ringCount() const
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        return m_rings.size();
+    }
+
+    /**
+     * @brief Gets the node a key belongs to
+     *
+     * @param key The key
+     * @return size_t The index of the node
+     */
+    size_t nodeOf(const std::string& key) const
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        return ownerOf(key);
+    }
+
+    /**
+     * @brief Gets a node
+     *
+     * @param index The index of the node
+     * @return Node& The node
+     */
+    Node& node(size_t index)
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        return *m_nodes[index];
+    }
+
+    /**
+     * @brief Gets the number of nodes
+     *
+     * @return size_t The number of nodes
+     */
+    size_t nodeCount() const
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        return m_nodes.size();
+    }
+
+private:
+    mutable std::shared_mutex m_mutex;
+    // Held while a key is moved, so a put on the new node can not be overwritten by the old value
+    std::mutex m_migration_mutex;
+    std::vector<std::unique_ptr<Node>> m_nodes;
+    size_t m_max_rings;
+    // The ring after every resize since the last dropOldRings, oldest first (the last one is the current ring)
+    std::vector<HashRing> m_rings;
+
+    size_t ownerOf(const std::string& key) const
+    {
+        if (m_nodes.empty())
+        {
+            throw std::logic_error("A partitioned data store needs at least one node");
+        }
+        return m_rings.back().nodeOf(key);
+    }
+
+    /**
+     * @brief Gets the nodes other than its owner that a key belonged to before earlier resizes
+     *
+     * @return std::vector<size_t> The nodes, the one that owned it most recently first
+     */
+    std::vector<size_t> previousOwnersOf(const std::string& key, size_t owner) const
+    {
+        std::vector<size_t> owners;
+        for (size_t i = m_rings.size() - 1; i-- > 0;)
+        {
+            size_t node = m_rings[i].nodeOf(key);
+            if (node != owner && std::find(owners.begin(), owners.end(), node) == owners.end())
+            {
+                owners.push_back(node);
+            }
+        }
+        return owners;
+    }
+
+    /**
+     * @brief Moves a key that was missing from its owner over from the most recent node that
+     * owned it before, if it is on any of them
+     *
+     * @return std::string The value, or an empty string if the key does not exist
+     */
+    std::string migrate(const std::string& key, size_t owner)
+    {
+        std::vector<size_t> previous = previousOwnersOf(key, owner);
+        if (previous.empty())
+        {
+            return std::string();
+        }
+
+        std::lock_guard<std::mutex> migration_lock(m_migration_mutex);
+        // Another thread may have moved or written the key in the meantime
+        std::string value = m_nodes[owner]->get(key);
+        if (!value.empty())
+        {
+            return value;
+        }
+        for (size_t node : previous)
+        {
+            value = m_nodes[node]->get(key);
+            if (!value.empty())
+            {
+                m_nodes[owner]->put(key, value);
+                m_nodes[node]->erase(key);
+                break;
+            }
+        }
+        return value;
+    }
+};
+
+#endif /* _PARTITIONED_DATASTORE_ */
@@ -0,0 +1,416 @@
+#ifndef _READ_AHEAD_VFS_
+#define _READ_AHEAD_VFS_
+
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <stdexcept>
+#include <sqlite3.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * @brief A sqlite VFS layered over another one (the default VFS unless told otherwise), that
+ * gives the data store its own read ahead on the main database files. \n
+ *
+ * Lookups of single keys read scattered pages, where anything the kernel reads ahead is wasted,
+ * while scans (forEach, warmUp, snapshots) read the pages of the table mostly in file order. So
+ * every read that starts where the one before it ended asks the kernel (with
+ * posix_fadvise(POSIX_FADV_WILLNEED)) to fetch the next window of the file in the background,
+ * and nothing is requested for the others. The window is set per file through
+ * sqlite3_file_control with FCNTL_SET_WINDOW (0 turns it off), and the read counters are added
+ * up with FCNTL_GET_STATS. Pages reached through memory mapped I/O (mmap_size) bypass the layer.
+ *
+ * The advice is given through a descriptor of the layer's own, since the VFS below does not
+ * hand out its own; the page cache is shared by every descriptor of a file.
+ *
+ */
+class ReadAheadVfs
+{
+public:
+    // sqlite3_file_control opcodes, well clear of sqlite's own
+    static const int FCNTL_SET_WINDOW = 0x52410001;
+    static const int FCNTL_GET_STATS = 0x52410002;
+
+    /**
+     * @brief Reads of a main database file through the layer
+     */
+    struct Stats
+    {
+        long long reads = 0;
+        long long bytes_read = 0;
+        // Reads that started where the one before ended
+        long long sequential_reads = 0;
+        // Bytes the kernel was asked to read ahead
+        long long read_ahead_bytes = 0;
+    };
+
+    /**
+     * @brief Registers the layer over a VFS (once per process and VFS)
+     *
+     * @param base The name of the VFS to layer over (empty for the default VFS)
+     * @return std::string The name to open databases with to go through the layer
+     */
+    static std::string registerOver(const std::string& base)
+    {
+        static std::mutex mutex;
+        static std::map<std::string, std::unique_ptr<Registration>> registrations;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unique_ptr<Registration>& registration = registrations[base];
+        if (!registration)
+        {
+            sqlite3_vfs* below = sqlite3_vfs_find(base.empty() ? NULL : base.c_str());
+            if (!below)
+            {
+                registrations.erase(base);
+                throw std::runtime_error("No such sqlite VFS: " + base);
+            }
+
+            std::unique_ptr<Registration> created(new Registration());
+            created->name = "readahead-" + std::string(below->zName);
+            sqlite3_vfs& vfs = created->vfs;
+            vfs.iVersion = std::min(below->iVersion, 3);
+            vfs.szOsFile = static_cast<int>(sizeof(File)) + below->szOsFile;
+            vfs.mxPathname = below->mxPathname;
+            vfs.zName = created->name.c_str();
+            vfs.pAppData = below;
+            vfs.xOpen = open;
+            vfs.xDelete = remove;
+            vfs.xAccess = access;
+            vfs.xFullPathname = fullPathname;
+            vfs.xDlOpen = dlOpen;
+            vfs.xDlError = dlError;
+            vfs.xDlSym = dlSym;
+            vfs.xDlClose = dlClose;
+            vfs.xRandomness = randomness;
+            vfs.xSleep = sleep;
+            vfs.xCurrentTime = currentTime;
+            vfs.xGetLastError = getLastError;
+            vfs.xCurrentTimeInt64 = currentTimeInt64;
+            vfs.xSetSystemCall = setSystemCall;
+            vfs.xGetSystemCall = getSystemCall;
+            vfs.xNextSystemCall = nextSystemCall;
+            if (sqlite3_vfs_register(&vfs, 0) != SQLITE_OK)
+            {
+                registrations.erase(base);
+                throw std::runtime_error("Failed to register sqlite VFS: " + created->name);
+            }
+            registration = std::move(created);
+        }
+        return registration->name;
+    }
+
+private:
+    struct Registration
+    {
+        sqlite3_vfs vfs = sqlite3_vfs();
+        std::string name;
+    };
+
+    // sqlite allocates szOsFile bytes for every open file: this, followed by the file of the
+    // VFS below. sqlite serializes the calls on a file, so nothing here needs a lock.
+    struct File
+    {
+        sqlite3_file base;
+        sqlite3_file* below;
+        // Only open for main database files
+        int fd;
+        sqlite3_int64 window;
+        sqlite3_int64 next_offset;
+        // The kernel has been asked for everything up to here
+        sqlite3_int64 advised_end;
+        Stats stats;
+    };
+
+    static sqlite3_vfs* below(sqlite3_vfs* vfs)
+    {
+        return static_cast<sqlite3_vfs*>(vfs->pAppData);
+    }
+
+    static sqlite3_file* below(sqlite3_file* file)
+    {
+        return reinterpret_cast<File*>(file)->below;
+    }
+
+    static const sqlite3_io_methods* methods()
+    {
+        static sqlite3_io_methods io = [] {
+            sqlite3_io_methods io = sqlite3_io_methods();
+            io.iVersion = 3;
+            io.xClose = close;
+            io.xRead = read;
+            io.xWrite = write;
+            io.xTruncate = truncate;
+            io.xSync = sync;
+            io.xFileSize = fileSize;
+            io.xLock = lock;
+            io.xUnlock = unlock;
+            io.xCheckReservedLock = checkReservedLock;
+            io.xFileControl = fileControl;
+            io.xSectorSize = sectorSize;
+            io.xDeviceCharacteristics = deviceCharacteristics;
+            io.xShmMap = shmMap;
+            io.xShmLock = shmLock;
+            io.xShmBarrier = shmBarrier;
+            io.xShmUnmap = shmUnmap;
+            io.xFetch = fetch;
+            io.xUnfetch = unfetch;
+            return io;
+        }();
+        return &io;
+    }
+
+    static int open(sqlite3_vfs* vfs, const char* name, sqlite3_file* file, int flags, int* out_flags)
+    {
+        File* layered = reinterpret_cast<File*>(file);
+        layered->base.pMethods = nullptr;
+        layered->below = reinterpret_cast<sqlite3_file*>(layered + 1);
+        int status = below(vfs)->xOpen(below(vfs), name, layered->below, flags, out_flags);
+        if (status != SQLITE_OK)
+        {
+            return status;
+        }
+
+        layered->fd = -1;
+        if ((flags & SQLITE_OPEN_MAIN_DB) && name)
+        {
+            layered->fd = ::open(name, O_RDONLY | O_CLOEXEC);
+        }
+        layered->window = 0;
+        layered->next_offset = -1;
+        layered->advised_end = 0;
+        layered->stats = Stats();
+        layered->base.pMethods = methods();
+        return SQLITE_OK;
+    }
+
+    static int close(sqlite3_file* file)
+    {
+        File* layered = reinterpret_cast<File*>(file);
+        if (layered->fd >= 0)
+        {
+            ::close(layered->fd);
+            layered->fd = -1;
+        }
+        return layered->below->pMethods ? layered->below->pMethods->xClose(layered->below) : SQLITE_OK;
+    }
+
+    static int read(sqlite3_file* file, void* buffer, int amount, sqlite3_int64 offset)
+    {
+        File* layered = reinterpret_cast<File*>(file);
+        if (layered->fd >= 0)
+        {
+            ++layered->stats.reads;
+            layered->stats.bytes_read += amount;
+            sqlite3_int64 end = offset + amount;
+            if (offset == layered->next_offset)
+            {
+                ++layered->stats.sequential_reads;
+                // Ask for the next window once the reads get within half a window of the end of
+                // the last one, so the kernel stays ahead of the scan
+                if (layered->window > 0 && end + layered->window / 2 > layered->advised_end)
+                {
+                    sqlite3_int64 start = std::max(end, layered->advised_end);
+                    posix_fadvise(layered->fd, static_cast<off_t>(start), static_cast<off_t>(end + layered->window - start), POSIX_FADV_WILLNEED);
+                    layered->stats.read_ahead_bytes += end + layered->window - start;
+                    layered->advised_end = end + layered->window;
+                }
+            }
+            layered->next_offset = end;
+        }
+        return below(file)->pMethods->xRead(below(file), buffer, amount, offset);
+    }
+
+    static int fileControl(sqlite3_file* file, int op, void* arg)
+    {
+        File* layered = reinterpret_cast<File*>(file);
+        if (op == FCNTL_SET_WINDOW)
+        {
+            layered->window = std::max<sqlite3_int64>(0, *static_cast<sqlite3_int64*>(arg));
+            layered->advised_end = 0;
+            return SQLITE_OK;
+        }
+        if (op == FCNTL_GET_STATS)
+        {
+            Stats* stats = static_cast<Stats*>(arg);
+            stats->reads += layered->stats.reads;
+            stats->bytes_read += layered->stats.bytes_read;
+            stats->sequential_reads += layered->stats.sequential_reads;
+            stats->read_ahead_bytes += layered->stats.read_ahead_bytes;
+            return SQLITE_OK;
+        }
+        return below(file)->pMethods->xFileControl(below(file), op, arg);
+    }
+
+    // Everything else goes straight to the VFS below
+
+    static int write(sqlite3_file* file, const void* buffer, int amount, sqlite3_int64 offset)
+    {
+        return below(file)->pMethods->xWrite(below(file), buffer, amount, offset);
+    }
+
+    static int truncate(sqlite3_file* file, sqlite3_int64 size)
+    {
+        return below(file)->pMethods->xTruncate(below(file), size);
+    }
+
+    static int sync(sqlite3_file* file, int flags)
+    {
+        return below(file)->pMethods->xSync(below(file), flags);
+    }
+
+    static int fileSize(sqlite3_file* file, sqlite3_int64* size)
+    {
+        return below(file)->pMethods->xFileSize(below(file), size);
+    }
+
+    static int lock(sqlite3_file* file, int level)
+    {
+        return below(file)->pMethods->xLock(below(file), level);
+    }
+
+    static int unlock(sqlite3_file* file, int level)
+    {
+        return below(file)->pMethods->xUnlock(below(file), level);
+    }
+
+    static int checkReservedLock(sqlite3_file* file, int* reserved)
+    {
+        return below(file)->pMethods->xCheckReservedLock(below(file), reserved);
+    }
+
+    static int sectorSize(sqlite3_file* file)
+    {
+        return below(file)->pMethods->xSectorSize(below(file));
+    }
+
+    static int deviceCharacteristics(sqlite3_file* file)
+    {
+        return below(file)->pMethods->xDeviceCharacteristics(below(file));
+    }
+
+    static int shmMap(sqlite3_file* file, int region, int size, int extend, void volatile** memory)
+    {
+        const sqlite3_io_methods* io = below(file)->pMethods;
+        return io->iVersion >= 2 ? io->xShmMap(below(file), region, size, extend, memory) : SQLITE_IOERR;
+    }
+
+    static int shmLock(sqlite3_file* file, int offset, int count, int flags)
+    {
+        const sqlite3_io_methods* io = below(file)->pMethods;
+        return io->iVersion >= 2 ? io->xShmLock(below(file), offset, count, flags) : SQLITE_IOERR;
+    }
+
+    static void shmBarrier(sqlite3_file* file)
+    {
+        const sqlite3_io_methods* io = below(file)->pMethods;
+        if (io->iVersion >= 2)
+        {
+            io->xShmBarrier(below(file));
+        }
+    }
+
+    static int shmUnmap(sqlite3_file* file, int remove)
+    {
+        const sqlite3_io_methods* io = below(file)->pMethods;
+        return io->iVersion >= 2 ? io->xShmUnmap(below(file), remove) : SQLITE_OK;
+    }
+
+    static int fetch(sqlite3_file* file, sqlite3_int64 offset, int amount, void** pointer)
+    {
+        const sqlite3_io_methods* io = below(file)->pMethods;
+        if (io->iVersion >= 3)
+        {
+            return io->xFetch(below(file), offset, amount, pointer);
+        }
+        *pointer = nullptr;
+        return SQLITE_OK;
+    }
+
+    static int unfetch(sqlite3_file* file, sqlite3_int64 offset, void* pointer)
+    {
+        const sqlite3_io_methods* io = below(file)->pMethods;
+        return io->iVersion >= 3 ? io->xUnfetch(below(file), offset, pointer) : SQLITE_OK;
+    }
+
+    static int remove(sqlite3_vfs* vfs, const char* name, int sync_dir)
+    {
+        return below(vfs)->xDelete(below(vfs), name, sync_dir);
+    }
+
+    static int access(sqlite3_vfs* vfs, const char* name, int flags, int* result)
+    {
+        return below(vfs)->xAccess(below(vfs), name, flags, result);
+    }
+
+    static int fullPathname(sqlite3_vfs* vfs, const char* name, int size, char* out)
+    {
+        return below(vfs)->xFullPathname(below(vfs), name, size, out);
+    }
+
+    static void* dlOpen(sqlite3_vfs* vfs, const char* name)
+    {
+        return below(vfs)->xDlOpen(below(vfs), name);
+    }
+
+    static void dlError(sqlite3_vfs* vfs, int size, char* message)
+    {
+        below(vfs)->xDlError(below(vfs), size, message);
+    }
+
+    static void (*dlSym(sqlite3_vfs* vfs, void* handle, const char* symbol))(void)
+    {
+        return below(vfs)->xDlSym(below(vfs), handle, symbol);
+    }
+
+    static void dlClose(sqlite3_vfs* vfs, void* handle)
+    {
+        below(vfs)->xDlClose(below(vfs), handle);
+    }
+
+    static int randomness(sqlite3_vfs* vfs, int size, char* out)
+    {
+        return below(vfs)->xRandomness(below(vfs), size, out);
+    }
+
+    static int sleep(sqlite3_vfs* vfs, int microseconds)
+    {
+        return below(vfs)->xSleep(below(vfs), microseconds);
+    }
+
+    static int currentTime(sqlite3_vfs* vfs, double* time)
+    {
+        return below(vfs)->xCurrentTime(below(vfs), time);
+    }
+
+    static int getLastError(sqlite3_vfs* vfs, int size, char* message)
+    {
+        return below(vfs)->xGetLastError ? below(vfs)->xGetLastError(below(vfs), size, message) : 0;
+    }
+
+    static int currentTimeInt64(sqlite3_vfs* vfs, sqlite3_int64* time)
+    {
+        return below(vfs)->xCurrentTimeInt64(below(vfs), time);
+    }
+
+    static int setSystemCall(sqlite3_vfs* vfs, const char* name, sqlite3_syscall_ptr call)
+    {
+        return below(vfs)->xSetSystemCall(below(vfs), name, call);
+    }
+
+    static sqlite3_syscall_ptr getSystemCall(sqlite3_vfs* vfs, const char* name)
+    {
+        return below(vfs)->xGetSystemCall(below(vfs), name);
+    }
+
+    static const char* nextSystemCall(sqlite3_vfs* vfs, const char* name)
+    {
+        return below(vfs)->xNextSystemCall(below(vfs), name);
+    }
+};
+
+#endif /* _READ_AHEAD_VFS_ */
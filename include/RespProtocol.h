@@ -0,0 +1,650 @@
+#ifndef _RESP_PROTOCOL_
+#define _RESP_PROTOCOL_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#include "EventLoopServer.h"
+#include "ShardedDataStore.h"
+
+/**
+ * @brief Expiry times for keys, shared by every connection of a server. \n
+ *
+ * The data store itself has no notion of expiry, so the server keeps the deadlines: a key that
+ * has expired is removed from the store when it is next accessed, or by sweep.
+ *
+ */
+class KeyExpiry
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    /**
+     * @brief Sets (or replaces) the deadline of a key
+     *
+     * @param key The key
+     * @param deadline When the key expires
+     */
+    void set(const std::string& key, clock::time_point deadline)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        removeLocked(key);
+        m_keys[key] = m_deadlines.insert(std::make_pair(deadline, key));
+    }
+
+    /**
+     * @brief Removes the deadline of a key, if it has one
+     *
+     * @param key The key
+     */
+    void clear(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        removeLocked(key);
+    }
+
+    /**
+     * @brief Checks whether a key has expired, and if so forgets its deadline
+     *
+     * @param key The key
+     * @return true If the key has expired (and should be removed from the store)
+     */
+    bool expire(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto keyItr = m_keys.find(key);
+        if (keyItr == m_keys.end() || keyItr->second->first > clock::now())
+        {
+            return false;
+        }
+        m_deadlines.erase(keyItr->second);
+        m_keys.erase(keyItr);
+        return true;
+    }
+
+    /**
+     * @brief Gets the time a key has left
+     *
+     * @param key The key
+     * @param remaining The time left until the key expires
+     * @return true If the key has a deadline
+     */
+    bool remaining(const std::string& key, clock::duration& remaining)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto keyItr = m_keys.find(key);
+        if (keyItr == m_keys.end())
+        {
+            return false;
+        }
+        remaining = std::max(clock::duration::zero(), keyItr->second->first - clock::now());
+        return true;
+    }
+
+    /**
+     * @brief Takes a few of the keys that have expired, earliest first
+     *
+     * @param limit The most keys to take
+     * @return std::vector<std::string> The keys (which should be removed from the store)
+     */
+    std::vector<std::string> sweep(size_t limit)
+    {
+        std::vector<std::string> expired;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        clock::time_point now = clock::now();
+        while (expired.size() < limit && !m_deadlines.empty() && m_deadlines.begin()->first <= now)
+        {
+            expired.push_back(m_deadlines.begin()->second);
+            m_keys.erase(m_deadlines.begin()->second);
+            m_deadlines.erase(m_deadlines.begin());
+        }
+        return expired;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::multimap<clock::time_point, std::string> m_deadlines;
+    std::unordered_map<std::string, std::multimap<clock::time_point, std::string>::iterator> m_keys;
+
+    void removeLocked(const std::string& key)
+    {
+        auto keyItr = m_keys.find(key);
+        if (keyItr != m_keys.end())
+        {
+            m_deadlines.erase(keyItr->second);
+            m_keys.erase(keyItr);
+        }
+    }
+};
+
+/**
+ * @brief Serves a ShardedDataStore over the Redis protocol (RESP2, or RESP3 after HELLO 3). \n
+ *
+ * Supports GET, SET (with EX, PX, NX, XX and KEEPTTL), MGET, MSET, DEL, EXISTS, EXPIRE, TTL,
+ * PING, ECHO, HELLO and QUIT, plus empty replies to COMMAND and CONFIG so tools that probe the
+ * server on startup (redis-cli, redis-benchmark) carry on. Every complete command in the input is
+ * parsed first, then runs of pipelined GET/MGET commands are served with one getMany and runs of
+ * plain SET/MSET commands are stored with one putMany. As with the memcached front-end, an empty
+ * value reads as a missing key. SET with NX or XX checks for the key and stores it in two steps,
+ * so two clients racing on the same key may both succeed.
+ *
+ */
+class RespProtocol : public ProtocolHandler
+{
+public:
+    /**
+     * @brief Construct a new Resp Protocol object
+     *
+     * @param store The data store to serve (must outlive the handler)
+     * @param expiry The expiry times of the keys, shared by every connection (must outlive the handler)
+     */
+    RespProtocol(ShardedDataStore& store, KeyExpiry& expiry) :
+        m_store(store),
+        m_expiry(expiry),
+        m_version(2)
+    {
+    }
+
+    size_t process(const char* data, size_t size, OutputQueue& output, bool& close) override
+    {
+        std::vector<std::vector<std::string>> commands;
+        size_t used = 0;
+        while (used < size)
+        {
+            std::vector<std::string> args;
+            std::string error;
+            size_t consumed = parseCommand(data + used, size - used, args, error);
+            if (!error.empty())
+            {
+                execute(commands, output, close);
+                output += "-ERR Protocol error: " + error + "\r\n";
+                close = true;
+                return size;
+            }
+            if (consumed == 0)
+            {
+                break;
+            }
+            used += consumed;
+            if (!args.empty())
+            {
+                commands.push_back(std::move(args));
+            }
+        }
+
+        // Drop a few of the keys that expired without anyone asking for them
+        for (const std::string& key : m_expiry.sweep(SWEEP_LIMIT))
+        {
+            m_store.erase(key);
+        }
+
+        execute(commands, output, close);
+        return used;
+    }
+
+private:
+    static const size_t MAX_INLINE = 64 * 1024;
+    static const size_t MAX_ARGS = 1024 * 1024;
+    static const size_t MAX_BULK = 64 * 1024 * 1024;
+    static const size_t SWEEP_LIMIT = 16;
+    // The longest expiry accepted (100 years), far enough from the clock's limits that adding it to now() can not overflow
+    static constexpr long long MAX_EXPIRE_MS = 100LL * 365 * 24 * 3600 * 1000;
+    // The most bytes of a client's command name echoed back in an error
+    static const size_t MAX_ERROR_NAME = 128;
+
+    ShardedDataStore& m_store;
+    KeyExpiry& m_expiry;
+    int m_version;
+
+    /**
+     * @brief Parses the command at the start of the input, either a RESP array of bulk strings
+     * or an inline command (words separated by spaces)
+     *
+     * @return size_t The size of the command (0 if it has not all arrived yet)
+     */
+    static size_t parseCommand(const char* data, size_t size, std::vector<std::string>& args, std::string& error)
+    {
+        size_t pos = 0;
+        std::string line;
+        if (data[0] != '*')
+        {
+            if (!readLine(data, size, pos, line))
+            {
+                if (size > MAX_INLINE)
+                {
+                    error = "too big inline request";
+                }
+                return 0;
+            }
+            size_t start = 0;
+            while (start < line.size())
+            {
+                size_t end = line.find(' ', start);
+                end = end == std::string::npos ? line.size() : end;
+                if (end > start)
+                {
+                    args.push_back(line.substr(start, end - start));
+                }
+                start = end + 1;
+            }
+            upperCaseName(args);
+            return pos;
+        }
+
+        long long count;
+        if (!readLine(data, size, pos, line))
+        {
+            return 0;
+        }
+        if (!parseInteger(line.substr(1), count) || count > static_cast<long long>(MAX_ARGS))
+        {
+            error = "invalid multibulk length";
+            return 0;
+        }
+
+        for (long long i = 0; i < count; ++i)
+        {
+            if (!readLine(data, size, pos, line))
+            {
+                args.clear();
+                return 0;
+            }
+            long long length;
+            if (line.empty() || line[0] != '$' || !parseInteger(line.substr(1), length) || length < 0 ||
+                length > static_cast<long long>(MAX_BULK))
+            {
+                error = "invalid bulk length";
+                return 0;
+            }
+            if (size - pos < static_cast<size_t>(length) + 2)
+            {
+                args.clear();
+                return 0;
+            }
+            args.push_back(std::string(data + pos, static_cast<size_t>(length)));
+            pos += static_cast<size_t>(length) + 2;
+        }
+        upperCaseName(args);
+        return pos;
+    }
+
+    /**
+     * @brief Runs parsed commands, serving runs of reads and runs of writes in batches
+     */
+    void execute(const std::vector<std::vector<std::string>>& commands, OutputQueue& output, bool& close)
+    {
+        size_t i = 0;
+        while (i < commands.size() && !close)
+        {
+            size_t end = i;
+            if (isBatchedRead(commands[i]))
+            {
+                while (end < commands.size() && isBatchedRead(commands[end]))
+                {
+                    ++end;
+                }
+                executeReads(commands, i, end, output);
+            }
+            else if (isBatchedWrite(commands[i]))
+            {
+                while (end < commands.size() && isBatchedWrite(commands[end]))
+                {
+                    ++end;
+                }
+                executeWrites(commands, i, end, output);
+            }
+            else
+            {
+                executeCommand(commands[i], output, close);
+                end = i + 1;
+            }
+            i = end;
+        }
+    }
+
+    static bool isBatchedRead(const std::vector<std::string>& args)
+    {
+        return (args[0] == "GET" && args.size() == 2) || (args[0] == "MGET" && args.size() >= 2);
+    }
+
+    static bool isBatchedWrite(const std::vector<std::string>& args)
+    {
+        return (args[0] == "SET" && args.size() == 3) || (args[0] == "MSET" && args.size() >= 3 && args.size() % 2 == 1);
+    }
+
+    void executeReads(const std::vector<std::vector<std::string>>& commands, size_t begin, size_t end, OutputQueue& output)
+    {
+        std::vector<std::string> keys;
+        for (size_t i = begin; i < end; ++i)
+        {
+            for (size_t j = 1; j < commands[i].size(); ++j)
+            {
+                expireIfDue(commands[i][j]);
+                keys.push_back(commands[i][j]);
+            }
+        }
+
+        std::vector<std::string> values = keys.size() == 1 ? std::vector<std::string>(1, m_store.get(keys[0]))
+                                                           : m_store.getMany(keys);
+        size_t next = 0;
+        for (size_t i = begin; i < end; ++i)
+        {
+            if (commands[i][0] == "MGET")
+            {
+                output += "*" + std::to_string(commands[i].size() - 1) + "\r\n";
+            }
+            for (size_t j = 1; j < commands[i].size(); ++j, ++next)
+            {
+                appendValue(std::move(values[next]), output);
+            }
+        }
+    }
+
+    void executeWrites(const std::vector<std::vector<std::string>>& commands, size_t begin, size_t end, OutputQueue& output)
+    {
+        std::vector<DataStore::key_val_pair> entries;
+        for (size_t i = begin; i < end; ++i)
+        {
+            for (size_t j = 1; j + 1 < commands[i].size(); j += 2)
+            {
+                m_expiry.clear(commands[i][j]);
+                entries.push_back(DataStore::key_val_pair(commands[i][j], commands[i][j + 1]));
+            }
+        }
+        m_store.putMany(entries);
+
+        for (size_t i = begin; i < end; ++i)
+        {
+            output += "+OK\r\n";
+        }
+    }
+
+    void executeCommand(const std::vector<std::string>& args, OutputQueue& output, bool& close)
+    {
+        const std::string& name = args[0];
+        if (name == "SET" && args.size() >= 3)
+        {
+            set(args, output);
+        }
+        else if ((name == "DEL" || name == "EXISTS") && args.size() >= 2)
+        {
+            long long count = 0;
+            for (size_t i = 1; i < args.size(); ++i)
+            {
+                expireIfDue(args[i]);
+                if (name == "DEL")
+                {
+                    m_expiry.clear(args[i]);
+                    count += m_store.erase(args[i]) ? 1 : 0;
+                }
+                else
+                {
+                    count += m_store.get(args[i]).empty() ? 0 : 1;
+                }
+            }
+            output += ":" + std::to_string(count) + "\r\n";
+        }
+        else if (name == "EXPIRE" && args.size() == 3)
+        {
+            long long seconds;
+            if (!parseInteger(args[2], seconds))
+            {
+                output += "-ERR value is not an integer or out of range\r\n";
+                return;
+            }
+            if (seconds > MAX_EXPIRE_MS / 1000)
+            {
+                output += "-ERR invalid expire time in 'expire' command\r\n";
+                return;
+            }
+            expireIfDue(args[1]);
+            if (m_store.get(args[1]).empty())
+            {
+                output += ":0\r\n";
+                return;
+            }
+            if (seconds <= 0)
+            {
+                m_expiry.clear(args[1]);
+                m_store.erase(args[1]);
+            }
+            else
+            {
+                m_expiry.set(args[1], KeyExpiry::clock::now() + std::chrono::seconds(seconds));
+            }
+            output += ":1\r\n";
+        }
+        else if (name == "TTL" && args.size() == 2)
+        {
+            expireIfDue(args[1]);
+            KeyExpiry::clock::duration remaining;
+            if (m_store.get(args[1]).empty())
+            {
+                output += ":-2\r\n";
+            }
+            else if (!m_expiry.remaining(args[1], remaining))
+            {
+                output += ":-1\r\n";
+            }
+            else
+            {
+                // Round up, so a key only reports 0 once it has expired
+                long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count();
+                output += ":" + std::to_string((ms + 999) / 1000) + "\r\n";
+            }
+        }
+        else if (name == "PING" && args.size() <= 2)
+        {
+            if (args.size() == 2)
+            {
+                appendBulk(args[1], output);
+            }
+            else
+            {
+                output += "+PONG\r\n";
+            }
+        }
+        else if (name == "ECHO" && args.size() == 2)
+        {
+            appendBulk(args[1], output);
+        }
+        else if (name == "HELLO")
+        {
+            hello(args, output);
+        }
+        else if (name == "COMMAND" || name == "CONFIG")
+        {
+            output += "*0\r\n";
+        }
+        else if (name == "QUIT")
+        {
+            output += "+OK\r\n";
+            close = true;
+        }
+        else if (name == "GET" || name == "SET" || name == "MGET" || name == "MSET" || name == "DEL" ||
+                 name == "EXISTS" || name == "EXPIRE" || name == "TTL" || name == "PING" || name == "ECHO")
+        {
+            std::string lower = name;
+            std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+            output += "-ERR wrong number of arguments for '" + lower + "' command\r\n";
+        }
+        else
+        {
+            output += "-ERR unknown command '" + printableName(name) + "'\r\n";
+        }
+    }
+
+    void set(const std::vector<std::string>& args, OutputQueue& output)
+    {
+        bool onlyIfMissing = false;
+        bool onlyIfExists = false;
+        bool keepTtl = false;
+        long long ttlMs = 0;
+        for (size_t i = 3; i < args.size(); ++i)
+        {
+            std::string option = args[i];
+            std::transform(option.begin(), option.end(), option.begin(), ::toupper);
+            long long amount;
+            if ((option == "EX" || option == "PX") && i + 1 < args.size())
+            {
+                if (!parseInteger(args[i + 1], amount))
+                {
+                    output += "-ERR value is not an integer or out of range\r\n";
+                    return;
+                }
+                if (amount <= 0 || amount > (option == "EX" ? MAX_EXPIRE_MS / 1000 : MAX_EXPIRE_MS))
+                {
+                    output += "-ERR invalid expire time in 'set' command\r\n";
+                    return;
+                }
+                ttlMs = option == "EX" ? amount * 1000 : amount;
+                ++i;
+            }
+            else if (option == "NX" || option == "XX" || option == "KEEPTTL")
+            {
+                onlyIfMissing = onlyIfMissing || option == "NX";
+                onlyIfExists = onlyIfExists || option == "XX";
+                keepTtl = keepTtl || option == "KEEPTTL";
+            }
+            else
+            {
+                output += "-ERR syntax error\r\n";
+                return;
+            }
+        }
+
+        const std::string& key = args[1];
+        if (onlyIfMissing || onlyIfExists)
+        {
+            expireIfDue(key);
+            bool exists = !m_store.get(key).empty();
+            if ((onlyIfMissing && exists) || (onlyIfExists && !exists))
+            {
+                appendValue("", output);
+                return;
+            }
+        }
+
+        m_store.put(key, args[2]);
+        if (ttlMs > 0)
+        {
+            m_expiry.set(key, KeyExpiry::clock::now() + std::chrono::milliseconds(ttlMs));
+        }
+        else if (!keepTtl)
+        {
+            m_expiry.clear(key);
+        }
+        output += "+OK\r\n";
+    }
+
+    void hello(const std::vector<std::string>& args, OutputQueue& output)
+    {
+        if (args.size() >= 2)
+        {
+            long long version;
+            if (!parseInteger(args[1], version) || (version != 2 && version != 3))
+            {
+                output += "-NOPROTO unsupported protocol version\r\n";
+                return;
+            }
+            m_version = static_cast<int>(version);
+        }
+
+        // A map in RESP3, a flat array of the same pairs in RESP2
+        output += m_version == 3 ? "%3\r\n" : "*6\r\n";
+        appendBulk("server", output);
+        appendBulk("datastore", output);
+        appendBulk("version", output);
+        appendBulk("1.0.0", output);
+        appendBulk("proto", output);
+        output += ":" + std::to_string(m_version) + "\r\n";
+    }
+
+    void expireIfDue(const std::string& key)
+    {
+        if (m_expiry.expire(key))
+        {
+            m_store.erase(key);
+        }
+    }
+
+    void appendValue(std::string&& value, OutputQueue& output) const
+    {
+        if (value.empty())
+        {
+            output += m_version == 3 ? "_\r\n" : "$-1\r\n";
+            return;
+        }
+        // The value itself is handed over to the queue rather than copied
+        output += "$" + std::to_string(value.size()) + "\r\n";
+        output.appendValue(std::move(value));
+        output += "\r\n";
+    }
+
+    /**
+     * @brief Makes a command name safe to echo back in an error line: control characters (which
+     * could end the line and start a reply of the client's choosing) become spaces, and long
+     * names are cut short
+     */
+    static std::string printableName(const std::string& name)
+    {
+        std::string printable = name.substr(0, MAX_ERROR_NAME);
+        for (char& c : printable)
+        {
+            if (static_cast<unsigned char>(c) < 0x20 || c == 0x7f)
+            {
+                c = ' ';
+            }
+        }
+        return printable;
+    }
+
+    static void appendBulk(const std::string& value, OutputQueue& output)
+    {
+        output += "$" + std::to_string(value.size()) + "\r\n";
+        output += value;
+        output += "\r\n";
+    }
+
+    static bool readLine(const char* data, size_t size, size_t& pos, std::string& line)
+    {
+        const char* newline = static_cast<const char*>(std::memchr(data + pos, '\n', size - pos));
+        if (!newline)
+        {
+            return false;
+        }
+        size_t end = static_cast<size_t>(newline - data);
+        line.assign(data + pos, end > pos && data[end - 1] == '\r' ? end - pos - 1 : end - pos);
+        pos = end + 1;
+        return true;
+    }
+
+    static bool parseInteger(const std::string& text, long long& value)
+    {
+        if (text.empty() || text.size() > 18)
+        {
+            return false;
+        }
+        char* end = nullptr;
+        value = std::strtoll(text.c_str(), &end, 10);
+        return *end == '\0';
+    }
+
+    static void upperCaseName(std::vector<std::string>& args)
+    {
+        if (!args.empty())
+        {
+            std::transform(args[0].begin(), args[0].end(), args[0].begin(), ::toupper);
+        }
+    }
+};
+
+#endif /* _RESP_PROTOCOL_ */
@@ -0,0 +1,821 @@
+#ifndef _SHARDED_DATASTORE_
+#define _SHARDED_DATASTORE_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "DataStore.h"
+#include "Numa.h"
+#include "ParallelFor.h"
+#include "StripedCounter.h"
+
+/**
+ * @brief Options for how a ShardedDataStore spreads its keys and load
+ */
+struct ShardedDataStoreOptions
+{
+    /**
+     * The number of most read keys of every shard to replicate (0 turns replication off). With
+     * change_tracking, a replica is only used for change_check_interval_ms after it was copied
+     * (so a change made through another connection is seen as soon as without replication), and
+     * nothing is replicated if that interval is 0.
+     */
+    size_t hot_keys = 0;
+
+    /**
+     * Spread the shards over the NUMA nodes, and open, warm up and purge every shard on a thread
+     * bound to its node, so the shard's memory is allocated there. The share of operations that
+     * reach a shard from another node is counted in the stats.
+     */
+    bool numa_aware = false;
+};
+
+/**
+ * @brief A thread safe data store that splits its keys over several independent DataStore shards. \n
+ *
+ * Every shard has its own lock, LRU cache and database files, so operations on keys that live in
+ * different shards do not contend with each other. Shard i is stored in "<dataStoreName>.shard<i>".
+ * Shards start on cache lines of their own, and the stats are kept in per CPU striped counters,
+ * so threads working on different shards do not write to the same cache lines either. \n
+ *
+ * A single very hot key still pins its shard's lock, so the most read keys of every shard can be
+ * replicated: each thread keeps read-only copies of them in its own replica stripe and serves them
+ * from there without touching the shard. Every hot key has a version that writes to it bump, and a
+ * copy is only used while its version is current, so a put invalidates all copies at once. \n
+ *
+ * On a NUMA machine the shards can be placed on the nodes in turn. A key's shard is fixed, so
+ * operations on it still go to its node wherever they come from, but replicated hot keys are read
+ * from copies the reading thread allocated itself, on its own node.
+ *
+ */
+class ShardedDataStore
+{
+public:
+    /**
+     * @brief Construct a new Sharded Data Store object
+     *
+     * @param max_cache_size The maximum size of the LRU cache, split evenly over the shards
+     * @param shards The number of shards to split the keys over
+     * @param dataStoreName The base name to use for the sqlite databases (defaults to "DataStore.db")
+     * @param options Tuning options for the sqlite backing store of each shard (each shard gets 
+     * a flash tier file of its own, "<flash_tier_path>.shard<i>", of flash_tier_bytes)
+     * @param sharding Options for how the keys and load are spread over the shards
+     */
+    ShardedDataStore(size_t max_cache_size, size_t shards, std::string dataStoreName = "DataStore.db",
+                     const DataStoreOptions& options = DataStoreOptions(),
+                     const ShardedDataStoreOptions& sharding = ShardedDataStoreOptions()) :
+        m_hot_keys(sharding.hot_keys),
+        m_replica_lifetime(options.change_tracking ? std::chrono::steady_clock::duration(std::chrono::milliseconds(options.change_check_interval_ms))
+                                                   : std::chrono::steady_clock::duration::max()),
+        m_numa_aware(sharding.numa_aware),
+        m_numa_nodes(1)
+    {
+        if (shards == 0)
+        {
+            throw std::invalid_argument("A sharded data store needs at least one shard");
+        }
+
+        // Every read has to look for changes made through other connections, so none can be served from a replica
+        if (m_replica_lifetime == std::chrono::steady_clock::duration::zero())
+        {
+            m_hot_keys = 0;
+        }
+
+        size_t shardCacheSize = (max_cache_size + shards - 1) / shards;
+        m_numa_nodes = m_numa_aware ? numaNodeCount() : 1;
+        m_shards.resize(shards);
+        if (m_hot_keys > 0)
+        {
+            size_t stripes = std::max(1u, std::thread::hardware_concurrency());
+            for (size_t i = 0; i < stripes; ++i)
+            {
+                m_stripes.push_back(std::unique_ptr<ReplicaStripe>(new ReplicaStripe()));
+                m_stripes.back()->window_hits.resize(shards, 0);
+            }
+        }
+
+        // Opening a shard may create its database files, so do them all at once
+        std::vector<std::string> errors(shards);
+        forEachShard([&](size_t i) {
+            try
+            {
+                m_shards[i].reset(new Shard());
+                m_shards[i]->node = shardNode(i);
+                DataStoreOptions shardOptions = options;
+                if (!options.flash_tier_path.empty())
+                {
+                    shardOptions.flash_tier_path = options.flash_tier_path + ".shard" + std::to_string(i);
+                }
+                m_shards[i]->store.reset(new DataStore(shardCacheSize, dataStoreName + ".shard" + std::to_string(i), shardOptions));
+                if (m_hot_keys > 0 && options.change_tracking)
+                {
+                    // Called from inside the shard's store, so with the shard locked
+                    Shard* shard = m_shards[i].get();
+                    shard->store->setChangeCallback([this, shard](const std::string* key) {
+                        invalidateReplicas(*shard, key);
+                    });
+                }
+            }
+            catch (const std::exception& e)
+            {
+                errors[i] = e.what();
+            }
+        });
+        for (const std::string& error : errors)
+        {
+            if (!error.empty())
+            {
+                throw std::runtime_error(error);
+            }
+        }
+    }
+
+    /**
+     * @brief Destroy the Sharded Data Store object. The shards purge their caches to
+     * persistent storage in parallel.
+     */
+    ~ShardedDataStore()
+    {
+        forEachShard([this](size_t i) {
+            std::lock_guard<std::mutex> lock(m_shards[i]->mutex);
+            m_shards[i]->store.reset();
+        });
+    }
+
+    ShardedDataStore(const ShardedDataStore&) = delete;
+    ShardedDataStore& operator=(const ShardedDataStore&) = delete;
+
+    /**
+     * @brief Store a value into the data store
+     *
+     * @param key Key to reference item by
+     * @param value Value to store
+     */
+    void put(const std::string& key, const std::string& value)
+    {
+        m_writes.add();
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        countAccess(shard);
+        shard.store->put(key, value);
+        invalidateReplicas(shard, &key);
+    }
+
+    /**
+     * @brief Get a value from the data store
+     *
+     * @param key The key to retrieve
+     * @return std::string The stored value or empty string if the key does not exist
+     */
+    std::string get(const std::string& key)
+    {
+        m_reads.add();
+        std::string value;
+        if (m_hot_keys > 0 && readReplica(key, value))
+        {
+            m_replica_reads.add();
+            return value;
+        }
+
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        countAccess(shard);
+        value = shard.store->get(key);
+        if (m_hot_keys > 0)
+        {
+            trackRead(shard, key, value);
+        }
+        return value;
+    }
+
+    /**
+     * @brief Store several values into the data store at once. The pairs are grouped by shard
+     * so every shard is locked only once. If a key appears more than once, the last value wins.
+     *
+     * @param entries The key/value pairs to store
+     */
+    void putMany(const std::vector<DataStore::key_val_pair>& entries)
+    {
+        m_writes.add(entries.size());
+        std::vector<std::vector<size_t>> positions(m_shards.size());
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            positions[shardOf(entries[i].first)].push_back(i);
+        }
+
+        for (size_t s = 0; s < m_shards.size(); ++s)
+        {
+            if (positions[s].empty())
+            {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(m_shards[s]->mutex);
+            countAccess(*m_shards[s]);
+            for (size_t i : positions[s])
+            {
+                m_shards[s]->store->put(entries[i].first, entries[i].second);
+                invalidateReplicas(*m_shards[s], &entries[i].first);
+            }
+        }
+    }
+
+    /**
+     * @brief Remove a value from the data store
+     *
+     * @param key The key to remove
+     * @return true If the key existed
+     * @return false If the key did not exist
+     */
+    bool erase(const std::string& key)
+    {
+        m_writes.add();
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        countAccess(shard);
+        bool found = shard.store->erase(key);
+        invalidateReplicas(shard, &key);
+        return found;
+    }
+
+    /**
+     * @brief Get several values from the data store at once. The keys are grouped by shard
+     * so every shard is locked (and queries its database) only once.
+     *
+     * @param keys The keys to retrieve
+     * @return std::vector<std::string> The stored values, in the same order as the keys
+     * (empty strings for keys that do not exist)
+     */
+    std::vector<std::string> getMany(const std::vector<std::string>& keys)
+    {
+        m_reads.add(keys.size());
+        std::vector<std::vector<size_t>> positions(m_shards.size());
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            positions[shardOf(keys[i])].push_back(i);
+        }
+
+        std::vector<std::string> values(keys.size());
+        for (size_t s = 0; s < m_shards.size(); ++s)
+        {
+            if (positions[s].empty())
+            {
+                continue;
+            }
+
+            std::vector<std::string> shardKeys;
+            for (size_t i : positions[s])
+            {
+                shardKeys.push_back(keys[i]);
+            }
+
+            std::vector<std::string> shardValues;
+            {
+                std::lock_guard<std::mutex> lock(m_shards[s]->mutex);
+                countAccess(*m_shards[s]);
+                shardValues = m_shards[s]->store->getMany(shardKeys);
+            }
+            for (size_t j = 0; j < positions[s].size(); ++j)
+            {
+                values[positions[s][j]] = std::move(shardValues[j]);
+            }
+        }
+
+        return values;
+    }
+
+    /**
+     * @brief Checks to see if the provided value exists in the cache. \n
+     * Note: this does not check if it exists in the persistent storage
+     *
+     * @param key The key to check for
+     * @return true if the key is in the cache
+     * @return false if the key is not in the cache
+     */
+    bool isInCache(const std::string& key)
+    {
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        return shard.store->isInCache(key);
+    }
+
+    /**
+     * @brief Gets the current size of the cache, over all shards
+     *
+     * @return size_t The current size of the cache
+     */
+    size_t size()
+    {
+        size_t total = 0;
+        for (std::unique_ptr<Shard>& shard : m_shards)
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            total += shard->store->size();
+        }
+        return total;
+    }
+
+    /**
+     * @brief Fills the cache of every shard from its persistent store, warming the shards up in parallel
+     *
+     * @return size_t The number of values that were loaded
+     */
+    size_t warmUp()
+    {
+        std::vector<size_t> loaded(m_shards.size(), 0);
+        forEachShard([this, &loaded](size_t i) {
+            std::lock_guard<std::mutex> lock(m_shards[i]->mutex);
+            loaded[i] = m_shards[i]->store->warmUp();
+        });
+
+        size_t total = 0;
+        for (size_t count : loaded)
+        {
+            total += count;
+        }
+        return total;
+    }
+
+    /**
+     * @brief Takes a copy of every shard while the store keeps serving. Shard i is copied to 
+     * "<path>.shard<i>". \n
+     * With the wal option, all shards are locked only while each is flushed and pinned (see 
+     * DataStore::pinSnapshot), so the copy is one point in time across shards, and then copied 
+     * without holding any lock. \n
+     * Without it, each shard in turn is flushed and then copied a few pages at a time, and its 
+     * lock is released between every batch of pages so foreground operations on the shard are 
+     * only briefly delayed. Writes made during the copy may or may not end up in it.
+     *
+     * @param path The base name of the snapshot databases
+     * @param pages_per_step The number of pages to copy at a time
+     * @return true If the snapshot was successful
+     * @return false If the snapshot failed
+     */
+    bool snapshot(const std::string& path, int pages_per_step = 64)
+    {
+        if (m_shards.front()->store->walMode())
+        {
+            std::vector<std::unique_ptr<DataStore::PinnedSnapshot>> pinned(m_shards.size());
+            {
+                std::vector<std::unique_lock<std::mutex>> locks;
+                locks.reserve(m_shards.size());
+                for (auto& shard : m_shards)
+                {
+                    locks.emplace_back(shard->mutex);
+                }
+                for (size_t i = 0; i < m_shards.size(); ++i)
+                {
+                    pinned[i] = m_shards[i]->store->pinSnapshot();
+                    if (!pinned[i])
+                    {
+                        return false;
+                    }
+                }
+            }
+
+            for (size_t i = 0; i < pinned.size(); ++i)
+            {
+                if (!pinned[i]->copyTo(path + ".shard" + std::to_string(i), pages_per_step))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        for (size_t i = 0; i < m_shards.size(); ++i)
+        {
+            std::unique_lock<std::mutex> lock(m_shards[i]->mutex);
+            bool success = m_shards[i]->store->snapshot(path + ".shard" + std::to_string(i), pages_per_step, [&lock]() {
+                lock.unlock();
+                std::this_thread::yield();
+                lock.lock();
+            });
+            if (!success)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Writes the cache of every shard to snapshot files from a forked child process. \n
+     * All shards are locked only for the duration of the fork, so the snapshot is a consistent 
+     * point in time image across shards. Shard i is written to "<path>.shard<i>".
+     *
+     * @param path The base name of the snapshot files
+     * @return pid_t The process id of the child (to pass to DataStore::waitForBackgroundSave), 
+     * or -1 if the fork failed
+     */
+    pid_t backgroundSave(const std::string& path)
+    {
+        std::vector<std::unique_lock<std::mutex>> locks;
+        for (std::unique_ptr<Shard>& shard : m_shards)
+        {
+            locks.push_back(std::unique_lock<std::mutex>(shard->mutex));
+        }
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            // Only this thread exists in the child, and it already holds every shard lock
+            bool success = true;
+            for (size_t i = 0; i < m_shards.size(); ++i)
+            {
+                success = m_shards[i]->store->saveCache(path + ".shard" + std::to_string(i)) && success;
+            }
+            _exit(success ? 0 : 1);
+        }
+        return pid;
+    }
+
+    /**
+     * @brief Gets the number of shards
+     *
+     * @return size_t The number of shards
+     */
+    size_t shardCount() const
+    {
+        return m_shards.size();
+    }
+
+    /**
+     * @brief Counters describing how the store is being used
+     */
+    struct Stats
+    {
+        // Keys read (with get or getMany), and how many of them were served from hot key replicas
+        uint64_t reads = 0;
+        uint64_t replica_reads = 0;
+        // Keys written (with put, putMany or erase)
+        uint64_t writes = 0;
+        // Operations that reached a shard from a thread on the shard's own NUMA node, or another one
+        // (only counted for NUMA aware stores)
+        uint64_t local_accesses = 0;
+        uint64_t remote_accesses = 0;
+        // remote_accesses as a share of all counted accesses
+        double remote_access_ratio = 0;
+    };
+
+    /**
+     * @brief Gets the store's counters. Each is summed over the CPUs when it is read, and they are
+     * read one after the other, so under load they can be slightly out of step with each other.
+     *
+     * @return Stats The counters
+     */
+    Stats stats() const
+    {
+        Stats stats;
+        stats.reads = m_reads.value();
+        stats.replica_reads = m_replica_reads.value();
+        stats.writes = m_writes.value();
+        stats.local_accesses = m_local_accesses.value();
+        stats.remote_accesses = m_remote_accesses.value();
+        uint64_t accesses = stats.local_accesses + stats.remote_accesses;
+        if (accesses > 0)
+        {
+            stats.remote_access_ratio = static_cast<double>(stats.remote_accesses) / accesses;
+        }
+        return stats;
+    }
+
+    /**
+     * @brief Gets the NUMA node a shard was placed on
+     *
+     * @param shard The index of the shard
+     * @return int The node (always 0 unless the store is NUMA aware)
+     */
+    int shardNode(size_t shard) const
+    {
+        return static_cast<int>(shard % m_numa_nodes);
+    }
+
+    /**
+     * @brief Gets the number of keys that are currently replicated, over all shards
+     *
+     * @return size_t The number of hot keys
+     */
+    size_t hotKeyCount()
+    {
+        size_t total = 0;
+        for (std::unique_ptr<Shard>& shard : m_shards)
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            total += shard->hot.size();
+        }
+        return total;
+    }
+
+private:
+    // The number of reads a shard serves between picking its hot keys again
+    static const size_t HOT_KEY_WINDOW = 4096;
+    // The number of reads in a window that a key needs to be replicated
+    static const size_t HOT_KEY_MIN_READS = 32;
+    // The number of replica reads of a shard's keys a stripe collects before adding them to the shard's window
+    static const size_t REPLICA_WINDOW_BATCH = 256;
+
+    struct HotKey
+    {
+        // Bumped by every write to the key, which invalidates all of its replicas
+        std::atomic<uint64_t> version{0};
+    };
+
+    struct Replica
+    {
+        std::string value;
+        std::shared_ptr<HotKey> key;
+        uint64_t version;
+        uint64_t hits;
+        std::chrono::steady_clock::time_point copied;
+    };
+
+    struct alignas(CACHE_LINE_SIZE) ReplicaStripe
+    {
+        std::mutex mutex;
+        std::unordered_map<std::string, Replica> replicas;
+        // Replica reads per shard not yet added to the shard's window
+        std::vector<size_t> window_hits;
+    };
+
+    struct alignas(CACHE_LINE_SIZE) Shard
+    {
+        std::mutex mutex;
+        std::unique_ptr<DataStore> store;
+        // The replicated keys, and the reads of other keys in the current window
+        std::unordered_map<std::string, std::shared_ptr<HotKey>> hot;
+        std::unordered_map<std::string, uint64_t> reads;
+        size_t window_reads = 0;
+        int node = 0;
+    };
+
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    size_t m_hot_keys;
+    // How long a replica may be used after it was copied
+    std::chrono::steady_clock::duration m_replica_lifetime;
+    bool m_numa_aware;
+    int m_numa_nodes;
+    std::vector<std::unique_ptr<ReplicaStripe>> m_stripes;
+
+    StripedCounter m_reads;
+    StripedCounter m_replica_reads;
+    StripedCounter m_writes;
+    StripedCounter m_local_accesses;
+    StripedCounter m_remote_accesses;
+
+    /**
+     * @brief Runs a task for every shard in parallel. For a NUMA aware store every task runs on
+     * a thread bound to its shard's node, so the memory it allocates is local to the shard.
+     */
+    void forEachShard(const std::function<void(size_t)>& task)
+    {
+        parallelFor(m_shards.size(), [this, &task](size_t i) {
+            bool bound = m_numa_aware && bindToNumaNode(shardNode(i));
+            task(i);
+            if (bound)
+            {
+                unbindFromNumaNode();
+            }
+        });
+    }
+
+    /**
+     * @brief Counts an operation on a shard as local or remote to the calling thread's node
+     */
+    void countAccess(Shard& shard)
+    {
+        if (!m_numa_aware)
+        {
+            return;
+        }
+        if (currentNumaNode() == shard.node)
+        {
+            m_local_accesses.add();
+        }
+        else
+        {
+            m_remote_accesses.add();
+        }
+    }
+
+    /**
+     * @brief Gets the replica stripe of the calling thread. Threads are dealt out to the stripes
+     * in turn, so concurrent readers of a hot key use different locks.
+     */
+    ReplicaStripe& stripe()
+    {
+        static std::atomic<size_t> next_thread(0);
+        thread_local size_t thread_index = next_thread.fetch_add(1, std::memory_order_relaxed);
+        return *m_stripes[thread_index % m_stripes.size()];
+    }
+
+    /**
+     * @brief Reads a key from the calling thread's replicas. The reads are added to the window of
+     * the key's shard in batches, so the shard keeps picking its hot keys while they are served
+     * from the replicas.
+     *
+     * @return true If the key had a current replica, which was copied to value
+     */
+    bool readReplica(const std::string& key, std::string& value)
+    {
+        size_t shard = shardOf(key);
+        size_t window_hits = 0;
+        {
+            ReplicaStripe& replicas = stripe();
+            std::lock_guard<std::mutex> lock(replicas.mutex);
+            auto replicaItr = replicas.replicas.find(key);
+            if (replicaItr == replicas.replicas.end())
+            {
+                return false;
+            }
+            if (replicaItr->second.version != replicaItr->second.key->version.load(std::memory_order_acquire) ||
+                std::chrono::steady_clock::now() - replicaItr->second.copied > m_replica_lifetime)
+            {
+                replicas.replicas.erase(replicaItr);
+                return false;
+            }
+            ++replicaItr->second.hits;
+            value = replicaItr->second.value;
+            if (++replicas.window_hits[shard] >= REPLICA_WINDOW_BATCH)
+            {
+                window_hits = replicas.window_hits[shard];
+                replicas.window_hits[shard] = 0;
+            }
+        }
+
+        // The shard is locked before its replica stripes, so not while holding this one
+        if (window_hits > 0)
+        {
+            std::lock_guard<std::mutex> lock(m_shards[shard]->mutex);
+            m_shards[shard]->window_reads += window_hits;
+            if (m_shards[shard]->window_reads >= HOT_KEY_WINDOW)
+            {
+                pickHotKeys(*m_shards[shard]);
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Counts a read that went to a shard, and replicates the value if the key is hot.
+     * Must be called with the shard locked.
+     */
+    void trackRead(Shard& shard, const std::string& key, const std::string& value)
+    {
+        auto hotItr = shard.hot.find(key);
+        if (hotItr == shard.hot.end())
+        {
+            ++shard.reads[key];
+        }
+        else if (!value.empty())
+        {
+            // Writers bump the version under the shard lock, which is held here, so the copy is current
+            ReplicaStripe& replicas = stripe();
+            std::lock_guard<std::mutex> lock(replicas.mutex);
+            Replica& replica = replicas.replicas[key];
+            replica.value = value;
+            replica.key = hotItr->second;
+            replica.version = hotItr->second->version.load(std::memory_order_relaxed);
+            replica.hits = 1;
+            replica.copied = std::chrono::steady_clock::now();
+        }
+
+        if (++shard.window_reads >= HOT_KEY_WINDOW)
+        {
+            pickHotKeys(shard);
+        }
+    }
+
+    /**
+     * @brief Replaces a shard's hot keys with the most read keys of the window that just ended.
+     * Must be called with the shard locked.
+     */
+    void pickHotKeys(Shard& shard)
+    {
+        std::unordered_map<std::string, uint64_t> reads;
+        reads.swap(shard.reads);
+        shard.window_reads = 0;
+
+        // Reads of the current hot keys are mostly served by the replicas, so count those too
+        for (std::unique_ptr<ReplicaStripe>& replicas : m_stripes)
+        {
+            std::lock_guard<std::mutex> lock(replicas->mutex);
+            for (auto replicaItr = replicas->replicas.begin(); replicaItr != replicas->replicas.end();)
+            {
+                if (replicaItr->second.version != replicaItr->second.key->version.load(std::memory_order_relaxed))
+                {
+                    replicaItr = replicas->replicas.erase(replicaItr);
+                    continue;
+                }
+                auto hotItr = shard.hot.find(replicaItr->first);
+                if (hotItr != shard.hot.end() && hotItr->second == replicaItr->second.key)
+                {
+                    reads[replicaItr->first] += replicaItr->second.hits;
+                    replicaItr->second.hits = 0;
+                }
+                ++replicaItr;
+            }
+        }
+
+        std::vector<std::pair<uint64_t, std::string>> candidates;
+        for (auto& read : reads)
+        {
+            if (read.second >= HOT_KEY_MIN_READS)
+            {
+                candidates.push_back(std::make_pair(read.second, read.first));
+            }
+        }
+        size_t count = std::min(m_hot_keys, candidates.size());
+        std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+                          [](const std::pair<uint64_t, std::string>& a, const std::pair<uint64_t, std::string>& b) {
+                              return a.first > b.first;
+                          });
+
+        std::unordered_map<std::string, std::shared_ptr<HotKey>> hot;
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto hotItr = shard.hot.find(candidates[i].second);
+            if (hotItr != shard.hot.end())
+            {
+                hot.insert(*hotItr);
+                shard.hot.erase(hotItr);
+            }
+            else
+            {
+                hot[candidates[i].second] = std::make_shared<HotKey>();
+            }
+        }
+        // Whatever is left has cooled down, so drop its replicas
+        for (auto& cooled : shard.hot)
+        {
+            cooled.second->version.fetch_add(1, std::memory_order_release);
+        }
+        shard.hot.swap(hot);
+
+        // Reads served by the replicas never reach the shard's LRU cache, so the hottest keys 
+        // would age out of it; mark them used once a window instead
+        for (auto& current : shard.hot)
+        {
+            shard.store->touch(current.first);
+        }
+    }
+
+    /**
+     * @brief Invalidates the replicas of a key after a write. Must be called with the shard locked.
+     *
+     * @param shard The shard of the key
+     * @param key The key, or nullptr to invalidate the replicas of all of the shard's keys
+     */
+    void invalidateReplicas(Shard& shard, const std::string* key)
+    {
+        if (m_hot_keys == 0)
+        {
+            return;
+        }
+        if (!key)
+        {
+            for (auto& hot : shard.hot)
+            {
+                hot.second->version.fetch_add(1, std::memory_order_release);
+            }
+            return;
+        }
+        auto hotItr = shard.hot.find(*key);
+        if (hotItr != shard.hot.end())
+        {
+            hotItr->second->version.fetch_add(1, std::memory_order_release);
+        }
+    }
+
+    /**
+     * @brief Gets the shard that a key belongs to. \n
+     * The shard's own DataStore picks the partition from the key hash modulo the partition
+     * count, so the shard comes from the mixed hash instead, which is independent of that.
+     *
+     * @param key The key to look up
+     * @return size_t The index of the shard
+     */
+    size_t shardOf(const std::string& key) const
+    {
+        return static_cast<size_t>(mixHash(DataStore::hashKey(key)) % m_shards.size());
+    }
+
+    /**
+     * @brief Gets the shard that a key belongs to
+     *
+     * @param key The key to look up
+     * @return Shard& The shard
+     */
+    Shard& shardFor(const std::string& key)
+    {
+        return *m_shards[shardOf(key)];
+    }
+};
+
+#endif /* _SHARDED_DATASTORE_ */
@@ -0,0 +1,503 @@
+#ifndef _SHARED_CACHE_SEGMENT_
+#define _SHARED_CACHE_SEGMENT_
+
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "KeyHash.h"
+
+/**
+ * @brief A cache that lives in a named POSIX shared memory segment, so every process on the host
+ * that opens the same name shares one copy of the hot values. \n
+ *
+ * The segment holds a header followed by a fixed number of fixed size slots, each holding one key
+ * and value inline. Nothing in the segment is a pointer, so it works wherever each process happens
+ * to map it. The slots are split into groups of PROBE_WINDOW, and a key lives in the group its
+ * hash picks (any slots past the last whole group go unused); when a group is full, one of its
+ * slots is evicted with the CLOCK algorithm. Entries that do not fit in a slot are not cached. \n
+ *
+ * The groups are spread over LOCK_STRIPES process shared, robust mutexes (with a clock hand each),
+ * so processes only contend when they use keys of the same stripe. If a process dies while
+ * holding a stripe's lock, the next process to take it clears the slots of that stripe, since the
+ * dead process may have left one half written. \n
+ *
+ * The process that creates the segment writes its pid into the header before initializing it.
+ * A process that finds the segment uninitialized, and its creator gone (or still not done after
+ * init_timeout_ms), removes the segment and creates it again. Processes sharing a segment must
+ * therefore see each other's pids (i.e. be in the same pid namespace).
+ *
+ */
+class SharedCacheSegment
+{
+public:
+    static constexpr size_t PROBE_WINDOW = 16;
+    static constexpr size_t LOCK_STRIPES = 64;
+
+    /**
+     * @brief Open (or create) a shared cache segment
+     *
+     * @param name The name of the segment (a POSIX shared memory name, e.g. "/datastore")
+     * @param slot_count The number of slots (ignored if the segment already exists)
+     * @param slot_size The number of bytes for the key and value of each slot (ignored if the
+     * segment already exists)
+     * @param init_timeout_ms How long to wait for the process that created the segment to
+     * initialize it, before taking it to have died half way and creating the segment again
+     */
+    SharedCacheSegment(const std::string& name, size_t slot_count, size_t slot_size, int init_timeout_ms = 5000)
+    {
+        if (slot_count == 0 || slot_size == 0)
+        {
+            throw std::invalid_argument("A shared cache segment needs at least one slot of at least one byte");
+        }
+
+        // Only a process that keeps recreating the segment as well could make this go round
+        // more than once or twice
+        for (int attempt = 0; !attach(name, slot_count, slot_size, init_timeout_ms); ++attempt)
+        {
+            if (attempt == MAX_ATTACH_ATTEMPTS)
+            {
+                throw std::runtime_error("Timed out waiting for shared memory segment to be initialized: " + name);
+            }
+        }
+    }
+
+    /**
+     * @brief Unmaps the segment. The segment itself stays around for other processes (see remove).
+     */
+    ~SharedCacheSegment()
+    {
+        munmap(m_base, m_size);
+    }
+
+    SharedCacheSegment(const SharedCacheSegment&) = delete;
+    SharedCacheSegment& operator=(const SharedCacheSegment&) = delete;
+
+    /**
+     * @brief Removes a shared cache segment. Processes that have it open keep using their mapping.
+     *
+     * @param name The name of the segment
+     * @return true If the segment was removed
+     * @return false If there was no such segment
+     */
+    static bool remove(const std::string& name)
+    {
+        return shm_unlink(name.c_str()) == 0;
+    }
+
+    /**
+     * @brief Gets a value from the segment
+     *
+     * @param key The key of the value
+     * @param value The value
+     * @return true If the value was in the segment
+     * @return false If the value was not in the segment
+     */
+    bool get(const std::string& key, std::string& value)
+    {
+        uint64_t hash = fnv1aHash(key);
+        Lock lock(*this, stripeOf(groupOf(hash)));
+        Slot* slot = find(key, hash);
+        if (!slot)
+        {
+            return false;
+        }
+        slot->referenced = 1;
+        value.assign(slot->data + slot->key_size, slot->value_size);
+        return true;
+    }
+
+    /**
+     * @brief Stores a value in the segment, replacing any older copy
+     *
+     * @param key The key of the value
+     * @param value The value
+     * @return true If the value was stored
+     * @return false If the key and value do not fit in a slot (any older copy is removed)
+     */
+    bool put(const std::string& key, const std::string& value)
+    {
+        uint64_t hash = fnv1aHash(key);
+        Lock lock(*this, stripeOf(groupOf(hash)));
+        Slot* slot = find(key, hash);
+        if (key.size() + value.size() > m_header->slot_size)
+        {
+            if (slot)
+            {
+                slot->used = 0;
+            }
+            return false;
+        }
+        if (!slot)
+        {
+            slot = claim(hash);
+        }
+
+        slot->used = 0;
+        slot->hash = hash;
+        slot->key_size = static_cast<uint32_t>(key.size());
+        slot->value_size = static_cast<uint32_t>(value.size());
+        std::memcpy(slot->data, key.data(), key.size());
+        std::memcpy(slot->data + key.size(), value.data(), value.size());
+        slot->referenced = 1;
+        slot->used = 1;
+        return true;
+    }
+
+    /**
+     * @brief Removes a value from the segment
+     *
+     * @param key The key of the value
+     * @return true If the value was in the segment
+     * @return false If the value was not in the segment
+     */
+    bool erase(const std::string& key)
+    {
+        uint64_t hash = fnv1aHash(key);
+        Lock lock(*this, stripeOf(groupOf(hash)));
+        Slot* slot = find(key, hash);
+        if (!slot)
+        {
+            return false;
+        }
+        slot->used = 0;
+        return true;
+    }
+
+    /**
+     * @brief Removes every value from the segment (for every process)
+     */
+    void clear()
+    {
+        for (uint64_t stripe = 0; stripe < LOCK_STRIPES; ++stripe)
+        {
+            Lock lock(*this, stripe);
+            clearStripe(stripe);
+        }
+    }
+
+    /**
+     * @brief Counts the values in the segment
+     *
+     * @return size_t The number of values
+     */
+    size_t size()
+    {
+        size_t count = 0;
+        for (uint64_t stripe = 0; stripe < LOCK_STRIPES; ++stripe)
+        {
+            Lock lock(*this, stripe);
+            for (uint64_t group = stripe; group < groupCount(); group += LOCK_STRIPES)
+            {
+                for (uint64_t i = 0; i < window(); ++i)
+                {
+                    count += slotAt(group * window() + i)->used ? 1 : 0;
+                }
+            }
+        }
+        return count;
+    }
+
+private:
+    static constexpr uint64_t MAGIC = 0x4453534547303032ULL; // "DSSEG002"
+    static const int MAX_ATTACH_ATTEMPTS = 3;
+
+    // Each on its own cache line, so processes using different stripes do not slow each other down
+    struct alignas(64) Stripe
+    {
+        pthread_mutex_t mutex;
+        uint64_t clock_hand;
+    };
+
+    struct Header
+    {
+        uint64_t magic;
+        uint64_t slot_count;
+        uint64_t slot_size;
+        std::atomic<int32_t> creator_pid;
+        std::atomic<uint32_t> ready;
+        Stripe stripes[LOCK_STRIPES];
+    };
+
+    struct Slot
+    {
+        uint64_t hash;
+        uint32_t key_size;
+        uint32_t value_size;
+        uint8_t used;
+        uint8_t referenced;
+        char data[1];
+    };
+
+    /**
+     * @brief Holds the lock of one stripe, recovering it from a process that died holding it
+     */
+    class Lock
+    {
+    public:
+        Lock(SharedCacheSegment& segment, uint64_t stripe) :
+            m_segment(segment),
+            m_mutex(&segment.m_header->stripes[stripe].mutex)
+        {
+            if (pthread_mutex_lock(m_mutex) == EOWNERDEAD)
+            {
+                m_segment.clearStripe(stripe);
+                pthread_mutex_consistent(m_mutex);
+            }
+        }
+
+        ~Lock()
+        {
+            pthread_mutex_unlock(m_mutex);
+        }
+
+    private:
+        SharedCacheSegment& m_segment;
+        pthread_mutex_t* m_mutex;
+    };
+
+    char* m_base;
+    size_t m_size;
+    Header* m_header;
+
+    /**
+     * @brief Opens the segment, creating and initializing it if it does not exist
+     *
+     * @return true If the segment is ready to use
+     * @return false If the segment was left uninitialized by its creator and has been removed,
+     * so it has to be created again
+     */
+    bool attach(const std::string& name, size_t slot_count, size_t slot_size, int init_timeout_ms)
+    {
+        // Whoever creates the segment initializes it, everyone else waits for that to finish
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(init_timeout_ms);
+        bool creator = true;
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0 && errno == EEXIST)
+        {
+            creator = false;
+            fd = shm_open(name.c_str(), O_RDWR, 0600);
+            if (fd < 0 && errno == ENOENT)
+            {
+                // Removed in the meantime
+                return false;
+            }
+        }
+        if (fd < 0)
+        {
+            throw std::runtime_error("Failed to open shared memory segment: " + name);
+        }
+
+        struct stat info;
+        std::memset(&info, 0, sizeof(info));
+        if (creator)
+        {
+            m_size = sizeof(Header) + slot_count * slotStride(slot_size);
+            if (ftruncate(fd, static_cast<off_t>(m_size)) != 0)
+            {
+                close(fd);
+                shm_unlink(name.c_str());
+                throw std::runtime_error("Failed to size shared memory segment: " + name);
+            }
+        }
+        else
+        {
+            // The creator sizes the segment right after creating it, so it can only stay empty 
+            // if the creator died
+            do
+            {
+                if (fstat(fd, &info) != 0)
+                {
+                    close(fd);
+                    throw std::runtime_error("Failed to open shared memory segment: " + name);
+                }
+                if (info.st_size == 0 && std::chrono::steady_clock::now() > deadline)
+                {
+                    close(fd);
+                    removeStale(name, info);
+                    return false;
+                }
+                std::this_thread::yield();
+            } while (info.st_size == 0);
+            m_size = static_cast<size_t>(info.st_size);
+        }
+
+        void* mapping = mmap(NULL, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            throw std::runtime_error("Failed to map shared memory segment: " + name);
+        }
+        m_base = static_cast<char*>(mapping);
+        m_header = reinterpret_cast<Header*>(m_base);
+
+        if (creator)
+        {
+            m_header->creator_pid.store(static_cast<int32_t>(getpid()), std::memory_order_release);
+            m_header->magic = MAGIC;
+            m_header->slot_count = slot_count;
+            m_header->slot_size = slot_size;
+
+            pthread_mutexattr_t attr;
+            pthread_mutexattr_init(&attr);
+            pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+            pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+            for (Stripe& stripe : m_header->stripes)
+            {
+                pthread_mutex_init(&stripe.mutex, &attr);
+                stripe.clock_hand = 0;
+            }
+            pthread_mutexattr_destroy(&attr);
+
+            m_header->ready.store(1, std::memory_order_release);
+        }
+        else
+        {
+            while (m_header->ready.load(std::memory_order_acquire) == 0)
+            {
+                // The pid is 0 until the creator gets to write it, and then there is nothing 
+                // to go on but the deadline
+                pid_t pid = static_cast<pid_t>(m_header->creator_pid.load(std::memory_order_acquire));
+                bool dead = pid > 0 && kill(pid, 0) != 0 && errno == ESRCH;
+                if (dead || std::chrono::steady_clock::now() > deadline)
+                {
+                    munmap(m_base, m_size);
+                    removeStale(name, info);
+                    return false;
+                }
+                std::this_thread::yield();
+            }
+            if (m_header->magic != MAGIC || sizeof(Header) + m_header->slot_count * slotStride(m_header->slot_size) > m_size)
+            {
+                munmap(m_base, m_size);
+                throw std::runtime_error("Not a shared cache segment: " + name);
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Removes a segment that was never initialized, unless the name has already been 
+     * given to a new segment (by another process that found it stale as well)
+     *
+     * @param name The name of the segment
+     * @param info The stat of the stale segment
+     */
+    static void removeStale(const std::string& name, const struct stat& info)
+    {
+        int fd = shm_open(name.c_str(), O_RDONLY, 0600);
+        if (fd < 0)
+        {
+            return;
+        }
+        struct stat current;
+        if (fstat(fd, &current) == 0 && current.st_dev == info.st_dev && current.st_ino == info.st_ino)
+        {
+            shm_unlink(name.c_str());
+        }
+        close(fd);
+    }
+
+    static size_t slotStride(size_t slot_size)
+    {
+        // Keep every slot 8 byte aligned
+        return (offsetof(Slot, data) + slot_size + 7) & ~static_cast<size_t>(7);
+    }
+
+    Slot* slotAt(uint64_t index)
+    {
+        return reinterpret_cast<Slot*>(m_base + sizeof(Header) + index * slotStride(m_header->slot_size));
+    }
+
+    uint64_t window() const
+    {
+        return std::min<uint64_t>(PROBE_WINDOW, m_header->slot_count);
+    }
+
+    uint64_t groupCount() const
+    {
+        return m_header->slot_count / window();
+    }
+
+    uint64_t groupOf(uint64_t hash) const
+    {
+        return hash % groupCount();
+    }
+
+    static uint64_t stripeOf(uint64_t group)
+    {
+        return group % LOCK_STRIPES;
+    }
+
+    Slot* find(const std::string& key, uint64_t hash)
+    {
+        uint64_t first = groupOf(hash) * window();
+        for (uint64_t i = 0; i < window(); ++i)
+        {
+            Slot* slot = slotAt(first + i);
+            if (slot->used && slot->hash == hash && slot->key_size == key.size() &&
+                std::memcmp(slot->data, key.data(), key.size()) == 0)
+            {
+                return slot;
+            }
+        }
+        return nullptr;
+    }
+
+    Slot* claim(uint64_t hash)
+    {
+        uint64_t group = groupOf(hash);
+        uint64_t first = group * window();
+        for (uint64_t i = 0; i < window(); ++i)
+        {
+            Slot* slot = slotAt(first + i);
+            if (!slot->used)
+            {
+                return slot;
+            }
+        }
+
+        // CLOCK over the group: give recently used slots a second chance
+        uint64_t& clock_hand = m_header->stripes[stripeOf(group)].clock_hand;
+        for (uint64_t i = 0; i < 2 * window(); ++i)
+        {
+            Slot* slot = slotAt(first + (clock_hand++) % window());
+            if (!slot->referenced)
+            {
+                return slot;
+            }
+            slot->referenced = 0;
+        }
+        return slotAt(first);
+    }
+
+    /**
+     * @brief Clears the slots of every group in a stripe (with the stripe's lock held)
+     */
+    void clearStripe(uint64_t stripe)
+    {
+        for (uint64_t group = stripe; group < groupCount(); group += LOCK_STRIPES)
+        {
+            for (uint64_t i = 0; i < window(); ++i)
+            {
+                slotAt(group * window() + i)->used = 0;
+            }
+        }
+    }
+};
+
+#endif /* _SHARED_CACHE_SEGMENT_ */
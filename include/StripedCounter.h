@@ -0,0 +1,93 @@
+#ifndef _STRIPED_COUNTER_
+#define _STRIPED_COUNTER_
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <thread>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include <sched.h>
+
+/**
+ * @brief The distance apart that two objects written by different cores have to be so they do
+ * not share a cache line
+ */
+#ifdef __cpp_lib_hardware_interference_size
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+// GCC warns that the value can change with -mtune, which only matters across binaries
+#pragma GCC diagnostic ignored "-Winterference-size"
+#endif
+constexpr size_t CACHE_LINE_SIZE = std::hardware_destructive_interference_size;
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#else
+constexpr size_t CACHE_LINE_SIZE = 64;
+#endif
+
+/**
+ * @brief A counter that many threads can add to without contending. \n
+ *
+ * Every CPU adds to its own slot, each on a cache line of its own, so increments never bounce a
+ * line between cores. Reading the counter sums the slots, which makes reads slower than adds.
+ *
+ */
+class StripedCounter
+{
+public:
+    /**
+     * @brief Construct a new Striped Counter object
+     *
+     * @param stripes The number of slots (0 for one per hardware thread)
+     */
+    StripedCounter(size_t stripes = 0) :
+        m_stripe_count(stripes > 0 ? stripes : std::max(1u, std::thread::hardware_concurrency())),
+        m_stripes(new Stripe[m_stripe_count])
+    {
+    }
+
+    StripedCounter(const StripedCounter&) = delete;
+    StripedCounter& operator=(const StripedCounter&) = delete;
+
+    /**
+     * @brief Adds to the counter
+     *
+     * @param count The amount to add
+     */
+    void add(uint64_t count = 1)
+    {
+        int cpu = sched_getcpu();
+        size_t stripe = cpu < 0 ? 0 : static_cast<size_t>(cpu) % m_stripe_count;
+        m_stripes[stripe].value.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Gets the value of the counter, summed over all slots
+     *
+     * @return uint64_t The value
+     */
+    uint64_t value() const
+    {
+        uint64_t total = 0;
+        for (size_t i = 0; i < m_stripe_count; ++i)
+        {
+            total += m_stripes[i].value.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Stripe
+    {
+        std::atomic<uint64_t> value{0};
+    };
+
+    size_t m_stripe_count;
+    std::unique_ptr<Stripe[]> m_stripes;
+};
+
+#endif /* _STRIPED_COUNTER_ */
@@ -0,0 +1,237 @@
+#ifndef _VALUE_CODEC_
+#define _VALUE_CODEC_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+
+#include <zlib.h>
+
+/**
+ * @brief Compresses values with deflate (zlib), optionally primed with a trained dictionary. \n
+ *
+ * An encoded value is a format byte, the id of the dictionary it was compressed with (uint32,
+ * 0 for none), the size of the original value (uint32) and the raw deflate stream. Values smaller
+ * than the minimum size, or that do not get smaller, are left alone so small values never pay for
+ * compression. Encoding and decoding only read the codec's state, so they can be called from
+ * several threads at once; adding dictionaries can not.
+ *
+ */
+class ValueCodec
+{
+public:
+    static const uint8_t FORMAT_DEFLATE = 1;
+    static const size_t HEADER_SIZE = 9;
+
+    /**
+     * @brief Construct a new Value Codec object
+     *
+     * @param min_size Values smaller than this are never compressed
+     * @param level The zlib compression level (1 is fastest, 9 is smallest)
+     */
+    ValueCodec(size_t min_size = 64, int level = 1) :
+        m_min_size(min_size),
+        m_level(level),
+        m_active_dictionary(0)
+    {
+    }
+
+    /**
+     * @brief Compresses a value, if it is worth it
+     *
+     * @param value The value to compress
+     * @param encoded The compressed value
+     * @return true If the value was compressed
+     * @return false If the value should be stored as it is
+     */
+    bool encode(const std::string& value, std::string& encoded) const
+    {
+        if (value.size() < m_min_size || value.size() > UINT32_MAX)
+        {
+            return false;
+        }
+
+        z_stream stream = z_stream();
+        if (deflateInit2(&stream, m_level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            return false;
+        }
+        const std::string* dictionary = activeDictionary();
+        if (dictionary)
+        {
+            deflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(dictionary->data()), static_cast<uInt>(dictionary->size()));
+        }
+
+        encoded.resize(HEADER_SIZE + deflateBound(&stream, static_cast<uLong>(value.size())));
+        encoded[0] = static_cast<char>(FORMAT_DEFLATE);
+        writeU32(&encoded[1], dictionary ? m_active_dictionary : 0);
+        writeU32(&encoded[5], static_cast<uint32_t>(value.size()));
+
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(value.data()));
+        stream.avail_in = static_cast<uInt>(value.size());
+        stream.next_out = reinterpret_cast<Bytef*>(&encoded[HEADER_SIZE]);
+        stream.avail_out = static_cast<uInt>(encoded.size() - HEADER_SIZE);
+        int status = deflate(&stream, Z_FINISH);
+        size_t compressedSize = stream.total_out;
+        deflateEnd(&stream);
+
+        if (status != Z_STREAM_END || HEADER_SIZE + compressedSize >= value.size())
+        {
+            return false;
+        }
+        encoded.resize(HEADER_SIZE + compressedSize);
+        return true;
+    }
+
+    /**
+     * @brief Decompresses a value produced by encode
+     *
+     * @param data The compressed value
+     * @param size The size of the compressed value
+     * @param value The original value
+     * @return true If the value was decompressed
+     * @return false If the value is corrupt or needs a dictionary the codec does not have
+     */
+    bool decode(const char* data, size_t size, std::string& value) const
+    {
+        if (size < HEADER_SIZE || static_cast<uint8_t>(data[0]) != FORMAT_DEFLATE)
+        {
+            return false;
+        }
+        uint32_t dictionaryId = readU32(data + 1);
+        uint32_t rawSize = readU32(data + 5);
+
+        z_stream stream = z_stream();
+        if (inflateInit2(&stream, -15) != Z_OK)
+        {
+            return false;
+        }
+        if (dictionaryId != 0)
+        {
+            auto dictItr = m_dictionaries.find(dictionaryId);
+            if (dictItr == m_dictionaries.end())
+            {
+                inflateEnd(&stream);
+                return false;
+            }
+            inflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(dictItr->second.data()), static_cast<uInt>(dictItr->second.size()));
+        }
+
+        value.resize(rawSize);
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data + HEADER_SIZE));
+        stream.avail_in = static_cast<uInt>(size - HEADER_SIZE);
+        stream.next_out = reinterpret_cast<Bytef*>(&value[0]);
+        stream.avail_out = rawSize;
+        int status = inflate(&stream, Z_FINISH);
+        bool success = status == Z_STREAM_END && stream.total_out == rawSize;
+        inflateEnd(&stream);
+        return success;
+    }
+
+    /**
+     * @brief Makes a dictionary available for decoding, and optionally for encoding new values
+     *
+     * @param dictionary The dictionary
+     * @param active Whether new values should be compressed with it
+     * @return uint32_t The id of the dictionary (its Adler-32, never 0)
+     */
+    uint32_t addDictionary(const std::string& dictionary, bool active)
+    {
+        uint32_t id = dictionaryId(dictionary);
+        m_dictionaries[id] = dictionary;
+        if (active)
+        {
+            m_active_dictionary = id;
+        }
+        return id;
+    }
+
+    /**
+     * @brief Gets the id of a dictionary
+     *
+     * @param dictionary The dictionary
+     * @return uint32_t The id of the dictionary (its Adler-32, never 0)
+     */
+    static uint32_t dictionaryId(const std::string& dictionary)
+    {
+        uint32_t id = static_cast<uint32_t>(adler32(adler32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(dictionary.data()),
+                                                    static_cast<uInt>(dictionary.size())));
+        return id == 0 ? 1 : id;
+    }
+
+    /**
+     * @brief Builds a deflate dictionary from sample values. \n
+     * Counts how often every 8 byte sequence appears across the samples and keeps the most
+     * frequent ones, placing the most frequent last (where deflate can reach them most cheaply).
+     *
+     * @param samples Sample values, ideally a few hundred representative ones
+     * @param max_size The maximum size of the dictionary (deflate only uses the last 32 KiB)
+     * @return std::string The dictionary
+     */
+    static std::string trainDictionary(const std::vector<std::string>& samples, size_t max_size = 16 * 1024)
+    {
+        const size_t gramSize = 8;
+        const size_t maxSampleBytes = 1 << 20;
+
+        std::unordered_map<std::string, size_t> counts;
+        size_t sampled = 0;
+        for (const std::string& sample : samples)
+        {
+            for (size_t i = 0; i + gramSize <= sample.size() && sampled < maxSampleBytes; ++i, ++sampled)
+            {
+                ++counts[sample.substr(i, gramSize)];
+            }
+        }
+
+        // Only sequences that repeat are worth having in the dictionary
+        std::vector<std::pair<size_t, std::string>> ranked;
+        for (auto& count : counts)
+        {
+            if (count.second > 1)
+            {
+                ranked.push_back(std::make_pair(count.second, count.first));
+            }
+        }
+        std::sort(ranked.begin(), ranked.end());
+
+        std::string dictionary;
+        size_t used = std::min(ranked.size(), max_size / gramSize);
+        for (size_t i = ranked.size() - used; i < ranked.size(); ++i)
+        {
+            dictionary += ranked[i].second;
+        }
+        return dictionary;
+    }
+
+private:
+    size_t m_min_size;
+    int m_level;
+    uint32_t m_active_dictionary;
+    std::map<uint32_t, std::string> m_dictionaries;
+
+    const std::string* activeDictionary() const
+    {
+        auto dictItr = m_dictionaries.find(m_active_dictionary);
+        return dictItr == m_dictionaries.end() ? nullptr : &dictItr->second;
+    }
+
+    static void writeU32(char* out, uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            out[i] = static_cast<char>(value >> (8 * i));
+        }
+    }
+
+    static uint32_t readU32(const char* in)
+    {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(in);
+        return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) |
+               (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+    }
+};
+
+#endif /* _VALUE_CODEC_ */
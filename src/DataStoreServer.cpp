@@ -0,0 +1,119 @@
+#include <iostream>
+#include <string>
+#include <memory>
+#include <cstdlib>
+#include <csignal>
+
+#include <pthread.h>
+
+#include "ShardedDataStore.h"
+#include "EventLoopServer.h"
+#include "MemcachedProtocol.h"
+#include "RespProtocol.h"
+
+namespace
+{
+    void usage(const char* program)
+    {
+        std::cerr << "Usage: " << program << " [options]\n"
+                  << "  --protocol <memcached|resp>     Protocol to serve (default memcached)\n"
+                  << "  --listen <host:port|unix:path>  Address to listen on (default 127.0.0.1:11211,\n"
+                  << "                                  or 127.0.0.1:6379 for resp)\n"
+                  << "  --db <name>                     Base name of the database files (default DataStore.db)\n"
+                  << "  --cache <entries>               Size of the LRU cache over all shards (default 100000)\n"
+                  << "  --shards <count>                Number of shards (default 16)\n"
+                  << "  --threads <count>               Number of event loops (default one per core)\n";
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string protocol = "memcached";
+    std::string listen;
+    std::string db = "DataStore.db";
+    size_t cache = 100000;
+    size_t shards = 16;
+    size_t threads = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--protocol")
+        {
+            protocol = value;
+        }
+        else if (arg == "--listen")
+        {
+            listen = value;
+        }
+        else if (arg == "--db")
+        {
+            db = value;
+        }
+        else if (arg == "--cache")
+        {
+            cache = std::strtoull(value.c_str(), NULL, 10);
+        }
+        else if (arg == "--shards")
+        {
+            shards = std::strtoull(value.c_str(), NULL, 10);
+        }
+        else if (arg == "--threads")
+        {
+            threads = std::strtoull(value.c_str(), NULL, 10);
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (protocol != "memcached" && protocol != "resp")
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (listen.empty())
+    {
+        listen = protocol == "resp" ? "127.0.0.1:6379" : "127.0.0.1:11211";
+    }
+
+    // Block the shutdown signals before any threads start, so they are only ever seen by sigwait below
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    try
+    {
+        ShardedDataStore store(cache, shards, db);
+        KeyExpiry expiry;
+        EventLoopServer server(listen, [&store, &expiry, &protocol]() {
+            if (protocol == "resp")
+            {
+                return std::unique_ptr<ProtocolHandler>(new RespProtocol(store, expiry));
+            }
+            return std::unique_ptr<ProtocolHandler>(new MemcachedProtocol(store));
+        }, threads);
+        std::cerr << "Serving " << db << " over " << protocol << " on " << listen << std::endl;
+
+        int signal = 0;
+        sigwait(&signals, &signal);
+        std::cerr << "Shutting down" << std::endl;
+        server.stop();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
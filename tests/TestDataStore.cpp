@@ -1,4 +1,9 @@
 #include <string>
+#include <vector>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <atomic>
 #include <gtest/gtest.h>
 
 #include "DataStore.h"
@@ -54,3 +59,1070 @@ TEST(TestDataStore, TestMaxCacheSize)
 
     EXPECT_EQ(ds.isInCache("2"), false);
 }
+
+TEST(TestDataStore, TestGetMany)
+{
+    std::remove("GetManyTest.db");
+    DataStore ds = DataStore(2, "GetManyTest.db");
+
+    ds.put("1", "one");
+    ds.put("2", "two");
+    ds.put("3", "three"); // Pushes "1" out to the database
+    ds.put("4", "four");  // Pushes "2" out to the database
+
+    std::vector<std::string> values = ds.getMany({"1", "4", "missing", "2", "1"});
+    ASSERT_EQ(values.size(), 5);
+    EXPECT_EQ(values[0], "one");
+    EXPECT_EQ(values[1], "four");
+    EXPECT_EQ(values[2], "");
+    EXPECT_EQ(values[3], "two");
+    EXPECT_EQ(values[4], "one");
+
+    EXPECT_EQ(ds.size(), 2);
+}
+
+TEST(TestDataStore, TestStorageOptions)
+{
+    std::remove("OptionsTest.db");
+
+    DataStoreOptions options;
+    options.page_size = 8192;
+    options.page_cache_kb = 4096;
+    options.mmap_size = 1 << 20;
+
+    {
+        DataStore ds = DataStore(1, "OptionsTest.db", options);
+        ds.put("1", "one");
+        ds.put("2", "two");
+        EXPECT_EQ(ds.get("1"), "one");
+    }
+
+    // Check the page size actually made it into the database file
+    sqlite3* db;
+    ASSERT_EQ(sqlite3_open("OptionsTest.db", &db), SQLITE_OK);
+    sqlite3_stmt* stmt;
+    ASSERT_EQ(sqlite3_prepare_v2(db, "PRAGMA page_size;", -1, &stmt, NULL), SQLITE_OK);
+    ASSERT_EQ(sqlite3_step(stmt), SQLITE_ROW);
+    EXPECT_EQ(sqlite3_column_int(stmt, 0), 8192);
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+
+    options.vfs = "no-such-vfs";
+    EXPECT_THROW(DataStore(1, "OptionsTest.db", options), std::runtime_error);
+}
+
+namespace
+{
+    // Reads every key twice through a store with the given page cache, and returns the page
+    // cache misses of the second pass
+    long long secondPassPageMisses(int page_cache_kb, int keys)
+    {
+        DataStoreOptions options;
+        options.page_cache_kb = page_cache_kb;
+        DataStore ds = DataStore(1, "PageCacheTest.db", options);
+        for (int i = 0; i < keys; ++i)
+        {
+            ds.get(std::to_string(i));
+        }
+        long long misses = ds.pageCacheStats().misses;
+        for (int i = 0; i < keys; ++i)
+        {
+            EXPECT_EQ(ds.get(std::to_string(i)), std::string(600, 'a' + i % 26));
+        }
+        return ds.pageCacheStats().misses - misses;
+    }
+}
+
+TEST(TestDataStore, TestPageCacheSize)
+{
+    std::remove("PageCacheTest.db");
+    const int keys = 2000;
+    {
+        DataStore ds = DataStore(1, "PageCacheTest.db");
+        for (int i = 0; i < keys; ++i)
+        {
+            ds.put(std::to_string(i), std::string(600, 'a' + i % 26));
+        }
+    }
+
+    // The database (over a MiB) fits in a 16 MiB page cache but not in a 64 KiB one, so
+    // the second pass over it should barely touch the file with the larger cache
+    long long small = secondPassPageMisses(64, keys);
+    long long large = secondPassPageMisses(16 * 1024, keys);
+    EXPECT_GT(small, 100);
+    EXPECT_LT(large * 10, small);
+}
+
+TEST(TestDataStore, TestReadAhead)
+{
+    std::remove("ReadAheadTest.db");
+    DataStoreOptions options;
+    options.read_ahead_bytes = 1 << 20;
+    const int keys = 2000;
+    {
+        DataStore ds = DataStore(1, "ReadAheadTest.db", options);
+        for (int i = 0; i < keys; ++i)
+        {
+            ds.put(std::to_string(i), std::string(600, 'a' + i % 26));
+        }
+    }
+
+    // A scan reads the table mostly in file order, so most of its reads continue the one
+    // before and the kernel is asked to read ahead of them
+    {
+        DataStore ds = DataStore(1, "ReadAheadTest.db", options);
+        int count = 0;
+        EXPECT_TRUE(ds.forEach([&count](const std::string& key, const std::string& value) {
+            EXPECT_EQ(value, std::string(600, 'a' + std::stoi(key) % 26));
+            ++count;
+            return true;
+        }));
+        EXPECT_EQ(count, keys);
+
+        ReadAheadVfs::Stats stats = ds.readAheadStats();
+        EXPECT_GT(stats.reads, 100);
+        EXPECT_GT(stats.sequential_reads * 2, stats.reads);
+        EXPECT_GT(stats.read_ahead_bytes, 0);
+    }
+
+    // Without the option the database is opened through the plain VFS
+    DataStore ds = DataStore(1, "ReadAheadTest.db");
+    EXPECT_EQ(ds.get("7"), std::string(600, 'h'));
+    EXPECT_EQ(ds.readAheadStats().reads, 0);
+}
+
+TEST(TestDataStore, TestPartitions)
+{
+    DataStoreOptions options;
+    options.partitions = 4;
+    for (size_t i = 0; i < options.partitions; ++i)
+    {
+        std::remove(("PartitionTest.db." + std::to_string(i)).c_str());
+    }
+
+    {
+        DataStore ds = DataStore(10, "PartitionTest.db", options);
+        for (int i = 0; i < 100; ++i)
+        {
+            ds.put(std::to_string(i), "value" + std::to_string(i));
+        }
+        EXPECT_EQ(ds.get("5"), "value5");
+    }
+
+    // Every key should have been written to exactly one of the partitions
+    int totalRows = 0;
+    for (size_t i = 0; i < options.partitions; ++i)
+    {
+        sqlite3* db;
+        ASSERT_EQ(sqlite3_open(("PartitionTest.db." + std::to_string(i)).c_str(), &db), SQLITE_OK);
+        sqlite3_stmt* stmt;
+        ASSERT_EQ(sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM data;", -1, &stmt, NULL), SQLITE_OK);
+        ASSERT_EQ(sqlite3_step(stmt), SQLITE_ROW);
+        EXPECT_GT(sqlite3_column_int(stmt, 0), 0);
+        totalRows += sqlite3_column_int(stmt, 0);
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+    }
+    EXPECT_EQ(totalRows, 100);
+
+    DataStore ds = DataStore(10, "PartitionTest.db", options);
+    for (int i = 0; i < 100; ++i)
+    {
+        EXPECT_EQ(ds.get(std::to_string(i)), "value" + std::to_string(i));
+    }
+    EXPECT_EQ(ds.get("missing"), "");
+    EXPECT_EQ(ds.isInCache("missing"), false);
+}
+
+TEST(TestDataStore, TestWarmUp)
+{
+    DataStoreOptions options;
+    options.partitions = 2;
+    std::remove("DSWarmUpTest.db.0");
+    std::remove("DSWarmUpTest.db.1");
+    {
+        DataStore ds = DataStore(20, "DSWarmUpTest.db", options);
+        for (int i = 0; i < 20; ++i)
+        {
+            ds.put(std::to_string(i), "value" + std::to_string(i));
+        }
+    }
+
+    DataStore ds = DataStore(5, "DSWarmUpTest.db", options);
+    ds.put("new", "value");
+    EXPECT_EQ(ds.warmUp(), 4);
+    EXPECT_EQ(ds.size(), 5);
+    EXPECT_EQ(ds.isInCache("new"), true);
+    EXPECT_EQ(ds.warmUp(), 0);
+}
+
+TEST(TestDataStore, TestSnapshot)
+{
+    std::remove("SnapshotSource.db");
+    std::remove("Snapshot.db");
+
+    DataStore ds = DataStore(100, "SnapshotSource.db");
+    for (int i = 0; i < 50; ++i)
+    {
+        ds.put(std::to_string(i), std::string(1000, 'a' + i % 26));
+    }
+
+    // Copy one page at a time to make sure the copy is made in several steps
+    int steps = 0;
+    ASSERT_EQ(ds.snapshot("Snapshot.db", 1, [&steps]() { ++steps; }), true);
+    EXPECT_GT(steps, 1);
+
+    // The values are still served from the cache after the flush
+    EXPECT_EQ(ds.isInCache("0"), true);
+    EXPECT_EQ(ds.get("0"), std::string(1000, 'a'));
+
+    DataStore copy = DataStore(1, "Snapshot.db");
+    for (int i = 0; i < 50; ++i)
+    {
+        EXPECT_EQ(copy.get(std::to_string(i)), std::string(1000, 'a' + i % 26));
+    }
+}
+
+TEST(TestDataStore, TestPointInTimeSnapshot)
+{
+    std::remove("WalSnapshotSource.db");
+    std::remove("WalSnapshot.db");
+
+    DataStoreOptions options;
+    options.wal = true;
+    DataStore ds = DataStore(100, "WalSnapshotSource.db", options);
+    ASSERT_EQ(ds.walMode(), true);
+    for (int i = 0; i < 50; ++i)
+    {
+        ds.put(std::to_string(i), std::string(1000, 'a'));
+    }
+
+    // Overwrite everything, and write it to the database, while the copy is being made
+    bool overwritten = false;
+    ASSERT_EQ(ds.snapshot("WalSnapshot.db", 1, [&ds, &overwritten]() {
+        if (!overwritten)
+        {
+            for (int i = 0; i < 50; ++i)
+            {
+                ds.put(std::to_string(i), std::string(1000, 'b'));
+            }
+            ASSERT_EQ(ds.flush(), true);
+            overwritten = true;
+        }
+    }), true);
+    ASSERT_EQ(overwritten, true);
+
+    DataStore copy = DataStore(1, "WalSnapshot.db");
+    for (int i = 0; i < 50; ++i)
+    {
+        EXPECT_EQ(copy.get(std::to_string(i)), std::string(1000, 'a'));
+    }
+}
+
+TEST(TestDataStore, TestBackgroundSave)
+{
+    std::remove("BackgroundSaveTest.db");
+    std::remove("BackgroundSave.snapshot");
+
+    DataStore ds = DataStore(10, "BackgroundSaveTest.db");
+    ds.put("1", "one");
+    ds.put("2", "two");
+    ds.get("1");
+
+    pid_t pid = ds.backgroundSave("BackgroundSave.snapshot");
+    ASSERT_GT(pid, 0);
+
+    // Changes made after the fork are not part of the snapshot
+    ds.put("3", "three");
+    ASSERT_EQ(DataStore::waitForBackgroundSave(pid), true);
+
+    std::remove("RestoreTest.db");
+    DataStore restored = DataStore(10, "RestoreTest.db");
+    EXPECT_EQ(restored.restoreCache("BackgroundSave.snapshot"), 2);
+    EXPECT_EQ(restored.size(), 2);
+    EXPECT_EQ(restored.isInCache("3"), false);
+    EXPECT_EQ(restored.get("1"), "one");
+    EXPECT_EQ(restored.get("2"), "two");
+}
+
+TEST(TestDataStore, TestDumpAndLoad)
+{
+    std::remove("DumpTest.db");
+    std::remove("LoadTest.db");
+
+    for (bool compress : {false, true})
+    {
+        {
+            DataStore ds = DataStore(10, "DumpTest.db");
+            for (int i = 0; i < 1000; ++i)
+            {
+                ds.put(std::to_string(i), "value" + std::to_string(i));
+            }
+            ASSERT_EQ(ds.dump("Dump.snapshot", compress), true);
+        }
+
+        DataStore loaded = DataStore(10, "LoadTest.db");
+        loaded.put("5", "stale");
+        EXPECT_EQ(loaded.load("Dump.snapshot"), 1000);
+        EXPECT_EQ(loaded.get("5"), "value5");
+        for (int i = 0; i < 1000; ++i)
+        {
+            EXPECT_EQ(loaded.get(std::to_string(i)), "value" + std::to_string(i));
+        }
+    }
+}
+
+TEST(TestDataStore, TestCorruptSnapshot)
+{
+    std::remove("CorruptTest.db");
+    DataStore ds = DataStore(10, "CorruptTest.db");
+    ds.put("1", std::string(100, 'x'));
+    ASSERT_EQ(ds.saveCache("Corrupt.snapshot"), true);
+
+    // Flip a byte in the middle of the first block
+    FILE* file = std::fopen("Corrupt.snapshot", "r+b");
+    ASSERT_NE(file, nullptr);
+    std::fseek(file, 60, SEEK_SET);
+    std::fputc('y', file);
+    std::fclose(file);
+
+    std::remove("CorruptRestoreTest.db");
+    DataStore restored = DataStore(10, "CorruptRestoreTest.db");
+    EXPECT_EQ(restored.restoreCache("Corrupt.snapshot"), 0);
+}
+
+TEST(TestDataStore, TestSnapshotIndexOffsetOverflow)
+{
+    std::remove("OverflowTest.db");
+    DataStore ds = DataStore(10, "OverflowTest.db");
+    ds.put("1", "one");
+    ASSERT_EQ(ds.saveCache("Overflow.snapshot"), true);
+
+    // Point the index at an offset that only adds up to the right place by wrapping around
+    FILE* file = std::fopen("Overflow.snapshot", "r+b");
+    ASSERT_NE(file, nullptr);
+    std::fseek(file, 0, SEEK_END);
+    uint64_t size = static_cast<uint64_t>(std::ftell(file));
+    uint64_t blockCount = (uint64_t(1) << 32) / CacheSnapshotWriter::INDEX_ENTRY_SIZE;
+    uint64_t indexOffset = size - CacheSnapshotWriter::FOOTER_SIZE - blockCount * CacheSnapshotWriter::INDEX_ENTRY_SIZE;
+    unsigned char footer[12];
+    for (int i = 0; i < 8; ++i)
+    {
+        footer[i] = static_cast<unsigned char>(indexOffset >> (8 * i));
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        footer[8 + i] = static_cast<unsigned char>(blockCount >> (8 * i));
+    }
+    std::fseek(file, static_cast<long>(size - CacheSnapshotWriter::FOOTER_SIZE), SEEK_SET);
+    std::fwrite(footer, 1, sizeof(footer), file);
+    std::fclose(file);
+
+    std::remove("OverflowRestoreTest.db");
+    DataStore restored = DataStore(10, "OverflowRestoreTest.db");
+    EXPECT_EQ(restored.restoreCache("Overflow.snapshot"), 0);
+}
+
+TEST(TestCrc32c, TestKnownValue)
+{
+    const std::string data = "123456789";
+    EXPECT_EQ(Crc32c::compute(data.data(), data.size()), 0xE3069283u);
+    EXPECT_EQ(Crc32c::computeSoftware(reinterpret_cast<const unsigned char*>(data.data()), data.size()), 0xE3069283u);
+
+    // Checksumming in pieces gives the same result
+    uint32_t crc = Crc32c::compute(data.data(), 4);
+    EXPECT_EQ(Crc32c::compute(data.data() + 4, data.size() - 4, crc), 0xE3069283u);
+}
+
+TEST(TestDataStore, TestBulkLoad)
+{
+    DataStoreOptions options;
+    options.partitions = 2;
+    std::remove("BulkLoadTest.db.0");
+    std::remove("BulkLoadTest.db.1");
+
+    std::vector<std::pair<std::string, std::string>> entries;
+    for (int i = 999; i >= 0; --i)
+    {
+        entries.push_back(std::make_pair(std::to_string(i), "value" + std::to_string(i)));
+    }
+    entries.push_back(std::make_pair("7", "seven"));
+
+    {
+        DataStore ds = DataStore(5, "BulkLoadTest.db", options);
+        ds.put("7", "cached");
+        EXPECT_EQ(ds.bulkLoad(entries.begin(), entries.end(), 3), 1000);
+
+        // The tail of the input ends up in the cache, unmodified
+        EXPECT_EQ(ds.isInCache("0"), true);
+        EXPECT_EQ(ds.isInCache("1"), true);
+        EXPECT_EQ(ds.get("7"), "seven");
+        EXPECT_EQ(ds.get("500"), "value500");
+    }
+
+    std::ofstream out("BulkLoad.tsv");
+    out << "a\tfirst\nb\tsecond\nmalformed\n";
+    out.close();
+
+    DataStore ds = DataStore(5, "BulkLoadTest.db", options);
+    EXPECT_EQ(ds.bulkLoad("BulkLoad.tsv"), 2);
+    EXPECT_EQ(ds.size(), 0);
+    EXPECT_EQ(ds.get("b"), "second");
+    EXPECT_EQ(ds.get("999"), "value999");
+    EXPECT_EQ(ds.get("7"), "seven");
+}
+
+TEST(TestDataStore, TestBulkLoadFailure)
+{
+    std::remove("BulkLoadFailureTest.db");
+    std::vector<std::pair<std::string, std::string>> entries;
+    for (int i = 0; i < 100; ++i)
+    {
+        entries.push_back(std::make_pair(std::to_string(i), "value" + std::to_string(i)));
+    }
+
+    DataStoreOptions options;
+    options.busy_timeout_ms = 0;
+    {
+        DataStore ds = DataStore(5, "BulkLoadFailureTest.db", options);
+        ds.put("7", "cached");
+        ASSERT_EQ(ds.flush(), true);
+
+        // Another connection holds the database locked, so the load can not commit
+        sqlite3* other = nullptr;
+        ASSERT_EQ(sqlite3_open("BulkLoadFailureTest.db", &other), SQLITE_OK);
+        ASSERT_EQ(sqlite3_exec(other, "BEGIN EXCLUSIVE;", NULL, nullptr, nullptr), SQLITE_OK);
+        EXPECT_EQ(ds.bulkLoad(entries.begin(), entries.end()), 0);
+        sqlite3_exec(other, "COMMIT;", NULL, nullptr, nullptr);
+        sqlite3_close(other);
+
+        // The cached value is not lost, and is written back later
+        EXPECT_EQ(ds.get("7"), "value7");
+    }
+
+    DataStore ds = DataStore(5, "BulkLoadFailureTest.db");
+    EXPECT_EQ(ds.get("7"), "value7");
+    EXPECT_EQ(ds.get("50"), "");
+}
+
+TEST(TestDataStore, TestForEach)
+{
+    DataStoreOptions options;
+    options.partitions = 3;
+    for (int i = 0; i < 3; ++i)
+    {
+        std::remove(("ForEachTest.db." + std::to_string(i)).c_str());
+    }
+
+    DataStore ds = DataStore(4, "ForEachTest.db", options);
+    for (int i = 0; i < 10; ++i)
+    {
+        ds.put("key" + std::to_string(i), "value" + std::to_string(i));
+    }
+    ds.put("key2", "updated");  // Only the cached copy is up to date
+    ds.put("key11", "eleven");
+    ds.get("key0");             // Cached, but not modified
+
+    std::vector<std::string> keys;
+    std::vector<std::string> values;
+    ASSERT_EQ(ds.forEach([&](const std::string& key, const std::string& value) {
+        keys.push_back(key);
+        values.push_back(value);
+        return true;
+    }), true);
+
+    std::vector<std::string> expectedKeys = {"key0", "key1", "key11", "key2", "key3", "key4", "key5", "key6", "key7", "key8", "key9"};
+    EXPECT_EQ(keys, expectedKeys);
+    EXPECT_EQ(values[2], "eleven");
+    EXPECT_EQ(values[3], "updated");
+    EXPECT_EQ(values[4], "value3");
+
+    // Stopping early
+    size_t visited = 0;
+    ds.forEach([&visited](const std::string&, const std::string&) {
+        return ++visited < 3;
+    });
+    EXPECT_EQ(visited, 3);
+}
+
+TEST(TestDataStore, TestScan)
+{
+    for (bool orderedIndex : {false, true})
+    {
+        DataStoreOptions options;
+        options.partitions = 2;
+        options.ordered_index = orderedIndex;
+        std::remove("ScanTest.db.0");
+        std::remove("ScanTest.db.1");
+
+        DataStore ds = DataStore(5, "ScanTest.db", options);
+        for (const char* key : {"apple", "apricot", "banana", "blueberry", "cherry", "ap", "b"})
+        {
+            ds.put(key, std::string("stored ") + key);
+        }
+        ds.put("apricot", "cached apricot");
+        ds.put("avocado", "cached avocado");
+        ds.get("apple");
+
+        auto collect = [](std::vector<std::string>& out) {
+            return [&out](const std::string& key, const std::string& value) {
+                out.push_back(key + "=" + value);
+                return true;
+            };
+        };
+
+        std::vector<std::string> prefixed;
+        ASSERT_EQ(ds.scanPrefix("ap", collect(prefixed)), true);
+        std::vector<std::string> expectedPrefixed = {"ap=stored ap", "apple=stored apple", "apricot=cached apricot"};
+        EXPECT_EQ(prefixed, expectedPrefixed);
+
+        std::vector<std::string> ranged;
+        ASSERT_EQ(ds.scan("apricot", "blueberry", collect(ranged)), true);
+        std::vector<std::string> expectedRanged = {"apricot=cached apricot", "avocado=cached avocado", "b=stored b", "banana=stored banana"};
+        EXPECT_EQ(ranged, expectedRanged);
+
+        // Values that have been flushed are found through the database only
+        ds.flush();
+        ds.put("banana", "cached banana");
+        std::vector<std::string> bs;
+        ASSERT_EQ(ds.scanPrefix("b", collect(bs)), true);
+        std::vector<std::string> expectedBs = {"b=stored b", "banana=cached banana", "blueberry=stored blueberry"};
+        EXPECT_EQ(bs, expectedBs);
+    }
+}
+
+static std::string jsonValue(int i)
+{
+    return "{\"id\": " + std::to_string(i) + ", \"name\": \"user" + std::to_string(i) + 
+           "\", \"email\": \"user" + std::to_string(i) + "@example.com\", \"active\": true, \"roles\": [\"reader\", \"writer\"]}";
+}
+
+static long long storedBytes(const std::string& path, const std::string& key)
+{
+    sqlite3* db;
+    sqlite3_open(path.c_str(), &db);
+    sqlite3_stmt* stmt;
+    sqlite3_prepare_v2(db, "SELECT LENGTH(CAST(value AS BLOB)) FROM data WHERE key = ?;", -1, &stmt, NULL);
+    sqlite3_bind_text(stmt, 1, key.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_step(stmt);
+    long long bytes = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return bytes;
+}
+
+TEST(TestDataStore, TestCompression)
+{
+    std::remove("CompressionTest.db");
+    std::remove("PlainTest.db");
+
+    DataStoreOptions options;
+    options.compression = true;
+    options.compression_min_size = 32;
+
+    {
+        DataStore plain = DataStore(1, "PlainTest.db");
+        DataStore ds = DataStore(1, "CompressionTest.db", options);
+        for (int i = 0; i < 100; ++i)
+        {
+            plain.put(std::to_string(i), jsonValue(i));
+            ds.put(std::to_string(i), jsonValue(i));
+        }
+        ds.put("small", "tiny");
+
+        // Values with a trained dictionary compress better than on their own
+        ASSERT_EQ(ds.trainCompressionDictionary(100), true);
+        for (int i = 100; i < 200; ++i)
+        {
+            plain.put(std::to_string(i), jsonValue(i));
+            ds.put(std::to_string(i), jsonValue(i));
+        }
+    }
+    EXPECT_LT(storedBytes("CompressionTest.db", "5"), storedBytes("PlainTest.db", "5"));
+    EXPECT_LT(storedBytes("CompressionTest.db", "150") * 2, storedBytes("PlainTest.db", "150"));
+    EXPECT_EQ(storedBytes("CompressionTest.db", "small"), 4);
+
+    // Everything reads back, including from a store opened without compression
+    DataStore ds = DataStore(1, "CompressionTest.db");
+    EXPECT_EQ(ds.get("small"), "tiny");
+    for (int i = 0; i < 200; ++i)
+    {
+        EXPECT_EQ(ds.get(std::to_string(i)), jsonValue(i));
+    }
+}
+
+TEST(TestDataStore, TestCompressedTier)
+{
+    std::remove("CompressedTierTest.db");
+
+    DataStoreOptions options;
+    options.compressed_tier_bytes = 1 << 20;
+
+    DataStore ds = DataStore(2, "CompressedTierTest.db", options);
+    for (int i = 0; i < 10; ++i)
+    {
+        ds.put(std::to_string(i), jsonValue(i));
+    }
+    EXPECT_EQ(ds.size(), 2);
+    EXPECT_EQ(ds.compressedTierSize(), 8);
+
+    // Change the stored copy behind the data store's back to prove hits come from the tier
+    sqlite3* db;
+    ASSERT_EQ(sqlite3_open("CompressedTierTest.db", &db), SQLITE_OK);
+    ASSERT_EQ(sqlite3_exec(db, "UPDATE data SET value = 'from disk';", NULL, nullptr, nullptr), SQLITE_OK);
+    sqlite3_close(db);
+
+    EXPECT_EQ(ds.get("0"), jsonValue(0));
+    EXPECT_EQ(ds.getMany({"1", "2"})[1], jsonValue(2));
+    EXPECT_EQ(ds.size(), 2);
+    EXPECT_EQ(ds.compressedTierSize(), 8);
+
+    // A put replaces whatever the tier had
+    ds.put("3", "new");
+    EXPECT_EQ(ds.get("3"), "new");
+
+    // A small tier evicts the oldest values
+    options.compressed_tier_bytes = 600;
+    std::remove("SmallTierTest.db");
+    DataStore small = DataStore(1, "SmallTierTest.db", options);
+    for (int i = 0; i < 10; ++i)
+    {
+        small.put(std::to_string(i), jsonValue(i));
+    }
+    EXPECT_GT(small.compressedTierSize(), 0);
+    EXPECT_LT(small.compressedTierSize(), 9);
+    EXPECT_EQ(small.get("0"), jsonValue(0));
+}
+
+TEST(TestDataStore, TestFlashTier)
+{
+    std::remove("FlashTierTest.db");
+
+    DataStoreOptions options;
+    options.flash_tier_path = "FlashTierTest.cache";
+    options.flash_tier_bytes = 4096;
+
+    {
+        DataStore ds = DataStore(2, "FlashTierTest.db", options);
+        for (int i = 0; i < 10; ++i)
+        {
+            ds.put(std::to_string(i), jsonValue(i));
+        }
+        EXPECT_EQ(ds.flashTierSize(), 8);
+
+        // Change the stored copies behind the data store's back to prove hits come from the tier
+        sqlite3* db;
+        ASSERT_EQ(sqlite3_open("FlashTierTest.db", &db), SQLITE_OK);
+        ASSERT_EQ(sqlite3_exec(db, "UPDATE data SET value = 'from disk';", NULL, nullptr, nullptr), SQLITE_OK);
+        sqlite3_close(db);
+        EXPECT_EQ(ds.get("0"), jsonValue(0));
+
+        // Wrapping around the log drops the oldest values, which are then read from the database
+        for (int i = 10; i < 60; ++i)
+        {
+            ds.put(std::to_string(i), jsonValue(i));
+        }
+        EXPECT_LT(ds.flashTierSize(), 4096 / 100);
+        EXPECT_EQ(ds.get("1"), "from disk");
+        EXPECT_EQ(ds.get("58"), jsonValue(58));
+    }
+
+    // The cache file goes away with the data store
+    EXPECT_EQ(std::fopen("FlashTierTest.cache", "r"), nullptr);
+
+    // Values pass through the compressed tier on their way to flash
+    std::remove("FlashTierTest.db");
+    options.compressed_tier_bytes = 600;
+    DataStore ds = DataStore(1, "FlashTierTest.db", options);
+    for (int i = 0; i < 20; ++i)
+    {
+        ds.put(std::to_string(i), jsonValue(i));
+    }
+    EXPECT_GT(ds.compressedTierSize(), 0);
+    EXPECT_GT(ds.flashTierSize(), 0);
+    for (int i = 0; i < 20; ++i)
+    {
+        EXPECT_EQ(ds.get(std::to_string(i)), jsonValue(i));
+    }
+}
+
+TEST(TestDataStore, TestSharedSegment)
+{
+    const std::string segment = "/DataStoreSharedSegmentTest";
+    SharedCacheSegment::remove(segment);
+    std::remove("SharedSegmentTest.db");
+
+    DataStoreOptions options;
+    options.shared_segment_name = segment;
+    options.shared_segment_slots = 64;
+    options.shared_segment_slot_size = 256;
+
+    DataStore first = DataStore(10, "SharedSegmentTest.db", options);
+    DataStore second = DataStore(10, "SharedSegmentTest.db", options);
+
+    // The value has not been written to the database, but the second store finds it in the segment
+    first.put("1", "one");
+    EXPECT_EQ(second.get("1"), "one");
+
+    // The same goes for another process
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        SharedCacheSegment child(segment, 64, 256);
+        std::string value;
+        bool found = child.get("1", value) && value == "one";
+        child.put("2", "from child");
+        _exit(found ? 0 : 1);
+    }
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    EXPECT_EQ(WIFEXITED(status) && WEXITSTATUS(status) == 0, true);
+    EXPECT_EQ(first.get("2"), "from child");
+
+    // Values too big for a slot are not shared
+    first.put("big", std::string(1000, 'x'));
+    EXPECT_EQ(second.get("big"), "");
+
+    SharedCacheSegment::remove(segment);
+}
+
+TEST(TestDataStore, TestChangeTracking)
+{
+    std::remove("ChangeTrackingTest.db");
+
+    DataStoreOptions options;
+    options.change_tracking = true;
+    options.change_log_size = 10;
+
+    DataStore reader = DataStore(1000, "ChangeTrackingTest.db", options);
+    DataStore writer = DataStore(1000, "ChangeTrackingTest.db", options);
+
+    writer.put("a", "1");
+    writer.put("b", "1");
+    EXPECT_EQ(writer.flush(), true);
+    EXPECT_EQ(reader.get("a"), "1");
+    EXPECT_EQ(reader.get("b"), "1");
+
+    // Only the key the writer changed is dropped from the reader's cache
+    writer.put("a", "2");
+    EXPECT_EQ(writer.flush(), true);
+    EXPECT_EQ(reader.get("a"), "2");
+    EXPECT_EQ(reader.isInCache("b"), true);
+
+    // Values the reader has modified itself are kept
+    reader.put("b", "mine");
+    writer.put("b", "theirs");
+    EXPECT_EQ(writer.flush(), true);
+    EXPECT_EQ(reader.get("b"), "mine");
+
+    // A reader that falls behind the trimmed log drops everything it has cached
+    EXPECT_EQ(reader.flush(), true);
+    EXPECT_EQ(reader.get("b"), "mine");
+    for (int i = 0; i < 300; ++i)
+    {
+        writer.put("key" + std::to_string(i), "value");
+    }
+    EXPECT_EQ(writer.flush(), true);
+    EXPECT_EQ(reader.get("key0"), "value");
+    EXPECT_EQ(reader.isInCache("b"), false);
+}
+
+TEST(TestDataStore, TestReadOnlyReplica)
+{
+    std::remove("ReadOnlyReplicaTest.db");
+    std::remove("MissingReplicaTest.db");
+
+    DataStoreOptions options;
+    options.change_tracking = true;
+    DataStore writer = DataStore(10, "ReadOnlyReplicaTest.db", options);
+    writer.put("1", "one");
+    EXPECT_EQ(writer.flush(), true);
+
+    options.read_only = true;
+    DataStore replica = DataStore(10, "ReadOnlyReplicaTest.db", options);
+    EXPECT_EQ(replica.get("1"), "one");
+    EXPECT_EQ(replica.get("2"), "");
+    EXPECT_THROW(replica.put("2", "two"), std::logic_error);
+    EXPECT_EQ(replica.isInCache("2"), false);
+
+    // The replica follows the writer
+    writer.put("1", "uno");
+    EXPECT_EQ(writer.flush(), true);
+    EXPECT_EQ(replica.get("1"), "uno");
+
+    // A replica can not create the database
+    EXPECT_THROW(DataStore(10, "MissingReplicaTest.db", options), std::runtime_error);
+}
+
+TEST(TestDataStore, TestReplicaWhileWriting)
+{
+    std::remove("ReplicaWhileWritingTest.db");
+
+    DataStoreOptions options;
+    options.change_tracking = true;
+    DataStore writer = DataStore(10, "ReplicaWhileWritingTest.db", options);
+    EXPECT_EQ(writer.walMode(), true);
+    writer.put("0", "value0");
+    ASSERT_EQ(writer.flush(), true);
+
+    options.read_only = true;
+    DataStore replica = DataStore(10, "ReplicaWhileWritingTest.db", options);
+
+    // The writer keeps committing (through evictions and flushes) while the replica reads every 
+    // key that is already committed, and must never miss one
+    std::atomic<int> committed(0);
+    std::atomic<bool> done(false);
+    std::thread writing([&writer, &committed, &done]() {
+        for (int i = 1; i < 500; ++i)
+        {
+            writer.put(std::to_string(i), "value" + std::to_string(i));
+            if (i % 10 == 0)
+            {
+                EXPECT_EQ(writer.flush(), true);
+                committed = i;
+            }
+        }
+        done = true;
+    });
+    int misses = 0;
+    while (!done)
+    {
+        int last = committed;
+        for (int i = 0; i <= last; i += 7)
+        {
+            if (replica.get(std::to_string(i)) != "value" + std::to_string(i))
+            {
+                ++misses;
+            }
+        }
+    }
+    writing.join();
+    EXPECT_EQ(misses, 0);
+
+    // A modified value whose write back fails when it is evicted stays cached until it can be written
+    options.read_only = false;
+    options.busy_timeout_ms = 0;
+    DataStore locked = DataStore(1, "ReplicaWhileWritingTest.db", options);
+    sqlite3* other = nullptr;
+    ASSERT_EQ(sqlite3_open("ReplicaWhileWritingTest.db", &other), SQLITE_OK);
+    ASSERT_EQ(sqlite3_exec(other, "BEGIN IMMEDIATE;", NULL, nullptr, nullptr), SQLITE_OK);
+    locked.put("a", "kept");
+    locked.put("b", "also kept");
+    EXPECT_EQ(locked.isInCache("a"), true);
+    sqlite3_exec(other, "COMMIT;", NULL, nullptr, nullptr);
+    sqlite3_close(other);
+    EXPECT_EQ(locked.flush(), true);
+    EXPECT_EQ(writer.get("a"), "kept");
+}
+
+TEST(TestDataStore, TestHugePageCacheArena)
+{
+    std::remove("ArenaTest.db");
+    DataStoreOptions options;
+    options.cache_arena_bytes = 16 * 1024 * 1024;
+    DataStore ds(2000, "ArenaTest.db", options);
+    for (int i = 0; i < 5000; ++i)
+    {
+        ds.put("key" + std::to_string(i), "value" + std::to_string(i));
+    }
+    for (int i = 0; i < 5000; ++i)
+    {
+        EXPECT_EQ(ds.get("key" + std::to_string(i)), "value" + std::to_string(i));
+    }
+    EXPECT_EQ(ds.size(), 2000);
+
+    // The cache lives in the arena, and evicted entries' memory is reused rather than added to
+    HugePageArena::Stats stats = ds.cacheArenaStats();
+    EXPECT_EQ(stats.reserved_bytes, 16 * 1024 * 1024);
+    EXPECT_GT(stats.used_bytes, 2000 * sizeof(DataStore::key_val_pair));
+    EXPECT_LT(stats.used_bytes, 1024 * 1024);
+    EXPECT_GE(stats.coverage(), 0);
+    EXPECT_LE(stats.coverage(), 1);
+
+    DataStore plain(10, "ArenaTest.db");
+    EXPECT_EQ(plain.cacheArenaStats().reserved_bytes, 0);
+}
+
+TEST(TestHugePageArena, TestReuseAndFallback)
+{
+    HugePageArena arena(1);
+    EXPECT_EQ(arena.stats().reserved_bytes, HugePageArena::HUGE_PAGE_SIZE);
+
+    void* first = arena.allocate(40);
+    void* second = arena.allocate(40);
+    EXPECT_NE(first, second);
+    EXPECT_TRUE(arena.contains(first));
+    arena.deallocate(first, 40);
+    EXPECT_EQ(arena.allocate(48), first);
+
+    // A full arena returns nullptr, and its allocator falls back to the heap
+    EXPECT_EQ(arena.allocate(4 * 1024 * 1024), nullptr);
+    ArenaAllocator<char> allocator(&arena);
+    char* large = allocator.allocate(4 * 1024 * 1024);
+    EXPECT_FALSE(arena.contains(large));
+    allocator.deallocate(large, 4 * 1024 * 1024);
+
+    // A freed large block is split up for smaller requests rather than left unused
+    HugePageArena splitting(1);
+    void* outgrown = splitting.allocate(1024 * 1024);
+    ASSERT_NE(outgrown, nullptr);
+    splitting.deallocate(outgrown, 1024 * 1024);
+    size_t used = splitting.stats().used_bytes;
+    void* bucketArray = splitting.allocate(600 * 1024);
+    EXPECT_EQ(bucketArray, outgrown);
+    void* another = splitting.allocate(300 * 1024);
+    EXPECT_EQ(another, static_cast<char*>(outgrown) + 600 * 1024);
+    EXPECT_EQ(splitting.stats().used_bytes, used);
+
+    // Once the arena is full, small blocks come from what is left of it
+    EXPECT_NE(splitting.allocate(splitting.stats().reserved_bytes - used), nullptr);
+    void* node = splitting.allocate(64);
+    EXPECT_EQ(node, static_cast<char*>(outgrown) + 900 * 1024);
+
+    // Huge pages can be refused, but the arena still works
+    HugePageArena hugetlbfs(1, true);
+    EXPECT_NE(hugetlbfs.allocate(64), nullptr);
+}
+
+TEST(TestHugePageArena, TestMergedMapping)
+{
+    const size_t size = 4 * HugePageArena::HUGE_PAGE_SIZE;
+    HugePageArena arena(size);
+    char* block = static_cast<char*>(arena.allocate(size));
+    ASSERT_NE(block, nullptr);
+    std::memset(block, 1, size);
+    size_t huge = arena.stats().huge_page_bytes;
+    if (huge == 0)
+    {
+        GTEST_SKIP() << "No transparent huge pages were given to the arena";
+    }
+
+    // A mapping with the same flags right below the arena gets merged into one with it by the
+    // kernel, so the arena no longer starts a mapping of its own
+    void* below = mmap(block - HugePageArena::HUGE_PAGE_SIZE, HugePageArena::HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+    if (below != block - HugePageArena::HUGE_PAGE_SIZE)
+    {
+        GTEST_SKIP() << "The address space below the arena is taken";
+    }
+    madvise(below, HugePageArena::HUGE_PAGE_SIZE, MADV_HUGEPAGE);
+    EXPECT_EQ(arena.stats().huge_page_bytes, huge);
+
+    // Memory outside the arena is not counted
+    std::memset(below, 1, HugePageArena::HUGE_PAGE_SIZE);
+    EXPECT_EQ(arena.stats().huge_page_bytes, huge);
+    munmap(below, HugePageArena::HUGE_PAGE_SIZE);
+}
+
+TEST(TestSharedCacheSegment, TestEviction)
+{
+    const std::string name = "/DataStoreSegmentEvictionTest";
+    SharedCacheSegment::remove(name);
+    {
+        SharedCacheSegment segment(name, 32, 64);
+        for (int i = 0; i < 100; ++i)
+        {
+            EXPECT_EQ(segment.put(std::to_string(i), "value" + std::to_string(i)), true);
+        }
+        EXPECT_LE(segment.size(), 32);
+
+        std::string value;
+        EXPECT_EQ(segment.get("99", value), true);
+        EXPECT_EQ(value, "value99");
+        EXPECT_EQ(segment.erase("99"), true);
+        EXPECT_EQ(segment.get("99", value), false);
+    }
+    SharedCacheSegment::remove(name);
+}
+
+TEST(TestSharedCacheSegment, TestDeadCreator)
+{
+    // A segment whose creator died before initializing it
+    const std::string name = "/DataStoreSegmentDeadCreatorTest";
+    SharedCacheSegment::remove(name);
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(ftruncate(fd, 4096), 0);
+    close(fd);
+
+    // It is taken to be stale once the timeout is up, and created again
+    {
+        SharedCacheSegment segment(name, 32, 64, 100);
+        EXPECT_EQ(segment.put("key", "value"), true);
+        std::string value;
+        EXPECT_EQ(segment.get("key", value), true);
+        EXPECT_EQ(value, "value");
+    }
+
+    // Which the next process to open it uses as it is
+    {
+        SharedCacheSegment segment(name, 32, 64, 100);
+        std::string value;
+        EXPECT_EQ(segment.get("key", value), true);
+        EXPECT_EQ(value, "value");
+    }
+    SharedCacheSegment::remove(name);
+}
+
+TEST(TestSharedCacheSegment, TestCreatorDiedWhileInitializing)
+{
+    // A creator that got as far as writing its pid but died before marking the segment ready
+    const std::string name = "/DataStoreSegmentDiedInitializingTest";
+    SharedCacheSegment::remove(name);
+    {
+        SharedCacheSegment segment(name, 32, 64);
+        EXPECT_EQ(segment.put("key", "value"), true);
+    }
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0)
+    {
+        _exit(0);
+    }
+    ASSERT_EQ(waitpid(pid, NULL, 0), pid);
+
+    // The header starts with the magic, the slot count and size, the creator's pid and the
+    // ready flag
+    int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    ASSERT_GE(fd, 0);
+    void* mapping = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    ASSERT_NE(mapping, MAP_FAILED);
+    int32_t* fields = reinterpret_cast<int32_t*>(static_cast<char*>(mapping) + 3 * sizeof(uint64_t));
+    fields[0] = static_cast<int32_t>(pid);
+    fields[1] = 0;
+    munmap(mapping, 4096);
+
+    // Found to be stale at once, without waiting out the (long) timeout
+    auto start = std::chrono::steady_clock::now();
+    SharedCacheSegment segment(name, 32, 64, 60000);
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+    std::string value;
+    EXPECT_EQ(segment.get("key", value), false);
+    EXPECT_EQ(segment.put("key", "value"), true);
+    SharedCacheSegment::remove(name);
+}
+
+TEST(TestSharedCacheSegment, TestStripes)
+{
+    // Every key is found again, whichever stripe its group is in
+    const std::string name = "/DataStoreSegmentStripesTest";
+    SharedCacheSegment::remove(name);
+    {
+        SharedCacheSegment segment(name, 4096, 64);
+        for (int i = 0; i < 1000; ++i)
+        {
+            EXPECT_EQ(segment.put(std::to_string(i), "value" + std::to_string(i)), true);
+        }
+        EXPECT_EQ(segment.size(), 1000);
+        for (int i = 0; i < 1000; i += 7)
+        {
+            std::string value;
+            EXPECT_EQ(segment.get(std::to_string(i), value), true);
+            EXPECT_EQ(value, "value" + std::to_string(i));
+        }
+        segment.clear();
+        EXPECT_EQ(segment.size(), 0);
+    }
+    SharedCacheSegment::remove(name);
+}
@@ -0,0 +1,568 @@
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ShardedDataStore.h"
+#include "EventLoopServer.h"
+#include "MemcachedProtocol.h"
+#include "RespProtocol.h"
+#include "DataStoreClient.h"
+#include "HashRing.h"
+#include "PartitionedDataStore.h"
+
+namespace
+{
+    void removeShardFiles(const std::string& name, size_t shards)
+    {
+        for (size_t i = 0; i < shards; ++i)
+        {
+            std::remove((name + ".shard" + std::to_string(i)).c_str());
+        }
+    }
+
+    int connectTcp(uint16_t port)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = sockaddr_in();
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    int connectUnix(const std::string& path)
+    {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address = sockaddr_un();
+        address.sun_family = AF_UNIX;
+        std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    void sendAll(int fd, const std::string& data)
+    {
+        size_t sent = 0;
+        while (sent < data.size())
+        {
+            ssize_t count = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (count <= 0)
+            {
+                return;
+            }
+            sent += static_cast<size_t>(count);
+        }
+    }
+
+    // Reads until the response ends with the terminator (or the connection closes)
+    std::string readUntil(int fd, const std::string& terminator)
+    {
+        std::string response;
+        char buffer[4096];
+        while (response.size() < terminator.size() ||
+               response.compare(response.size() - terminator.size(), terminator.size(), terminator) != 0)
+        {
+            ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+            if (count <= 0)
+            {
+                break;
+            }
+            response.append(buffer, static_cast<size_t>(count));
+        }
+        return response;
+    }
+
+    std::string readExactly(int fd, size_t size)
+    {
+        std::string response;
+        char buffer[65536];
+        while (response.size() < size)
+        {
+            ssize_t count = recv(fd, buffer, std::min(sizeof(buffer), size - response.size()), 0);
+            if (count <= 0)
+            {
+                break;
+            }
+            response.append(buffer, static_cast<size_t>(count));
+        }
+        return response;
+    }
+
+    std::string roundTrip(int fd, const std::string& request, const std::string& terminator)
+    {
+        sendAll(fd, request);
+        return readUntil(fd, terminator);
+    }
+
+    EventLoopServer::handler_factory memcached(ShardedDataStore& store)
+    {
+        return [&store]() {
+            return std::unique_ptr<ProtocolHandler>(new MemcachedProtocol(store));
+        };
+    }
+
+    EventLoopServer::handler_factory resp(ShardedDataStore& store, KeyExpiry& expiry)
+    {
+        return [&store, &expiry]() {
+            return std::unique_ptr<ProtocolHandler>(new RespProtocol(store, expiry));
+        };
+    }
+
+    // Never finds a complete request, so all of the input stays waiting
+    class StallingProtocol : public ProtocolHandler
+    {
+    public:
+        size_t process(const char*, size_t, OutputQueue&, bool&) override
+        {
+            return 0;
+        }
+    };
+
+    std::string command(const std::vector<std::string>& args)
+    {
+        std::string encoded = "*" + std::to_string(args.size()) + "\r\n";
+        for (const std::string& arg : args)
+        {
+            encoded += "$" + std::to_string(arg.size()) + "\r\n" + arg + "\r\n";
+        }
+        return encoded;
+    }
+}
+
+TEST(TestMemcachedServer, TestTextProtocol)
+{
+    removeShardFiles("MemcachedTextTest.db", 4);
+    ShardedDataStore store(100, 4, "MemcachedTextTest.db");
+    EventLoopServer server("127.0.0.1:0", memcached(store), 2);
+
+    int fd = connectTcp(server.port());
+    ASSERT_GE(fd, 0);
+
+    EXPECT_EQ(roundTrip(fd, "set a 0 0 3\r\none\r\n", "\r\n"), "STORED\r\n");
+    EXPECT_EQ(roundTrip(fd, "get a\r\n", "END\r\n"), "VALUE a 0 3\r\none\r\nEND\r\n");
+    EXPECT_EQ(roundTrip(fd, "add a 0 0 1\r\nx\r\n", "\r\n"), "NOT_STORED\r\n");
+    EXPECT_EQ(roundTrip(fd, "replace b 0 0 1\r\nx\r\n", "\r\n"), "NOT_STORED\r\n");
+
+    // Pipelined requests, with the data of one split across two writes
+    sendAll(fd, "set b 0 0 3\r\ntw");
+    usleep(10000);
+    EXPECT_EQ(roundTrip(fd, "o\r\nset c 0 0 5 noreply\r\nthree\r\nget a b c d\r\n", "END\r\n"),
+              "STORED\r\nVALUE a 0 3\r\none\r\nVALUE b 0 3\r\ntwo\r\nVALUE c 0 5\r\nthree\r\nEND\r\n");
+
+    EXPECT_EQ(roundTrip(fd, "delete a\r\ndelete a\r\nget a\r\n", "END\r\n"), "DELETED\r\nNOT_FOUND\r\nEND\r\n");
+    EXPECT_EQ(roundTrip(fd, "bogus\r\n", "\r\n"), "ERROR\r\n");
+
+    // Values stay in the store after the client goes away
+    EXPECT_EQ(roundTrip(fd, "quit\r\n", "\r\n"), "");
+    close(fd);
+    EXPECT_EQ(store.get("b"), "two");
+}
+
+TEST(TestMemcachedServer, TestMetaProtocol)
+{
+    removeShardFiles("MemcachedMetaTest.db", 2);
+    ShardedDataStore store(100, 2, "MemcachedMetaTest.db");
+    EventLoopServer server("127.0.0.1:0", memcached(store), 1);
+
+    int fd = connectTcp(server.port());
+    ASSERT_GE(fd, 0);
+
+    EXPECT_EQ(roundTrip(fd, "ms key 5 T0 Oabc\r\nvalue\r\n", "\r\n"), "HD Oabc\r\n");
+    EXPECT_EQ(roundTrip(fd, "mg key v k s\r\n", "value\r\n"), "VA 5 kkey s5\r\nvalue\r\n");
+    EXPECT_EQ(roundTrip(fd, "mg key\r\n", "\r\n"), "HD\r\n");
+    EXPECT_EQ(roundTrip(fd, "ms key 1 ME\r\nx\r\n", "\r\n"), "NS\r\n");
+
+    // Quiet misses say nothing, so mn marks the end of the pipeline
+    EXPECT_EQ(roundTrip(fd, "mg missing v q\r\nms other 2 q\r\nhi\r\nmg other v q\r\nmn\r\n", "MN\r\n"),
+              "VA 2\r\nhi\r\nMN\r\n");
+    EXPECT_EQ(roundTrip(fd, "md key\r\nmd key\r\nmg key v\r\n", "EN\r\n"), "HD\r\nNF\r\nEN\r\n");
+    close(fd);
+}
+
+TEST(TestMemcachedServer, TestUnixSocket)
+{
+    const std::string path = "MemcachedUnixTest.sock";
+    removeShardFiles("MemcachedUnixTest.db", 2);
+    ShardedDataStore store(100, 2, "MemcachedUnixTest.db");
+    {
+        EventLoopServer server("unix:" + path, memcached(store), 2);
+
+        int first = connectUnix(path);
+        int second = connectUnix(path);
+        ASSERT_GE(first, 0);
+        ASSERT_GE(second, 0);
+        EXPECT_EQ(roundTrip(first, "set shared 0 0 2\r\nok\r\n", "\r\n"), "STORED\r\n");
+        EXPECT_EQ(roundTrip(second, "get shared\r\n", "END\r\n"), "VALUE shared 0 2\r\nok\r\nEND\r\n");
+        close(first);
+        close(second);
+    }
+
+    // The socket file goes away with the server
+    EXPECT_EQ(access(path.c_str(), F_OK), -1);
+}
+
+TEST(TestRespServer, TestPipelinedCommands)
+{
+    removeShardFiles("RespPipelineTest.db", 4);
+    ShardedDataStore store(100, 4, "RespPipelineTest.db");
+    KeyExpiry expiry;
+    EventLoopServer server("127.0.0.1:0", resp(store, expiry), 2);
+
+    int fd = connectTcp(server.port());
+    ASSERT_GE(fd, 0);
+
+    EXPECT_EQ(roundTrip(fd, "PING\r\n", "\r\n"), "+PONG\r\n");
+
+    // A pipeline of writes and then reads, with a command split across two writes
+    std::string pipeline = command({"SET", "a", "1"}) + command({"MSET", "b", "2", "c", "3"}) +
+                           command({"get", "a"}) + command({"MGET", "a", "b", "missing", "c"}) + command({"GET", "c"});
+    sendAll(fd, pipeline.substr(0, 20));
+    usleep(10000);
+    EXPECT_EQ(roundTrip(fd, pipeline.substr(20), "$1\r\n3\r\n"),
+              "+OK\r\n+OK\r\n$1\r\n1\r\n*4\r\n$1\r\n1\r\n$1\r\n2\r\n$-1\r\n$1\r\n3\r\n$1\r\n3\r\n");
+
+    EXPECT_EQ(roundTrip(fd, command({"DEL", "a", "b", "missing"}), "\r\n"), ":2\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"EXISTS", "a", "c"}), "\r\n"), ":1\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"SET", "c", "4", "NX"}), "\r\n"), "$-1\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"GET"}), "\r\n"), "-ERR wrong number of arguments for 'get' command\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"FLUSHALL"}), "\r\n"), "-ERR unknown command 'FLUSHALL'\r\n");
+
+    // A command name can not end the error line early, and is cut short
+    EXPECT_EQ(roundTrip(fd, command({"X\r\n+OK"}), "\r\n"), "-ERR unknown command 'X  +OK'\r\n");
+    EXPECT_EQ(roundTrip(fd, command({std::string(1000, 'Y')}), "\r\n"), "-ERR unknown command '" + std::string(128, 'Y') + "'\r\n");
+
+    // RESP3 sends nulls as such
+    EXPECT_EQ(roundTrip(fd, command({"HELLO", "3"}), ":3\r\n"),
+              "%3\r\n$6\r\nserver\r\n$9\r\ndatastore\r\n$7\r\nversion\r\n$5\r\n1.0.0\r\n$5\r\nproto\r\n:3\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"GET", "missing"}), "\r\n"), "_\r\n");
+
+    EXPECT_EQ(roundTrip(fd, command({"QUIT"}), "\r\n"), "+OK\r\n");
+    close(fd);
+    EXPECT_EQ(store.get("c"), "3");
+}
+
+TEST(TestRespServer, TestExpire)
+{
+    removeShardFiles("RespExpireTest.db", 2);
+    ShardedDataStore store(100, 2, "RespExpireTest.db");
+    KeyExpiry expiry;
+    EventLoopServer server("127.0.0.1:0", resp(store, expiry), 1);
+
+    int fd = connectTcp(server.port());
+    ASSERT_GE(fd, 0);
+
+    EXPECT_EQ(roundTrip(fd, command({"SET", "short", "x", "PX", "50"}), "\r\n"), "+OK\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"SET", "long", "y"}), "\r\n"), "+OK\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"TTL", "long"}), "\r\n"), ":-1\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"EXPIRE", "long", "100"}), "\r\n"), ":1\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"TTL", "long"}), "\r\n"), ":100\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"EXPIRE", "missing", "100"}), "\r\n"), ":0\r\n");
+
+    usleep(100000);
+    EXPECT_EQ(roundTrip(fd, command({"GET", "short"}), "\r\n"), "$-1\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"TTL", "short"}), "\r\n"), ":-2\r\n");
+    EXPECT_EQ(store.get("short"), "");
+
+    // A plain SET clears the expiry, and a non-positive one deletes the key
+    EXPECT_EQ(roundTrip(fd, command({"SET", "long", "z"}), "\r\n"), "+OK\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"TTL", "long"}), "\r\n"), ":-1\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"EXPIRE", "long", "0"}), "\r\n"), ":1\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"GET", "long"}), "\r\n"), "$-1\r\n");
+
+    // Expiry times so far away that they would overflow the clock are refused
+    EXPECT_EQ(roundTrip(fd, command({"SET", "huge", "x", "EX", "999999999999999999"}), "\r\n"), 
+              "-ERR invalid expire time in 'set' command\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"SET", "huge", "x", "PX", "999999999999999999"}), "\r\n"), 
+              "-ERR invalid expire time in 'set' command\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"SET", "huge", "x", "EX", "0"}), "\r\n"), 
+              "-ERR invalid expire time in 'set' command\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"SET", "huge", "x", "PX", "-5"}), "\r\n"), 
+              "-ERR invalid expire time in 'set' command\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"SET", "huge", "x", "EX", "soon"}), "\r\n"), 
+              "-ERR value is not an integer or out of range\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"GET", "huge"}), "\r\n"), "$-1\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"SET", "huge", "x"}), "\r\n"), "+OK\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"EXPIRE", "huge", "999999999999999999"}), "\r\n"), 
+              "-ERR invalid expire time in 'expire' command\r\n");
+    EXPECT_EQ(roundTrip(fd, command({"TTL", "huge"}), "\r\n"), ":-1\r\n");
+    close(fd);
+}
+
+TEST(TestOutputQueue, TestSharedBuffers)
+{
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    auto big = std::make_shared<const std::string>(std::string(4 * 1024 * 1024, 'b'));
+    std::string expected = "head" + *big + "small" + std::string(8192, 'm') + "tail";
+
+    OutputQueue output;
+    output += "head";
+    output.appendShared(big);
+    output.appendValue("small");
+    output.appendValue(std::string(8192, 'm'));
+    output += "tail";
+    EXPECT_EQ(output.size(), expected.size());
+
+    // The socket fills up long before 4 MiB, so the queue is sent in many partial writes
+    std::string received;
+    std::thread reader([&]() {
+        char buffer[65536];
+        while (received.size() < expected.size())
+        {
+            ssize_t count = recv(fds[1], buffer, sizeof(buffer), 0);
+            if (count <= 0)
+            {
+                break;
+            }
+            received.append(buffer, static_cast<size_t>(count));
+        }
+    });
+    while (!output.empty())
+    {
+        ASSERT_EQ(output.send(fds[0]), true);
+        std::this_thread::yield();
+    }
+    reader.join();
+
+    EXPECT_EQ(received == expected, true);
+    // The queue let go of the shared buffer once it was sent
+    EXPECT_EQ(big.use_count(), 1);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(TestMemcachedServer, TestLargeValues)
+{
+    removeShardFiles("MemcachedLargeTest.db", 2);
+    ShardedDataStore store(100, 2, "MemcachedLargeTest.db");
+    EventLoopServer server("127.0.0.1:0", memcached(store), 1);
+
+    int fd = connectTcp(server.port());
+    ASSERT_GE(fd, 0);
+
+    std::string value(2 * 1024 * 1024, 'v');
+    EXPECT_EQ(roundTrip(fd, "set big 0 0 " + std::to_string(value.size()) + "\r\n" + value + "\r\n", "\r\n"), "STORED\r\n");
+
+    std::string expected;
+    for (int i = 0; i < 4; ++i)
+    {
+        expected += "VALUE big 0 " + std::to_string(value.size()) + "\r\n" + value + "\r\nEND\r\n";
+    }
+    sendAll(fd, "get big\r\nget big\r\nget big\r\nget big\r\n");
+    std::string response = readExactly(fd, expected.size());
+    EXPECT_EQ(response.size(), expected.size());
+    EXPECT_EQ(response == expected, true);
+    close(fd);
+}
+
+TEST(TestEventLoopServer, TestInputLimit)
+{
+    EventLoopServer server("127.0.0.1:0", []() {
+        return std::unique_ptr<ProtocolHandler>(new StallingProtocol());
+    }, 1, 4096);
+
+    int fd = connectTcp(server.port());
+    ASSERT_GE(fd, 0);
+    sendAll(fd, std::string(3000, 'x'));
+    sendAll(fd, std::string(64 * 1024, 'x'));
+
+    // The server closes the connection instead of buffering without limit (with a reset, as
+    // it never read everything that was sent)
+    timeval timeout = timeval();
+    timeout.tv_sec = 5;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char buffer[16];
+    ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+    EXPECT_TRUE(count == 0 || (count < 0 && errno == ECONNRESET));
+    close(fd);
+}
+
+TEST(TestHashRing, TestMinimalMovement)
+{
+    HashRing ring;
+    ring.addNode("first");
+    ring.addNode("second");
+    ring.addNode("third");
+
+    std::vector<size_t> before;
+    for (int i = 0; i < 10000; ++i)
+    {
+        before.push_back(ring.nodeOf("key" + std::to_string(i)));
+    }
+
+    // Adding a fourth node only moves keys onto it, about a quarter of them
+    ring.addNode("fourth");
+    size_t moved = 0;
+    for (int i = 0; i < 10000; ++i)
+    {
+        size_t node = ring.nodeOf("key" + std::to_string(i));
+        if (node != before[i])
+        {
+            EXPECT_EQ(node, 3);
+            ++moved;
+        }
+    }
+    EXPECT_GT(moved, 1500);
+    EXPECT_LT(moved, 3500);
+}
+
+TEST(TestDataStoreClient, TestSeveralServers)
+{
+    removeShardFiles("ClientFirst.db", 2);
+    removeShardFiles("ClientSecond.db", 2);
+    ShardedDataStore first_store(1000, 2, "ClientFirst.db");
+    ShardedDataStore second_store(1000, 2, "ClientSecond.db");
+    EventLoopServer first("127.0.0.1:0", memcached(first_store), 1);
+    EventLoopServer second("127.0.0.1:0", memcached(second_store), 1);
+
+    DataStoreClient client({"127.0.0.1:" + std::to_string(first.port()), "127.0.0.1:" + std::to_string(second.port())}, 2);
+    std::vector<std::string> keys;
+    for (int i = 0; i < 200; ++i)
+    {
+        keys.push_back("key" + std::to_string(i));
+        client.put(keys.back(), "value" + std::to_string(i));
+    }
+
+    EXPECT_EQ(client.get("key7"), "value7");
+    EXPECT_EQ(client.get("missing"), "");
+    std::vector<std::string> values = client.getMany(keys);
+    ASSERT_EQ(values.size(), keys.size());
+    for (int i = 0; i < 200; ++i)
+    {
+        EXPECT_EQ(values[i], "value" + std::to_string(i));
+    }
+
+    // Both servers got a share of the keys
+    EXPECT_GT(first_store.size(), 50);
+    EXPECT_GT(second_store.size(), 50);
+    EXPECT_EQ(first_store.size() + second_store.size(), 200);
+
+    EXPECT_TRUE(client.erase("key7"));
+    EXPECT_FALSE(client.erase("key7"));
+    EXPECT_EQ(client.get("key7"), "");
+    EXPECT_THROW(client.put("bad key", "value"), std::invalid_argument);
+}
+
+TEST(TestDataStoreClient, TestConcurrentGets)
+{
+    removeShardFiles("ClientConcurrent.db", 2);
+    ShardedDataStore store(1000, 2, "ClientConcurrent.db");
+    EventLoopServer server("127.0.0.1:0", memcached(store), 1);
+
+    // A single connection, so the threads' requests share (and are pipelined on) it
+    DataStoreClient client({"127.0.0.1:" + std::to_string(server.port())}, 1);
+    for (int i = 0; i < 100; ++i)
+    {
+        client.put("key" + std::to_string(i), std::string(i * 50, 'a' + i % 26));
+    }
+
+    std::vector<std::thread> threads;
+    std::vector<int> failures(8, 0);
+    for (int t = 0; t < 8; ++t)
+    {
+        threads.emplace_back([&client, &failures, t]() {
+            for (int i = 0; i < 300; ++i)
+            {
+                int key = (i * 7 + t) % 100;
+                if (client.get("key" + std::to_string(key)) != std::string(key * 50, 'a' + key % 26))
+                {
+                    ++failures[t];
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    for (int t = 0; t < 8; ++t)
+    {
+        EXPECT_EQ(failures[t], 0);
+    }
+}
+
+TEST(TestDataStoreClient, TestServerDown)
+{
+    std::string address;
+    {
+        removeShardFiles("ClientDown.db", 1);
+        ShardedDataStore store(100, 1, "ClientDown.db");
+        EventLoopServer server("127.0.0.1:0", memcached(store), 1);
+        address = "127.0.0.1:" + std::to_string(server.port());
+    }
+
+    DataStoreClient client({address}, 1);
+    EXPECT_THROW(client.get("key"), std::runtime_error);
+}
+
+TEST(TestDataStoreClient, TestServerNeverReplies)
+{
+    // The kernel completes connections to a listening socket that nobody accepts from, so
+    // requests are sent but never answered
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = sockaddr_in();
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+    ASSERT_EQ(listen(listener, 16), 0);
+    socklen_t length = sizeof(address);
+    getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length);
+
+    DataStoreClient client({"127.0.0.1:" + std::to_string(ntohs(address.sin_port))}, 1, 100);
+    EXPECT_THROW(client.get("key"), std::runtime_error);
+    // The failed batch must not leave the connection marked busy
+    EXPECT_THROW(client.get("key"), std::runtime_error);
+    close(listener);
+}
+
+TEST(TestPartitionedDataStore, TestRemoteNodes)
+{
+    removeShardFiles("PartitionRemoteFirst.db", 2);
+    removeShardFiles("PartitionRemoteSecond.db", 2);
+    ShardedDataStore first_store(1000, 2, "PartitionRemoteFirst.db");
+    ShardedDataStore second_store(1000, 2, "PartitionRemoteSecond.db");
+    EventLoopServer first("127.0.0.1:0", memcached(first_store), 1);
+    EventLoopServer second("127.0.0.1:0", memcached(second_store), 1);
+
+    PartitionedDataStore<DataStoreClient> ds;
+    std::string first_address = "127.0.0.1:" + std::to_string(first.port());
+    ds.addNode(first_address, std::unique_ptr<DataStoreClient>(new DataStoreClient({first_address}, 1)));
+    for (int i = 0; i < 100; ++i)
+    {
+        ds.put("key" + std::to_string(i), "value" + std::to_string(i));
+    }
+    EXPECT_EQ(first_store.size(), 100);
+
+    // Growing onto a second server moves part of the keys there as they are read
+    std::string second_address = "127.0.0.1:" + std::to_string(second.port());
+    ds.addNode(second_address, std::unique_ptr<DataStoreClient>(new DataStoreClient({second_address}, 1)));
+    for (int i = 0; i < 100; ++i)
+    {
+        EXPECT_EQ(ds.get("key" + std::to_string(i)), "value" + std::to_string(i));
+    }
+    EXPECT_GT(second_store.size(), 20);
+    EXPECT_EQ(first_store.size() + second_store.size(), 100);
+}
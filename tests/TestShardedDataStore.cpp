@@ -0,0 +1,664 @@
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <gtest/gtest.h>
+
+#include "ShardedDataStore.h"
+#include "PartitionedDataStore.h"
+
+static void removeShardFiles(const std::string& name, size_t shards)
+{
+    for (size_t i = 0; i < shards; ++i)
+    {
+        std::remove((name + ".shard" + std::to_string(i)).c_str());
+    }
+}
+
+TEST(TestShardedDataStore, TestConcurrentPutGet)
+{
+    removeShardFiles("ShardTest.db", 4);
+    ShardedDataStore ds(40, 4, "ShardTest.db");
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&ds, t]() {
+            for (int i = 0; i < 250; ++i)
+            {
+                std::string key = std::to_string(t * 1000 + i);
+                ds.put(key, "value" + key);
+                EXPECT_EQ(ds.get(key), "value" + key);
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    EXPECT_LE(ds.size(), 40);
+    std::vector<std::string> values = ds.getMany({"0", "3249", "missing"});
+    EXPECT_EQ(values[0], "value0");
+    EXPECT_EQ(values[1], "value3249");
+    EXPECT_EQ(values[2], "");
+}
+
+TEST(TestShardedDataStore, TestShardsSpreadOverPartitions)
+{
+    // Three shards of three partitions each, where picking the shard and the partition from
+    // the same hash would leave some partitions with far more keys than others
+    DataStoreOptions options;
+    options.partitions = 3;
+    for (size_t shard = 0; shard < 3; ++shard)
+    {
+        for (size_t partition = 0; partition < 3; ++partition)
+        {
+            std::remove(("SpreadTest.db.shard" + std::to_string(shard) + "." + std::to_string(partition)).c_str());
+        }
+    }
+    {
+        ShardedDataStore ds(9000, 3, "SpreadTest.db", options);
+        for (int i = 0; i < 9000; ++i)
+        {
+            ds.put("key" + std::to_string(i), "value");
+        }
+    }
+
+    for (size_t shard = 0; shard < 3; ++shard)
+    {
+        for (size_t partition = 0; partition < 3; ++partition)
+        {
+            sqlite3* db;
+            std::string path = "SpreadTest.db.shard" + std::to_string(shard) + "." + std::to_string(partition);
+            ASSERT_EQ(sqlite3_open(path.c_str(), &db), SQLITE_OK);
+            sqlite3_stmt* stmt;
+            ASSERT_EQ(sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM data;", -1, &stmt, NULL), SQLITE_OK);
+            ASSERT_EQ(sqlite3_step(stmt), SQLITE_ROW);
+            int count = sqlite3_column_int(stmt, 0);
+            EXPECT_GT(count, 850) << path;
+            EXPECT_LT(count, 1150) << path;
+            sqlite3_finalize(stmt);
+            sqlite3_close(db);
+        }
+    }
+}
+
+TEST(TestShardedDataStore, TestFlushAndWarmUp)
+{
+    removeShardFiles("WarmUpTest.db", 3);
+    {
+        ShardedDataStore ds(300, 3, "WarmUpTest.db");
+        for (int i = 0; i < 30; ++i)
+        {
+            ds.put(std::to_string(i), "value" + std::to_string(i));
+        }
+    }
+
+    // Everything should have been flushed on shutdown and be loaded back by the warm up
+    ShardedDataStore ds(300, 3, "WarmUpTest.db");
+    EXPECT_EQ(ds.size(), 0);
+    EXPECT_EQ(ds.warmUp(), 30);
+    EXPECT_EQ(ds.size(), 30);
+    for (int i = 0; i < 30; ++i)
+    {
+        EXPECT_EQ(ds.isInCache(std::to_string(i)), true);
+        EXPECT_EQ(ds.get(std::to_string(i)), "value" + std::to_string(i));
+    }
+}
+
+TEST(TestShardedDataStore, TestSnapshotWhileServing)
+{
+    removeShardFiles("ShardSnapshotSource.db", 2);
+    removeShardFiles("ShardSnapshot.db", 2);
+
+    ShardedDataStore ds(1000, 2, "ShardSnapshotSource.db");
+    for (int i = 0; i < 200; ++i)
+    {
+        ds.put(std::to_string(i), std::string(500, 'x'));
+    }
+
+    // Keep serving traffic while the snapshot is taken
+    std::thread writer([&ds]() {
+        for (int i = 200; i < 400; ++i)
+        {
+            ds.put(std::to_string(i), "late");
+        }
+    });
+    ASSERT_EQ(ds.snapshot("ShardSnapshot.db", 1), true);
+    writer.join();
+
+    ShardedDataStore copy(10, 2, "ShardSnapshot.db");
+    for (int i = 0; i < 200; ++i)
+    {
+        EXPECT_EQ(copy.get(std::to_string(i)), std::string(500, 'x'));
+    }
+}
+
+TEST(TestShardedDataStore, TestPointInTimeSnapshot)
+{
+    removeShardFiles("ShardWalSnapshotSource.db", 3);
+    removeShardFiles("ShardWalSnapshot.db", 3);
+
+    DataStoreOptions options;
+    options.wal = true;
+    ShardedDataStore ds(1000, 3, "ShardWalSnapshotSource.db", options);
+    for (int i = 0; i < 200; ++i)
+    {
+        ds.put(std::to_string(i), std::string(500, 'x'));
+    }
+
+    std::thread writer([&ds]() {
+        for (int i = 200; i < 400; ++i)
+        {
+            ds.put(std::to_string(i), "late");
+        }
+    });
+    ASSERT_EQ(ds.snapshot("ShardWalSnapshot.db", 1), true);
+    writer.join();
+
+    // The copy is of one moment across all shards, so the late keys it has are the first ones written
+    ShardedDataStore copy(10, 3, "ShardWalSnapshot.db");
+    for (int i = 0; i < 200; ++i)
+    {
+        EXPECT_EQ(copy.get(std::to_string(i)), std::string(500, 'x'));
+    }
+    int late = 200;
+    while (late < 400 && copy.get(std::to_string(late)) == "late")
+    {
+        ++late;
+    }
+    for (int i = late; i < 400; ++i)
+    {
+        EXPECT_EQ(copy.get(std::to_string(i)), "");
+    }
+}
+
+TEST(TestShardedDataStore, TestFlashTier)
+{
+    removeShardFiles("ShardFlashTierTest.db", 3);
+
+    DataStoreOptions options;
+    options.flash_tier_path = "ShardFlashTierTest.cache";
+    options.flash_tier_bytes = 64 * 1024;
+
+    {
+        ShardedDataStore ds(3, 3, "ShardFlashTierTest.db", options);
+        for (int i = 0; i < 30; ++i)
+        {
+            ds.put(std::to_string(i), "value" + std::to_string(i));
+        }
+
+        // Every shard has a cache file of its own
+        for (int i = 0; i < 3; ++i)
+        {
+            FILE* file = std::fopen(("ShardFlashTierTest.cache.shard" + std::to_string(i)).c_str(), "r");
+            ASSERT_NE(file, nullptr);
+            std::fclose(file);
+        }
+
+        // Change the stored copies behind the data store's back to prove every value is served 
+        // from its shard's tier, and none was overwritten by another shard
+        for (int i = 0; i < 3; ++i)
+        {
+            sqlite3* db;
+            ASSERT_EQ(sqlite3_open(("ShardFlashTierTest.db.shard" + std::to_string(i)).c_str(), &db), SQLITE_OK);
+            ASSERT_EQ(sqlite3_exec(db, "UPDATE data SET value = 'from disk';", NULL, nullptr, nullptr), SQLITE_OK);
+            sqlite3_close(db);
+        }
+        for (int i = 0; i < 30; ++i)
+        {
+            EXPECT_EQ(ds.get(std::to_string(i)), "value" + std::to_string(i));
+        }
+    }
+
+    for (int i = 0; i < 3; ++i)
+    {
+        EXPECT_EQ(std::fopen(("ShardFlashTierTest.cache.shard" + std::to_string(i)).c_str(), "r"), nullptr);
+    }
+}
+
+TEST(TestShardedDataStore, TestBackgroundSave)
+{
+    removeShardFiles("ShardBackgroundSaveTest.db", 2);
+
+    ShardedDataStore ds(100, 2, "ShardBackgroundSaveTest.db");
+    for (int i = 0; i < 20; ++i)
+    {
+        ds.put(std::to_string(i), "value" + std::to_string(i));
+    }
+
+    pid_t pid = ds.backgroundSave("ShardBackgroundSave.snapshot");
+    ASSERT_GT(pid, 0);
+    ASSERT_EQ(DataStore::waitForBackgroundSave(pid), true);
+
+    size_t restored = 0;
+    for (int i = 0; i < 2; ++i)
+    {
+        std::string name = "ShardRestoreTest.db." + std::to_string(i);
+        std::remove(name.c_str());
+        DataStore shard(100, name);
+        restored += shard.restoreCache("ShardBackgroundSave.snapshot.shard" + std::to_string(i));
+    }
+    EXPECT_EQ(restored, 20);
+}
+
+TEST(TestShardedDataStore, TestHotKeyReplication)
+{
+    removeShardFiles("HotKeyTest.db", 4);
+    ShardedDataStoreOptions sharding;
+    sharding.hot_keys = 2;
+    ShardedDataStore ds(1000, 4, "HotKeyTest.db", DataStoreOptions(), sharding);
+    for (int i = 0; i < 100; ++i)
+    {
+        ds.put("key" + std::to_string(i), "value" + std::to_string(i));
+    }
+
+    // One key takes most of the reads, so it gets replicated
+    for (int i = 0; i < 20000; ++i)
+    {
+        EXPECT_EQ(ds.get("key7"), "value7");
+        if (i % 10 == 0)
+        {
+            ds.get("key" + std::to_string(i % 100));
+        }
+    }
+    EXPECT_GE(ds.hotKeyCount(), 1);
+    EXPECT_GT(ds.stats().replica_reads, 10000);
+
+    // Readers never see a value go backwards while the hot key is being written
+    std::atomic<bool> stop(false);
+    std::vector<int> failures(4, 0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t)
+    {
+        readers.emplace_back([&ds, &stop, &failures, t]() {
+            int last = 0;
+            while (!stop)
+            {
+                std::string value = ds.get("key7");
+                int version = value.compare(0, 7, "version") == 0 ? std::stoi(value.substr(7)) : 0;
+                if (version < last)
+                {
+                    ++failures[t];
+                }
+                last = version;
+            }
+        });
+    }
+    for (int i = 1; i <= 2000; ++i)
+    {
+        ds.put("key7", "version" + std::to_string(i));
+    }
+    stop = true;
+    for (std::thread& reader : readers)
+    {
+        reader.join();
+    }
+    for (int t = 0; t < 4; ++t)
+    {
+        EXPECT_EQ(failures[t], 0);
+    }
+
+    EXPECT_EQ(ds.get("key7"), "version2000");
+    EXPECT_TRUE(ds.erase("key7"));
+    EXPECT_EQ(ds.get("key7"), "");
+}
+
+TEST(TestShardedDataStore, TestHotKeysWhileServedFromReplicas)
+{
+    removeShardFiles("HotKeyWindowTest.db", 1);
+    ShardedDataStoreOptions sharding;
+    sharding.hot_keys = 2;
+    ShardedDataStore ds(100, 1, "HotKeyWindowTest.db", DataStoreOptions(), sharding);
+    ds.put("a", "1");
+    ds.put("b", "2");
+    for (int i = 0; i < 5000; ++i)
+    {
+        ds.get("a");
+    }
+    EXPECT_EQ(ds.hotKeyCount(), 1);
+
+    // Almost every read is now served by a replica, but they still count toward picking hot keys
+    for (int i = 0; i < 20000; ++i)
+    {
+        ds.get("a");
+        if (i % 50 == 0)
+        {
+            ds.get("b");
+        }
+    }
+    EXPECT_EQ(ds.hotKeyCount(), 2);
+}
+
+TEST(TestShardedDataStore, TestHotKeysStayCached)
+{
+    removeShardFiles("HotKeyLruTest.db", 1);
+    ShardedDataStoreOptions sharding;
+    sharding.hot_keys = 1;
+    ShardedDataStore ds(1000, 1, "HotKeyLruTest.db", DataStoreOptions(), sharding);
+    for (int i = 0; i < 3000; ++i)
+    {
+        ds.put(std::to_string(i), "cold");
+    }
+    ds.put("a", "hot");
+    for (int i = 0; i < 5000; ++i)
+    {
+        ds.get("a");
+    }
+    ASSERT_EQ(ds.hotKeyCount(), 1);
+
+    // The hot key is read from its replica, while several times the cache's worth of cold
+    // keys go through the shard, and it still is not the one evicted
+    for (int i = 0; i < 30000; ++i)
+    {
+        EXPECT_EQ(ds.get("a"), "hot");
+        if (i % 10 == 0)
+        {
+            EXPECT_EQ(ds.get(std::to_string(i / 10)), "cold");
+        }
+    }
+    EXPECT_EQ(ds.hotKeyCount(), 1);
+    EXPECT_EQ(ds.isInCache("a"), true);
+}
+
+TEST(TestShardedDataStore, TestReplicasFollowOtherWriters)
+{
+    removeShardFiles("ReplicaChangeTest.db", 1);
+    DataStoreOptions options;
+    options.change_tracking = true;
+    options.change_check_interval_ms = 50;
+    ShardedDataStoreOptions sharding;
+    sharding.hot_keys = 1;
+    {
+        DataStore other(10, "ReplicaChangeTest.db.shard0", options);
+        other.put("a", "old");
+    }
+    ShardedDataStore ds(100, 1, "ReplicaChangeTest.db", options, sharding);
+    for (int i = 0; i < 5000; ++i)
+    {
+        ds.get("a");
+    }
+    ASSERT_EQ(ds.hotKeyCount(), 1);
+    EXPECT_EQ(ds.get("a"), "old");
+
+    // Another connection changes the hot key, which is seen within the check interval
+    {
+        DataStore other(10, "ReplicaChangeTest.db.shard0", options);
+        other.put("a", "new");
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(ds.get("b"), "");
+    EXPECT_EQ(ds.get("a"), "new");
+
+    // Without a check interval, every read goes to the shard
+    removeShardFiles("ReplicaNoIntervalTest.db", 1);
+    options.change_check_interval_ms = 0;
+    ShardedDataStore checked(100, 1, "ReplicaNoIntervalTest.db", options, sharding);
+    checked.put("a", "1");
+    for (int i = 0; i < 5000; ++i)
+    {
+        checked.get("a");
+    }
+    EXPECT_EQ(checked.hotKeyCount(), 0);
+}
+
+TEST(TestShardedDataStore, TestNumaPlacement)
+{
+    removeShardFiles("NumaTest.db", 4);
+    ShardedDataStoreOptions sharding;
+    sharding.numa_aware = true;
+    ShardedDataStore ds(1000, 4, "NumaTest.db", DataStoreOptions(), sharding);
+
+    // The shards go to the nodes in turn (a machine without NUMA has the single node 0)
+    int nodes = numaNodeCount();
+    for (size_t i = 0; i < ds.shardCount(); ++i)
+    {
+        EXPECT_EQ(ds.shardNode(i), static_cast<int>(i % nodes));
+    }
+
+    for (int i = 0; i < 100; ++i)
+    {
+        ds.put("key" + std::to_string(i), "value" + std::to_string(i));
+        EXPECT_EQ(ds.get("key" + std::to_string(i)), "value" + std::to_string(i));
+    }
+    ShardedDataStore::Stats stats = ds.stats();
+    EXPECT_EQ(stats.local_accesses + stats.remote_accesses, 200);
+    if (nodes == 1)
+    {
+        EXPECT_EQ(stats.remote_accesses, 0);
+    }
+    EXPECT_GE(stats.remote_access_ratio, 0);
+    EXPECT_LE(stats.remote_access_ratio, 1);
+}
+
+TEST(TestShardedDataStore, TestStripedStats)
+{
+    StripedCounter counter(4);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&counter]() {
+            for (int i = 0; i < 100000; ++i)
+            {
+                counter.add();
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    EXPECT_EQ(counter.value(), 400000);
+
+    removeShardFiles("StatsTest.db", 4);
+    ShardedDataStore ds(100, 4, "StatsTest.db");
+    ds.put("first", "1");
+    ds.putMany({{"second", "2"}, {"third", "3"}});
+    ds.get("first");
+    ds.getMany({"second", "third", "missing"});
+    ds.erase("first");
+
+    ShardedDataStore::Stats stats = ds.stats();
+    EXPECT_EQ(stats.reads, 4);
+    EXPECT_EQ(stats.writes, 4);
+    EXPECT_EQ(stats.replica_reads, 0);
+}
+
+TEST(TestPartitionedDataStore, TestWeightsAndResize)
+{
+    for (const char* name : {"PartitionFirst.db", "PartitionSecond.db", "PartitionThird.db"})
+    {
+        std::remove(name);
+    }
+    PartitionedDataStore<DataStore> ds;
+    ds.addNode("first", std::unique_ptr<DataStore>(new DataStore(1000, "PartitionFirst.db")));
+    ds.addNode("second", std::unique_ptr<DataStore>(new DataStore(1000, "PartitionSecond.db")), 3.0);
+
+    // The second node has three times the weight, so it owns about three quarters of the keys
+    size_t owned = 0;
+    for (int i = 0; i < 10000; ++i)
+    {
+        owned += ds.nodeOf("key" + std::to_string(i));
+    }
+    EXPECT_GT(owned, 6500);
+    EXPECT_LT(owned, 8500);
+
+    std::vector<std::string> keys;
+    std::vector<size_t> before;
+    for (int i = 0; i < 400; ++i)
+    {
+        keys.push_back("key" + std::to_string(i));
+        ds.put(keys.back(), "value" + std::to_string(i));
+        before.push_back(ds.nodeOf(keys.back()));
+    }
+
+    // Only keys that now belong to the new node move, and they are still found there
+    ds.addNode("third", std::unique_ptr<DataStore>(new DataStore(1000, "PartitionThird.db")));
+    size_t moved = 0;
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        size_t node = ds.nodeOf(keys[i]);
+        if (node != before[i])
+        {
+            EXPECT_EQ(node, 2);
+            ++moved;
+        }
+    }
+    EXPECT_GT(moved, 0);
+    EXPECT_LT(moved, 200);
+
+    std::vector<std::string> values = ds.getMany(keys);
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        EXPECT_EQ(values[i], "value" + std::to_string(i));
+        EXPECT_EQ(ds.get(keys[i]), "value" + std::to_string(i));
+    }
+    // The moved keys were taken off their old nodes
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        if (ds.nodeOf(keys[i]) == 2)
+        {
+            EXPECT_EQ(ds.node(before[i]).get(keys[i]), "");
+            EXPECT_EQ(ds.node(2).get(keys[i]), "value" + std::to_string(i));
+        }
+    }
+
+    EXPECT_TRUE(ds.erase("key0"));
+    EXPECT_EQ(ds.get("key0"), "");
+}
+
+TEST(TestPartitionedDataStore, TestGrowTwice)
+{
+    for (const char* name : {"GrowFirst.db", "GrowSecond.db", "GrowThird.db", "GrowFourth.db"})
+    {
+        std::remove(name);
+    }
+    PartitionedDataStore<DataStore> ds;
+    ds.addNode("first", std::unique_ptr<DataStore>(new DataStore(1000, "GrowFirst.db")));
+    ds.addNode("second", std::unique_ptr<DataStore>(new DataStore(1000, "GrowSecond.db")));
+    for (int i = 0; i < 1000; ++i)
+    {
+        ds.put("key" + std::to_string(i), "value" + std::to_string(i));
+    }
+
+    // Add two nodes back to back, before any key has been read and moved
+    ds.addNode("third", std::unique_ptr<DataStore>(new DataStore(1000, "GrowThird.db")));
+    ds.addNode("fourth", std::unique_ptr<DataStore>(new DataStore(1000, "GrowFourth.db")));
+    for (int i = 0; i < 1000; ++i)
+    {
+        EXPECT_EQ(ds.get("key" + std::to_string(i)), "value" + std::to_string(i));
+    }
+
+    // Every key is now on its current node
+    for (int i = 0; i < 1000; ++i)
+    {
+        std::string key = "key" + std::to_string(i);
+        EXPECT_EQ(ds.node(ds.nodeOf(key)).get(key), "value" + std::to_string(i));
+    }
+}
+
+TEST(TestPartitionedDataStore, TestDropOldRings)
+{
+    for (const char* name : {"DrainFirst.db", "DrainSecond.db", "DrainThird.db"})
+    {
+        std::remove(name);
+    }
+    PartitionedDataStore<DataStore> ds(160, 2);
+    ds.addNode("first", std::unique_ptr<DataStore>(new DataStore(1000, "DrainFirst.db")));
+    std::vector<std::string> keys;
+    for (int i = 0; i < 200; ++i)
+    {
+        keys.push_back("key" + std::to_string(i));
+        ds.put(keys.back(), "value" + std::to_string(i));
+    }
+    ds.addNode("second", std::unique_ptr<DataStore>(new DataStore(1000, "DrainSecond.db")));
+    EXPECT_EQ(ds.ringCount(), 2);
+
+    // No more rings are kept than asked for, until the keys have been moved
+    EXPECT_THROW(ds.addNode("third", std::unique_ptr<DataStore>(new DataStore(1000, "DrainThird.db"))), std::logic_error);
+    EXPECT_GT(ds.migrateKeys(keys), 0);
+    EXPECT_EQ(ds.migrateKeys(keys), 0);
+    ds.dropOldRings();
+    EXPECT_EQ(ds.ringCount(), 1);
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        EXPECT_EQ(ds.get(keys[i]), "value" + std::to_string(i));
+    }
+    ds.addNode("third", std::unique_ptr<DataStore>(new DataStore(1000, "DrainThird.db")));
+    EXPECT_EQ(ds.ringCount(), 2);
+}
+
+/**
+ * @brief A thread safe node that can hold a get of one key until it is released
+ */
+class PausingNode
+{
+public:
+    PausingNode(const std::string& name) : m_store(100, 1, name) {}
+
+    void put(const std::string& key, const std::string& value) { m_store.put(key, value); }
+    bool erase(const std::string& key) { return m_store.erase(key); }
+    std::vector<std::string> getMany(const std::vector<std::string>& keys) { return m_store.getMany(keys); }
+
+    std::string get(const std::string& key)
+    {
+        if (key == pause_key)
+        {
+            paused = true;
+            while (!released)
+            {
+                std::this_thread::yield();
+            }
+        }
+        return m_store.get(key);
+    }
+
+    std::string pause_key;
+    std::atomic<bool> paused{false};
+    std::atomic<bool> released{false};
+
+private:
+    ShardedDataStore m_store;
+};
+
+TEST(TestPartitionedDataStore, TestEraseDuringMigration)
+{
+    removeShardFiles("PausingFirst.db", 1);
+    removeShardFiles("PausingSecond.db", 1);
+    PartitionedDataStore<PausingNode> ds;
+    PausingNode* first = new PausingNode("PausingFirst.db");
+    ds.addNode("first", std::unique_ptr<PausingNode>(first));
+    for (int i = 0; i < 100; ++i)
+    {
+        ds.put("key" + std::to_string(i), "value");
+    }
+    ds.addNode("second", std::unique_ptr<PausingNode>(new PausingNode("PausingSecond.db")));
+    std::string key;
+    for (int i = 0; i < 100 && key.empty(); ++i)
+    {
+        if (ds.nodeOf("key" + std::to_string(i)) == 1)
+        {
+            key = "key" + std::to_string(i);
+        }
+    }
+    ASSERT_FALSE(key.empty());
+
+    // A get moving the key holds while reading the old copy, and the key is erased meanwhile
+    first->pause_key = key;
+    std::thread reader([&ds, &key]() { ds.get(key); });
+    while (!first->paused)
+    {
+        std::this_thread::yield();
+    }
+    std::thread eraser([&ds, &key]() { ds.erase(key); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    first->released = true;
+    reader.join();
+    eraser.join();
+
+    first->pause_key.clear();
+    EXPECT_EQ(ds.get(key), "");
+}